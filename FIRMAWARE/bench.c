@@ -0,0 +1,188 @@
+/*
+ * Тест на скоростта на SD картата
+ *
+ * Натоварванията минават през FatFS и sd_read_block/sd_write_block -
+ * същия път, който използват пътеките и SmartPort блоковете.
+ */
+
+#include "bench.h"
+#include "perf.h"
+#include "ff.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <string.h>
+
+// FatFS file access mode definitions (ако не са дефинирани в ff.h)
+#ifndef FA_READ
+#define FA_READ         0x01
+#define FA_WRITE        0x02
+#define FA_CREATE_ALWAYS 0x08
+#endif
+
+static uint8_t bench_buffer[BENCH_CHUNK_SIZE];
+static FIL bench_file;
+
+// xorshift32 - повторяеми случайни позиции
+static uint32_t bench_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Ред с резултата: MB/s, IOPS и закъснения на една операция
+static void bench_report(bench_print_t print, const char *name, const perf_stat_t *stat,
+                         uint32_t bytes, uint32_t elapsed_us) {
+    char line[160];
+    if (elapsed_us == 0) {
+        elapsed_us = 1;
+    }
+    uint32_t kb_per_s = (uint32_t)((uint64_t)bytes * 1000000 / 1024 / elapsed_us);
+    uint32_t iops = (uint32_t)((uint64_t)stat->count * 1000000 / elapsed_us);
+
+    snprintf(line, sizeof(line), "%-8s %lu.%02lu MB/s %5lu IOPS  p50=%lu p99=%lu max=%lu µs\r\n",
+             name, (unsigned long)(kb_per_s / 1024), (unsigned long)((kb_per_s % 1024) * 100 / 1024),
+             (unsigned long)iops, (unsigned long)perf_stat_percentile(stat, 50),
+             (unsigned long)perf_stat_percentile(stat, 99), (unsigned long)stat->max);
+    print(line);
+}
+
+static void bench_error(bench_print_t print, const char *step, FRESULT res) {
+    char line[96];
+    snprintf(line, sizeof(line), "ГРЕШКА: %s (код: %d)\r\n", step, res);
+    print(line);
+}
+
+// Последователен запис и четене на целия файл на части от BENCH_CHUNK_SIZE
+static bool bench_sequential(uint32_t size, bench_print_t print) {
+    perf_stat_t stat;
+    UINT done;
+
+    for (uint32_t i = 0; i < sizeof(bench_buffer); i++) {
+        bench_buffer[i] = (uint8_t)(i * 7);
+    }
+
+    perf_stat_reset(&stat);
+    uint32_t start = time_us_32();
+    for (uint32_t pos = 0; pos < size; pos += BENCH_CHUNK_SIZE) {
+        uint32_t op = time_us_32();
+        FRESULT res = f_write(&bench_file, bench_buffer, BENCH_CHUNK_SIZE, &done);
+        if (res != FR_OK || done != BENCH_CHUNK_SIZE) {
+            bench_error(print, "последователен запис", res);
+            return false;
+        }
+        perf_stat_add(&stat, time_us_32() - op);
+    }
+    f_sync(&bench_file);
+    bench_report(print, "seq wr", &stat, size, time_us_32() - start);
+
+    f_lseek(&bench_file, 0);
+    perf_stat_reset(&stat);
+    start = time_us_32();
+    for (uint32_t pos = 0; pos < size; pos += BENCH_CHUNK_SIZE) {
+        uint32_t op = time_us_32();
+        FRESULT res = f_read(&bench_file, bench_buffer, BENCH_CHUNK_SIZE, &done);
+        if (res != FR_OK || done != BENCH_CHUNK_SIZE) {
+            bench_error(print, "последователно четене", res);
+            return false;
+        }
+        perf_stat_add(&stat, time_us_32() - op);
+    }
+    bench_report(print, "seq rd", &stat, size, time_us_32() - start);
+    return true;
+}
+
+// Случайни четения на подравнени блокове от 512 байта
+static bool bench_random_reads(uint32_t size, bench_print_t print) {
+    perf_stat_t stat;
+    uint32_t seed = time_us_32() | 1;
+    uint32_t blocks = size / 512;
+    UINT done;
+
+    perf_stat_reset(&stat);
+    uint32_t start = time_us_32();
+    for (uint32_t i = 0; i < BENCH_RANDOM_READS; i++) {
+        uint32_t block = bench_random(&seed) % blocks;
+        uint32_t op = time_us_32();
+        FRESULT res = f_lseek(&bench_file, (FSIZE_t)block * 512);
+        if (res == FR_OK) {
+            res = f_read(&bench_file, bench_buffer, 512, &done);
+        }
+        if (res != FR_OK || done != 512) {
+            bench_error(print, "случайно четене", res);
+            return false;
+        }
+        perf_stat_add(&stat, time_us_32() - op);
+    }
+    bench_report(print, "rand rd", &stat, BENCH_RANDOM_READS * 512, time_us_32() - start);
+    return true;
+}
+
+// Disk II: четене на пътека, запис на един сектор и f_sync - както при смяна на пътека след запис
+static bool bench_disk2(bench_print_t print) {
+    perf_stat_t stat;
+    uint32_t seed = time_us_32() | 1;
+    UINT done;
+
+    perf_stat_reset(&stat);
+    uint32_t start = time_us_32();
+    for (uint32_t track = 0; track < BENCH_DISK2_TRACKS; track++) {
+        uint32_t sector = bench_random(&seed) % (BENCH_DISK2_TRACK_SIZE / BENCH_DISK2_SECTOR_SIZE);
+        uint32_t op = time_us_32();
+
+        FRESULT res = f_lseek(&bench_file, (FSIZE_t)track * BENCH_DISK2_TRACK_SIZE);
+        if (res == FR_OK) {
+            res = f_read(&bench_file, bench_buffer, BENCH_DISK2_TRACK_SIZE, &done);
+        }
+        if (res == FR_OK) {
+            res = f_lseek(&bench_file, (FSIZE_t)track * BENCH_DISK2_TRACK_SIZE + sector * BENCH_DISK2_SECTOR_SIZE);
+        }
+        if (res == FR_OK) {
+            res = f_write(&bench_file, bench_buffer, BENCH_DISK2_SECTOR_SIZE, &done);
+        }
+        if (res == FR_OK) {
+            res = f_sync(&bench_file);
+        }
+        if (res != FR_OK) {
+            bench_error(print, "Disk II натоварване", res);
+            return false;
+        }
+        perf_stat_add(&stat, time_us_32() - op);
+    }
+    bench_report(print, "disk2", &stat,
+                 BENCH_DISK2_TRACKS * (BENCH_DISK2_TRACK_SIZE + BENCH_DISK2_SECTOR_SIZE), time_us_32() - start);
+    return true;
+}
+
+// Всички натоварвания върху временен файл от size_kb KB
+bool bench_run(uint32_t size_kb, bench_print_t print) {
+    char line[96];
+
+    if (size_kb < BENCH_DISK2_TRACKS * BENCH_DISK2_TRACK_SIZE / 1024) {
+        size_kb = BENCH_DISK2_TRACKS * BENCH_DISK2_TRACK_SIZE / 1024;
+    }
+    if (size_kb > BENCH_MAX_KB) {
+        size_kb = BENCH_MAX_KB;
+    }
+    uint32_t size = size_kb * 1024;
+
+    FRESULT res = f_open(&bench_file, BENCH_FILENAME, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if (res != FR_OK) {
+        bench_error(print, "не може да се създаде " BENCH_FILENAME, res);
+        return false;
+    }
+
+    snprintf(line, sizeof(line), "\r\n=== SD тест: %lu KB, части по %d байта ===\r\n",
+             (unsigned long)size_kb, BENCH_CHUNK_SIZE);
+    print(line);
+
+    bool ok = bench_sequential(size, print) &&
+              bench_random_reads(size, print) &&
+              bench_disk2(print);
+
+    f_close(&bench_file);
+    f_unlink(BENCH_FILENAME);
+    return ok;
+}
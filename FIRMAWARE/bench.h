@@ -0,0 +1,25 @@
+/*
+ * Тест на скоростта на SD картата (CLI bench)
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BENCH_FILENAME "BENCH.TMP"   // Временен файл в корена (изтрива се след теста)
+#define BENCH_CHUNK_SIZE 4096        // Последователни операции - по 8 блока
+#define BENCH_DEFAULT_KB 1024        // Размер на файла по подразбиране
+#define BENCH_MAX_KB 16384
+#define BENCH_RANDOM_READS 256       // Случайни четения по 512 байта
+#define BENCH_DISK2_TRACKS 35        // Disk II: четене на пътека + запис на сектор + sync
+#define BENCH_DISK2_TRACK_SIZE 4096
+#define BENCH_DISK2_SECTOR_SIZE 256
+
+typedef void (*bench_print_t)(const char *line);
+
+// Функции
+bool bench_run(uint32_t size_kb, bench_print_t print);
+
+#endif // BENCH_H
@@ -5,12 +5,22 @@
 #include "cli.h"
 #include "hardware/uart.h"
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
 #include "pico/stdlib.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "config.h"
 #include "disk_manager.h"
+#include "drive.h"
+#include "smartport.h"
+#include "log.h"
+#include "perf.h"
+#include "bench.h"
+#include "sd_card.h"
+#include "track_cache.h"
+#include "profile.h"
+#include "journal.h"
 
 #define UART_ID uart1
 #define UART_BAUD_RATE 115200
@@ -19,33 +29,110 @@
 
 #define CLI_BUFFER_SIZE 128
 #define CLI_MAX_ARGS 8
+#define CLI_DISK_LIST_LINES 20  // Дискове на една страница от списъка
+
+// Буфери между UART прекъсването и главния цикъл (размерът е степен на 2)
+#define CLI_RX_RING_SIZE 256
+#define CLI_TX_RING_SIZE 4096   // Събира най-дългия изход (disk list, status)
+
+#define CLI_LOG_DUMP_RECORDS 32  // Записи при "log" без брой
+#define CLI_LOG_LINE_MAX 192     // Място в изходния буфер за един ред от лога
+#define CLI_LOG_PER_CALL 4       // Записи на едно извикване на cli_log_task
 
 // CLI буфер
 static char cli_buffer[CLI_BUFFER_SIZE];
 static uint8_t cli_buffer_index = 0;
 static bool cli_echo = true;
 
+// Приети символи (пише прекъсването, чете cli_process)
+static volatile char cli_rx_ring[CLI_RX_RING_SIZE];
+static volatile uint16_t cli_rx_head = 0;
+static volatile uint16_t cli_rx_tail = 0;
+
+// Изход към терминала (пише главният цикъл, изпраща прекъсването)
+static volatile char cli_tx_ring[CLI_TX_RING_SIZE];
+static volatile uint16_t cli_tx_head = 0;
+static volatile uint16_t cli_tx_tail = 0;
+
+// Загубени символи при пълен буфер
+static uint32_t cli_rx_dropped = 0;
+static uint32_t cli_tx_dropped = 0;
+
+// Извеждане на лога - записите се форматират, когато в изходния буфер има място
+static bool cli_log_active = false;
+static bool cli_log_stream = false;      // Нови записи без край (log stream on)
+static bool cli_log_raw = false;         // Шестнадесетичен вид за tools/log_decode.py
+static uint32_t cli_log_seq = 0;         // Следващ запис за извеждане
+static uint32_t cli_log_end = 0;         // Край на извеждането (без поток)
+static uint32_t cli_log_first = 0;       // Първият запис след "log clear"
+
 // Външни променливи (декларирани в Floppy_PICO_green.c)
-extern uint8_t current_track;
 extern bool motor_on;
-extern bool write_protected;
-extern bool disk_image_loaded;
 extern disk_manager_t disk_manager;
-extern gpio_config_t gpio_config;
 
 // Forward декларации за функции от основния файл
-extern bool load_track(uint8_t track);
 extern void update_display(void);
+extern bool set_smartport_mode(bool enabled);
 
-// GPIO макроси
-#define GPIO_WRITE_PROTECT gpio_config.write_protect
+// Устройството, към което се отнасят командите (избира се с drive)
+static drive_t* cli_drive(void) {
+    return drive_get(disk_manager_get_drive(&disk_manager));
+}
 
-// Helper функция за изпращане на низ през UART
-static void cli_uart_puts(uart_inst_t *uart, const char *str) {
-    if (str == NULL) return;
-    while (*str) {
-        uart_putc(uart, *str++);
+// Прехвърляне от буфера към UART FIFO; TX прекъсването е включено, докато има данни
+// Извиква се от прекъсването или при забранено прекъсване
+static void cli_tx_fill(void) {
+    while (cli_tx_tail != cli_tx_head && uart_is_writable(UART_ID)) {
+        uart_putc_raw(UART_ID, cli_tx_ring[cli_tx_tail]);
+        cli_tx_tail = (cli_tx_tail + 1) & (CLI_TX_RING_SIZE - 1);
+    }
+    uart_set_irq_enables(UART_ID, true, cli_tx_tail != cli_tx_head);
+}
+
+static void cli_uart_irq_handler(void) {
+    while (uart_is_readable(UART_ID)) {
+        char c = uart_getc(UART_ID);
+        uint16_t next = (cli_rx_head + 1) & (CLI_RX_RING_SIZE - 1);
+        if (next == cli_rx_tail) {
+            cli_rx_dropped++;
+            continue;
+        }
+        cli_rx_ring[cli_rx_head] = c;
+        cli_rx_head = next;
     }
+    cli_tx_fill();
+}
+
+// Запис в изходния буфер без изчакване - при пълен буфер изходът се съкращава
+static void cli_write(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint16_t next = (cli_tx_head + 1) & (CLI_TX_RING_SIZE - 1);
+        if (next == cli_tx_tail) {
+            cli_tx_dropped += len - i;
+            break;
+        }
+        cli_tx_ring[cli_tx_head] = data[i];
+        cli_tx_head = next;
+    }
+    
+    // TX прекъсването идва само при изпразване на FIFO - първите байтове се подават оттук
+    irq_set_enabled(UART1_IRQ, false);
+    cli_tx_fill();
+    irq_set_enabled(UART1_IRQ, true);
+}
+
+static void cli_puts(const char *str) {
+    if (str == NULL) return;
+    cli_write(str, strlen(str));
+}
+
+static void cli_putc(char c) {
+    cli_write(&c, 1);
+}
+
+// Свободно място в изходния буфер
+static uint16_t cli_tx_free(void) {
+    return (cli_tx_tail - cli_tx_head - 1) & (CLI_TX_RING_SIZE - 1);
 }
 
 // Инициализация на UART за CLI
@@ -57,10 +144,16 @@ void cli_init(void) {
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
     
+    // Приемане и изпращане в прекъсване (UART1_IRQ съответства на UART_ID)
+    uart_set_fifo_enabled(UART_ID, true);
+    irq_set_exclusive_handler(UART1_IRQ, cli_uart_irq_handler);
+    irq_set_enabled(UART1_IRQ, true);
+    uart_set_irq_enables(UART_ID, true, false);
+    
     // Изпращане на приветствено съобщение
-    cli_uart_puts(UART_ID, "\r\n=== Apple II Floppy Disk Emulator CLI ===\r\n");
-    cli_uart_puts(UART_ID, "Въведете 'help' за списък с команди\r\n");
-    cli_uart_puts(UART_ID, "> ");
+    cli_puts("\r\n=== Apple II Floppy Disk Emulator CLI ===\r\n");
+    cli_puts("Въведете 'help' за списък с команди\r\n");
+    cli_puts("> ");
     
     cli_buffer_index = 0;
     memset(cli_buffer, 0, sizeof(cli_buffer));
@@ -80,6 +173,32 @@ static void parse_command(char *line, char **argv, int *argc) {
     }
 }
 
+// Списък с дискове от каталога, по CLI_DISK_LIST_LINES наведнъж
+static void cli_list_disks(uint16_t start, uint16_t current_idx) {
+    uint16_t count = disk_manager_get_count(&disk_manager);
+    char buf[160];
+    
+    snprintf(buf, sizeof(buf), "\r\n=== Налични дискове (%d) ===\r\n", count);
+    cli_puts(buf);
+    
+    uint16_t end = (count - start > CLI_DISK_LIST_LINES) ? start + CLI_DISK_LIST_LINES : count;
+    for (uint16_t i = start; i < end; i++) {
+        catalog_entry_t *disk = disk_manager_get_disk(&disk_manager, i);
+        if (disk) {
+            snprintf(buf, sizeof(buf), "%s%d: %s%s\r\n",
+                    (i == current_idx) ? ">" : " ",
+                    i, disk->filename,
+                    (i == current_idx) ? " [АКТИВЕН]" : "");
+            cli_puts(buf);
+        }
+    }
+    
+    if (end < count) {
+        snprintf(buf, sizeof(buf), "... още %d (disk list %d)\r\n", count - end, end);
+        cli_puts(buf);
+    }
+}
+
 // Изпълнение на команда
 static void execute_command(int argc, char **argv) {
     if (argc == 0) return;
@@ -90,158 +209,455 @@ static void execute_command(int argc, char **argv) {
         cli_print_help();
     }
     else if (strcmp(cmd, "status") == 0 || strcmp(cmd, "stat") == 0) {
-        cli_uart_puts(UART_ID, "\r\n=== Статус ===\r\n");
+        cli_puts("\r\n=== Статус ===\r\n");
         
         // Мотор
-        cli_uart_puts(UART_ID, "Мотор: ");
-        cli_uart_puts(UART_ID, motor_on ? "ВКЛЮЧЕН" : "ИЗКЛЮЧЕН");
-        cli_uart_puts(UART_ID, "\r\n");
+        char buf[160];
+        snprintf(buf, sizeof(buf), "Мотор: %s (устройство %d)\r\n",
+                 motor_on ? "ВКЛЮЧЕН" : "ИЗКЛЮЧЕН", drive_active_id() + 1);
+        cli_puts(buf);
         
-        // Пътека
-        char buf[64];
-        snprintf(buf, sizeof(buf), "Пътека: %d/%d\r\n", current_track, get_tracks_per_disk() - 1);
-        cli_uart_puts(UART_ID, buf);
+        snprintf(buf, sizeof(buf), "Режим: %s\r\n", smartport_enabled() ? "SmartPort" : "Disk II");
+        cli_puts(buf);
         
-        // Диск
-        if (disk_image_loaded) {
-            const char *disk_name = disk_manager_get_current_name(&disk_manager);
-            snprintf(buf, sizeof(buf), "Диск: %s\r\n", disk_name);
-            cli_uart_puts(UART_ID, buf);
+        // Устройства - пътека, диск, формат и write protect на всяко
+        for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+            drive_t *d = drive_get(i);
+            disk_image_t *image = disk_manager_get_image(&disk_manager, i);
+            
+            snprintf(buf, sizeof(buf), "%sУстройство %d: пътека %d/%d%s\r\n",
+                     (i == disk_manager_get_drive(&disk_manager)) ? ">" : " ",
+                     i + 1, d->track, get_tracks_per_disk() - 1,
+                     d->write_protected ? ", write protect" : "");
+            cli_puts(buf);
             
-            disk_config_t *format = get_current_disk_format();
-            if (format) {
-                snprintf(buf, sizeof(buf), "Формат: %s\r\n", format->format_name);
-                cli_uart_puts(UART_ID, buf);
+            if (disk_manager.disk_loaded[i] && image) {
+                snprintf(buf, sizeof(buf), "  Диск: %s (%s)\r\n",
+                         image->filename, get_disk_config(image->format)->format_name);
+            } else {
+                snprintf(buf, sizeof(buf), "  Диск: Не е зареден\r\n");
             }
+            cli_puts(buf);
+        }
+        
+        // Каталог
+        if (disk_manager_scan_busy(&disk_manager)) {
+            snprintf(buf, sizeof(buf), "Каталог: %s (%lu елемента, %d имиджа)\r\n",
+                     disk_manager.scan_phase == SCAN_PHASE_VERIFY ? "проверка" :
+                     disk_manager.scan_phase == SCAN_PHASE_SORT ? "сортиране" : "сканиране",
+                     (unsigned long)disk_manager.scan_entries, disk_manager_get_count(&disk_manager));
         } else {
-            cli_uart_puts(UART_ID, "Диск: Не е зареден\r\n");
+            snprintf(buf, sizeof(buf), "Каталог: %d имиджа\r\n", disk_manager_get_count(&disk_manager));
+        }
+        cli_puts(buf);
+        
+        // Кеш на пътеките
+        uint32_t cache_hits, cache_misses;
+        track_cache_stats(&cache_hits, &cache_misses);
+        snprintf(buf, sizeof(buf), "Кеш на пътеки: %d/%d записа, попадения %lu, пропуски %lu\r\n",
+                 track_cache_used(), TRACK_CACHE_ENTRIES + TRACK_CACHE_SPECULATIVE,
+                 (unsigned long)cache_hits, (unsigned long)cache_misses);
+        cli_puts(buf);
+        
+        uint32_t prefetch_loaded, prefetch_cancelled;
+        drive_prefetch_stats(&prefetch_loaded, &prefetch_cancelled);
+        snprintf(buf, sizeof(buf), "Предварително заредени: %lu (отменени %lu), излишни зареждания: %lu\r\n",
+                 (unsigned long)prefetch_loaded, (unsigned long)prefetch_cancelled,
+                 (unsigned long)drive_loads_skipped());
+        cli_puts(buf);
+        
+        uint32_t sectors_written, sectors_elided;
+        drive_write_stats(&sectors_written, &sectors_elided);
+        snprintf(buf, sizeof(buf), "Записани сектори: %lu (еднакви, пропуснати: %lu)\r\n",
+                 (unsigned long)sectors_written, (unsigned long)sectors_elided);
+        cli_puts(buf);
+        
+        if (journal_enabled() || journal_pending(0) || journal_pending(1)) {
+            snprintf(buf, sizeof(buf), "Журнал: %s, чакащи сектори: %d / %d\r\n",
+                     journal_enabled() ? "вкл" : "изкл", journal_pending(0), journal_pending(1));
+            cli_puts(buf);
+        }
+        
+        uint32_t spin_ups, spin_resumed;
+        drive_spindle_stats(&spin_ups, &spin_resumed);
+        snprintf(buf, sizeof(buf), "Шпиндел: спиране след %lu ms, пускания %lu (+%lu преди да спре)\r\n",
+                 (unsigned long)drive_get_spin_down_ms(), (unsigned long)spin_ups, (unsigned long)spin_resumed);
+        cli_puts(buf);
+        
+        // SD шина
+        snprintf(buf, sizeof(buf), "SD: %lu kHz, CRC %s (грешни блокове: %lu)\r\n",
+                 (unsigned long)(sd_card_clock_hz() / 1000),
+                 sd_card_crc_enabled() ? "вкл" : "изкл", (unsigned long)sd_card_crc_errors());
+        cli_puts(buf);
+        
+        // Загубени символи в CLI буферите
+        if (cli_rx_dropped || cli_tx_dropped) {
+            snprintf(buf, sizeof(buf), "CLI: загубени символи - вход %lu, изход %lu\r\n",
+                     (unsigned long)cli_rx_dropped, (unsigned long)cli_tx_dropped);
+            cli_puts(buf);
+        }
+    }
+    else if (strcmp(cmd, "smartport") == 0 || strcmp(cmd, "sp") == 0) {
+        // Режим на емулация: Disk II или SmartPort блоково устройство
+        if (argc > 1) {
+            if (strcmp(argv[1], "on") == 0) {
+                if (!set_smartport_mode(true)) {
+                    cli_puts("Грешка: незаписаните пътеки или журналът не могат да се запишат в имиджите\r\n");
+                }
+            } else if (strcmp(argv[1], "off") == 0) {
+                set_smartport_mode(false);
+            } else {
+                cli_puts("Използване: smartport on|off\r\n");
+                return;
+            }
         }
         
-        // Write Protect
-        cli_uart_puts(UART_ID, "Write Protect: ");
-        cli_uart_puts(UART_ID, write_protected ? "ДА" : "НЕ");
-        cli_uart_puts(UART_ID, "\r\n");
+        const smartport_stats_t *stats = smartport_get_stats();
+        char buf[160];
+        snprintf(buf, sizeof(buf), "SmartPort: %s (команди %lu, прочетени %lu, записани %lu, грешки %lu)\r\n",
+                 smartport_enabled() ? "ВКЛЮЧЕН" : "ИЗКЛЮЧЕН",
+                 (unsigned long)stats->commands, (unsigned long)stats->blocks_read,
+                 (unsigned long)stats->blocks_written, (unsigned long)stats->errors);
+        cli_puts(buf);
+        for (uint8_t i = 0; i < SP_UNIT_COUNT; i++) {
+            if (smartport_unit_id(i) != 0) {
+                snprintf(buf, sizeof(buf), "  Том %d: адрес %d\r\n", i + 1, smartport_unit_id(i));
+                cli_puts(buf);
+            }
+        }
+    }
+    else if (strcmp(cmd, "drive") == 0 || strcmp(cmd, "drv") == 0) {
+        // Избор на устройството за командите disk/track/wprotect
+        if (argc > 1) {
+            int drive = atoi(argv[1]);
+            if (drive >= 1 && drive <= DRIVE_COUNT) {
+                disk_manager_select_drive(&disk_manager, drive - 1);
+            } else {
+                cli_puts("Невалиден номер на устройство\r\n");
+                return;
+            }
+        }
+        char buf[64];
+        snprintf(buf, sizeof(buf), "Устройство: %d\r\n", disk_manager_get_drive(&disk_manager) + 1);
+        cli_puts(buf);
     }
     else if (strcmp(cmd, "motor") == 0) {
         if (argc > 1) {
             if (strcmp(argv[1], "on") == 0) {
                 motor_on = true;
-                if (load_track(current_track)) {
-                    cli_uart_puts(UART_ID, "Мотор ВКЛЮЧЕН\r\n");
-                }
+                drive_request_load(drive_active());
+                cli_puts("Мотор ВКЛЮЧЕН\r\n");
             } else if (strcmp(argv[1], "off") == 0) {
                 motor_on = false;
-                cli_uart_puts(UART_ID, "Мотор ИЗКЛЮЧЕН\r\n");
+                cli_puts("Мотор ИЗКЛЮЧЕН\r\n");
             } else {
-                cli_uart_puts(UART_ID, "Използване: motor on|off\r\n");
+                cli_puts("Използване: motor on|off\r\n");
             }
         } else {
-            cli_uart_puts(UART_ID, motor_on ? "Мотор: ВКЛЮЧЕН\r\n" : "Мотор: ИЗКЛЮЧЕН\r\n");
+            cli_puts(motor_on ? "Мотор: ВКЛЮЧЕН\r\n" : "Мотор: ИЗКЛЮЧЕН\r\n");
         }
     }
     else if (strcmp(cmd, "track") == 0) {
         if (argc > 1) {
             int track = atoi(argv[1]);
             if (track >= 0 && track < get_tracks_per_disk()) {
-                current_track = track;
-                if (motor_on && load_track(current_track)) {
+                drive_t *d = cli_drive();
+                d->track = track;
+                if (motor_on && drive_load_now(d)) {
                     char buf[64];
-                    snprintf(buf, sizeof(buf), "Пътека %d заредена\r\n", current_track);
-                    cli_uart_puts(UART_ID, buf);
+                    snprintf(buf, sizeof(buf), "Пътека %d заредена\r\n", d->track);
+                    cli_puts(buf);
                 } else {
                     char buf[64];
-                    snprintf(buf, sizeof(buf), "Пътека зададена на %d\r\n", current_track);
-                    cli_uart_puts(UART_ID, buf);
+                    snprintf(buf, sizeof(buf), "Пътека зададена на %d\r\n", d->track);
+                    drive_request_load(d);
+                    cli_puts(buf);
                 }
             } else {
-                cli_uart_puts(UART_ID, "Невалиден номер на пътека\r\n");
+                cli_puts("Невалиден номер на пътека\r\n");
             }
         } else {
             char buf[32];
-            snprintf(buf, sizeof(buf), "Текуща пътека: %d\r\n", current_track);
-            cli_uart_puts(UART_ID, buf);
+            snprintf(buf, sizeof(buf), "Текуща пътека: %d\r\n", cli_drive()->track);
+            cli_puts(buf);
         }
     }
     else if (strcmp(cmd, "disk") == 0) {
-        uint8_t count = disk_manager_get_count(&disk_manager);
+        uint16_t count = disk_manager_get_count(&disk_manager);
+        uint16_t current_idx = disk_manager_get_current_index(&disk_manager);
         
-        if (argc > 1) {
+        if (argc > 2 && strcmp(argv[1], "find") == 0) {
+            // Търсене по начало на името в сортирания каталог
+            uint16_t index = disk_manager_find_prefix(&disk_manager, argv[2]);
+            if (index == CATALOG_INDEX_NONE) {
+                cli_puts("Каталогът е празен\r\n");
+            } else {
+                cli_list_disks(index, current_idx);
+            }
+        } else if (argc > 1 && strcmp(argv[1], "list") == 0) {
+            // Списък от зададена позиция
+            int start = (argc > 2) ? atoi(argv[2]) : 0;
+            if (start >= 0 && start < count) {
+                cli_list_disks(start, current_idx);
+            } else {
+                cli_puts("Невалидна позиция в каталога\r\n");
+            }
+        } else if (argc > 1) {
             // Избор на диск
             int disk_num = atoi(argv[1]);
             if (disk_num >= 0 && disk_num < count) {
+                drive_eject(cli_drive(), true);
                 if (disk_manager_load(&disk_manager, disk_num)) {
-                    load_track(current_track);
-                    char buf[64];
+                    drive_reload(cli_drive());
+                    char buf[160];
                     snprintf(buf, sizeof(buf), "Диск %d зареден: %s\r\n", 
                             disk_num, disk_manager_get_current_name(&disk_manager));
-                    cli_uart_puts(UART_ID, buf);
+                    cli_puts(buf);
                 } else {
-                    cli_uart_puts(UART_ID, "Грешка при зареждане на диск\r\n");
+                    cli_puts("Грешка при зареждане на диск\r\n");
                 }
             } else {
-                cli_uart_puts(UART_ID, "Невалиден номер на диск\r\n");
+                cli_puts("Невалиден номер на диск\r\n");
             }
         } else {
-            // Списък с дискове
-            cli_uart_puts(UART_ID, "\r\n=== Налични дискове ===\r\n");
-            for (uint8_t i = 0; i < count; i++) {
-                disk_image_t *disk = disk_manager_get_disk(&disk_manager, i);
-                if (disk) {
-                    uint8_t current_idx = disk_manager_get_current_index(&disk_manager);
-                    char buf[64];
-                    snprintf(buf, sizeof(buf), "%s%d: %s%s\r\n",
-                            (i == current_idx) ? ">" : " ",
-                            i, disk->filename,
-                            (i == current_idx) ? " [АКТИВЕН]" : "");
-                    cli_uart_puts(UART_ID, buf);
-                }
+            // Списък около текущия диск
+            uint16_t start = 0;
+            if (current_idx != CATALOG_INDEX_NONE && current_idx >= CLI_DISK_LIST_LINES / 2) {
+                start = current_idx - CLI_DISK_LIST_LINES / 2;
             }
+            cli_list_disks(start, current_idx);
+        }
+    }
+    else if (strcmp(cmd, "rescan") == 0) {
+        // Пълно сканиране на картата и нов каталог (във фонов режим)
+        if (disk_manager_rescan(&disk_manager, true)) {
+            cli_puts("Сканирането на SD картата започна (статус: status)\r\n");
+        } else {
+            cli_puts("Грешка: сканирането не може да започне\r\n");
         }
     }
     else if (strcmp(cmd, "wprotect") == 0 || strcmp(cmd, "wp") == 0) {
         if (argc > 1) {
             if (strcmp(argv[1], "on") == 0) {
-                write_protected = true;
-                gpio_put(GPIO_WRITE_PROTECT, 0);
-                cli_uart_puts(UART_ID, "Write Protect ВКЛЮЧЕН\r\n");
+                cli_drive()->write_protected = true;
+                cli_puts("Write Protect ВКЛЮЧЕН\r\n");
             } else if (strcmp(argv[1], "off") == 0) {
-                write_protected = false;
-                gpio_put(GPIO_WRITE_PROTECT, 1);
-                cli_uart_puts(UART_ID, "Write Protect ИЗКЛЮЧЕН\r\n");
+                cli_drive()->write_protected = false;
+                cli_puts("Write Protect ИЗКЛЮЧЕН\r\n");
             } else {
-                cli_uart_puts(UART_ID, "Използване: wprotect on|off\r\n");
+                cli_puts("Използване: wprotect on|off\r\n");
             }
         } else {
-            cli_uart_puts(UART_ID, write_protected ? "Write Protect: ВКЛЮЧЕН\r\n" : "Write Protect: ИЗКЛЮЧЕН\r\n");
+            cli_puts(cli_drive()->write_protected ? "Write Protect: ВКЛЮЧЕН\r\n" : "Write Protect: ИЗКЛЮЧЕН\r\n");
         }
     }
     else if (strcmp(cmd, "reset") == 0) {
-        cli_uart_puts(UART_ID, "Рестартиране на системата...\r\n");
+        cli_puts("Рестартиране на системата...\r\n");
         // В реална имплементация може да се използва watchdog или software reset
-        cli_uart_puts(UART_ID, "Забележка: Рестартирането не е имплементирано\r\n");
+        cli_puts("Забележка: Рестартирането не е имплементирано\r\n");
+    }
+    else if (strcmp(cmd, "log") == 0) {
+        // Отложен лог: извеждане, ниво, поток
+        char buf[80];
+        const char *sub = (argc > 1) ? argv[1] : "";
+        
+        if (strcmp(sub, "level") == 0) {
+            if (argc > 2) {
+                log_level_t level;
+                if (!log_parse_level(argv[2], &level)) {
+                    cli_puts("Използване: log level error|warn|info|debug\r\n");
+                    return;
+                }
+                log_set_level(level);
+            }
+            snprintf(buf, sizeof(buf), "Ниво на лога: %s\r\n", log_level_name(log_get_level()));
+            cli_puts(buf);
+        } else if (strcmp(sub, "stream") == 0) {
+            if (argc > 2 && strcmp(argv[2], "on") == 0) {
+                cli_log_stream = true;
+                cli_log_raw = (argc > 3 && strcmp(argv[3], "raw") == 0);
+                cli_log_seq = log_head();
+                cli_log_active = true;
+            } else if (argc > 2 && strcmp(argv[2], "off") == 0) {
+                cli_log_stream = false;
+                cli_log_active = false;
+            }
+            cli_puts(cli_log_stream ? "Поток на лога: ВКЛЮЧЕН\r\n" : "Поток на лога: ИЗКЛЮЧЕН\r\n");
+        } else if (strcmp(sub, "clear") == 0) {
+            cli_log_first = log_head();
+            cli_puts("Логът е изчистен\r\n");
+        } else {
+            // Последните записи (log [raw] [брой])
+            cli_log_raw = (strcmp(sub, "raw") == 0);
+            const char *count_arg = cli_log_raw ? (argc > 2 ? argv[2] : NULL) : (argc > 1 ? argv[1] : NULL);
+            uint32_t count = count_arg ? (uint32_t)atoi(count_arg) : CLI_LOG_DUMP_RECORDS;
+            uint32_t head = log_head();
+            uint32_t available = head - cli_log_first;
+            if (available > LOG_RING_SIZE) {
+                available = LOG_RING_SIZE;
+            }
+            if (count > available) {
+                count = available;
+            }
+            snprintf(buf, sizeof(buf), "Лог: %lu записа (ниво %s)\r\n", (unsigned long)count,
+                     log_level_name(log_get_level()));
+            cli_puts(buf);
+            cli_log_stream = false;
+            cli_log_seq = head - count;
+            cli_log_end = head;
+            cli_log_active = true;
+        }
+    }
+    else if (strcmp(cmd, "perf") == 0) {
+        // Закъснения в горещите пътища (след извеждането се нулират, освен с "keep")
+        char buf[160];
+        cli_puts("\r\n=== Закъснения (µs) ===\r\n");
+        for (uint8_t i = 0; i < PERF_COUNT; i++) {
+            const perf_stat_t *stat = perf_get((perf_id_t)i);
+            if (stat->count == 0) {
+                snprintf(buf, sizeof(buf), "%-10s няма измервания\r\n", perf_name((perf_id_t)i));
+                cli_puts(buf);
+                continue;
+            }
+            snprintf(buf, sizeof(buf), "%-10s n=%lu min=%lu avg=%lu p50=%lu p99=%lu max=%lu\r\n",
+                     perf_name((perf_id_t)i), (unsigned long)stat->count, (unsigned long)stat->min,
+                     (unsigned long)(stat->total / stat->count),
+                     (unsigned long)perf_stat_percentile(stat, 50),
+                     (unsigned long)perf_stat_percentile(stat, 99), (unsigned long)stat->max);
+            cli_puts(buf);
+            
+            // Непразните log2 кошове: горна граница и брой
+            int len = snprintf(buf, sizeof(buf), "  ");
+            for (uint8_t b = 0; b < PERF_BUCKETS && len < (int)sizeof(buf) - 24; b++) {
+                if (stat->buckets[b]) {
+                    len += snprintf(buf + len, sizeof(buf) - len, " <%lu:%lu",
+                                    (unsigned long)(1u << b), (unsigned long)stat->buckets[b]);
+                }
+            }
+            cli_puts(buf);
+            cli_puts("\r\n");
+        }
+        
+        // Записаните сектори, еднакви с буфера, не стигат до картата (броячите не се нулират)
+        uint32_t sectors_written, sectors_elided;
+        drive_write_stats(&sectors_written, &sectors_elided);
+        snprintf(buf, sizeof(buf), "Сектори: записани %lu, еднакви (без запис в картата) %lu\r\n",
+                 (unsigned long)sectors_written, (unsigned long)sectors_elided);
+        cli_puts(buf);
+        if (argc < 2 || strcmp(argv[1], "keep") != 0) {
+            perf_reset();
+        }
+    }
+    else if (strcmp(cmd, "bench") == 0) {
+        // Тестът блокира главния цикъл за няколко секунди - не и докато Apple II чете
+        if (motor_on || smartport_enabled()) {
+            cli_puts("Тестът е възможен само при изключен мотор и Disk II режим\r\n");
+            return;
+        }
+        uint32_t size_kb = (argc > 1) ? (uint32_t)atoi(argv[1]) : BENCH_DEFAULT_KB;
+        if (!bench_run(size_kb, cli_puts)) {
+            cli_puts("Тестът е прекъснат\r\n");
+        }
+    }
+    else if (strcmp(cmd, "spindown") == 0) {
+        // Забавяне на спирането на шпиндела след изключване на ENABLE
+        char buf[64];
+        if (argc > 1) {
+            drive_set_spin_down_ms((uint32_t)atoi(argv[1]));
+        }
+        snprintf(buf, sizeof(buf), "Спиране на шпиндела след %lu ms\r\n", (unsigned long)drive_get_spin_down_ms());
+        cli_puts(buf);
+    }
+    else if (strcmp(cmd, "journal") == 0 || strcmp(cmd, "jnl") == 0) {
+        // Режим на журнал: записаните сектори отиват последователно в .JNL до имиджа
+        char buf[96];
+        if (argc > 1) {
+            if (strcmp(argv[1], "on") == 0) {
+                journal_set_enabled(true);
+            } else if (strcmp(argv[1], "off") == 0) {
+                journal_set_enabled(false);
+            } else if (strcmp(argv[1], "fold") == 0) {
+                for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+                    if (!journal_fold(i)) {
+                        snprintf(buf, sizeof(buf), "Грешка: журналът на устройство %d не е прехвърлен\r\n", i + 1);
+                        cli_puts(buf);
+                    }
+                }
+            } else {
+                cli_puts("Използване: journal [on|off|fold]\r\n");
+                return;
+            }
+        }
+        snprintf(buf, sizeof(buf), "Журнал: %s, чакащи сектори: %d / %d\r\n",
+                 journal_enabled() ? "ВКЛЮЧЕН" : "ИЗКЛЮЧЕН", journal_pending(0), journal_pending(1));
+        cli_puts(buf);
+    }
+    else if (strcmp(cmd, "profile") == 0 || strcmp(cmd, "prf") == 0) {
+        // Профили на достъпа до пътеките (файл .PRF до имиджа)
+        char buf[128];
+        if (argc > 2 && (strcmp(argv[1], "record") == 0 || strcmp(argv[1], "replay") == 0)) {
+            bool record = strcmp(argv[1], "record") == 0;
+            bool enabled = strcmp(argv[2], "on") == 0;
+            if (!enabled && strcmp(argv[2], "off") != 0) {
+                cli_puts("Използване: profile record|replay on|off\r\n");
+                return;
+            }
+            if (record) {
+                profile_set_record(enabled);
+            } else {
+                profile_set_replay(enabled);
+            }
+            snprintf(buf, sizeof(buf), "%s на профили: %s\r\n",
+                     record ? "Записване" : "Възпроизвеждане", enabled ? "ВКЛЮЧЕНО" : "ИЗКЛЮЧЕНО");
+            cli_puts(buf);
+        } else if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+            uint8_t drive = disk_manager_get_drive(&disk_manager);
+            if (profile_delete(drive)) {
+                snprintf(buf, sizeof(buf), "Профилът на устройство %d е изтрит\r\n", drive + 1);
+            } else {
+                snprintf(buf, sizeof(buf), "Грешка: профилът на устройство %d не може да се изтрие\r\n", drive + 1);
+            }
+            cli_puts(buf);
+        } else {
+            snprintf(buf, sizeof(buf), "Записване: %s, възпроизвеждане: %s\r\n",
+                     profile_record_enabled() ? "вкл" : "изкл", profile_replay_enabled() ? "вкл" : "изкл");
+            cli_puts(buf);
+            for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+                bool recording;
+                uint16_t count, position;
+                profile_status(i, &recording, &count, &position);
+                if (recording) {
+                    snprintf(buf, sizeof(buf), "Устройство %d: записва се (%d пътеки)\r\n", i + 1, count);
+                } else if (count > 0) {
+                    snprintf(buf, sizeof(buf), "Устройство %d: профил %d/%d пътеки\r\n", i + 1, position, count);
+                } else {
+                    snprintf(buf, sizeof(buf), "Устройство %d: без профил\r\n", i + 1);
+                }
+                cli_puts(buf);
+            }
+        }
     }
     else if (strcmp(cmd, "clear") == 0 || strcmp(cmd, "cls") == 0) {
         // Изчистване на екрана (ANSI escape sequence)
-        cli_uart_puts(UART_ID, "\033[2J\033[H");
+        cli_puts("\033[2J\033[H");
     }
     else {
         char buf[128];
         snprintf(buf, sizeof(buf), "Неизвестна команда: %s\r\nВъведете 'help' за списък с команди\r\n", cmd);
-        cli_uart_puts(UART_ID, buf);
+        cli_puts(buf);
     }
 }
 
-// Обработка на CLI команди
+// Изпълнение на въведените команди (извиква се само от главния цикъл)
+// На едно извикване се изпълнява най-много една команда
 void cli_process(void) {
-    // Проверка за налични данни в UART (обработваме всички налични символи)
-    printf("cli PROCESS \n");
-    while (uart_is_readable(UART_ID)) {
-        printf("cli PROCESS in while \n");
-        char c = uart_getc(UART_ID);
+    while (cli_rx_tail != cli_rx_head) {
+        char c = cli_rx_ring[cli_rx_tail];
+        cli_rx_tail = (cli_rx_tail + 1) & (CLI_RX_RING_SIZE - 1);
         
         // Echo на символа
         if (cli_echo) {
-            uart_putc(UART_ID, c);
+            cli_putc(c);
         }
         
         // Обработка на символа
@@ -249,16 +665,11 @@ void cli_process(void) {
             if (cli_buffer_index > 0) {
                 cli_buffer[cli_buffer_index] = '\0';
                 
-                // Debug: показване на получената команда
-                printf("CLI команда получена: '%s'\n", cli_buffer);
-                
                 // Парсиране и изпълнение на команда
                 char *argv[CLI_MAX_ARGS];
                 int argc;
                 parse_command(cli_buffer, argv, &argc);
                 
-                printf("CLI команда парсирана: argc=%d\n", argc);
-                
                 if (argc > 0) {
                     execute_command(argc, argv);
                 }
@@ -267,17 +678,17 @@ void cli_process(void) {
                 cli_buffer_index = 0;
                 memset(cli_buffer, 0, sizeof(cli_buffer));
                 
-                cli_uart_puts(UART_ID, "\r\n> ");
-            } else {
-                cli_uart_puts(UART_ID, "\r\n> ");
+                cli_puts("\r\n> ");
+                return;
             }
+            cli_puts("\r\n> ");
         }
         else if (c == '\b' || c == 0x7F) {  // Backspace
             if (cli_buffer_index > 0) {
                 cli_buffer_index--;
                 cli_buffer[cli_buffer_index] = '\0';
                 if (cli_echo) {
-                    cli_uart_puts(UART_ID, "\b \b");
+                    cli_puts("\b \b");
                 }
             }
         }
@@ -285,24 +696,78 @@ void cli_process(void) {
             cli_buffer[cli_buffer_index++] = c;
         } else {
             // Буферът е пълен
-            cli_uart_puts(UART_ID, "\r\nБуферът е пълен!\r\n> ");
+            cli_puts("\r\nБуферът е пълен!\r\n> ");
             cli_buffer_index = 0;
             memset(cli_buffer, 0, sizeof(cli_buffer));
         }
     }
 }
 
+// Извеждане на записите от лога (извиква се от главния цикъл, когато няма SD операции)
+// Форматира по няколко записа, само ако изходният буфер има място за тях
+void cli_log_task(void) {
+    char line[CLI_LOG_LINE_MAX];
+    
+    for (uint8_t n = 0; n < CLI_LOG_PER_CALL && cli_log_active; n++) {
+        if (cli_tx_free() < CLI_LOG_LINE_MAX) {
+            return;
+        }
+        
+        uint32_t end = cli_log_stream ? log_head() : cli_log_end;
+        if (cli_log_seq == end) {
+            cli_log_active = cli_log_stream;
+            return;
+        }
+        
+        log_record_t record;
+        if (!log_get(cli_log_seq, &record)) {
+            // Записите са презаписани, докато чакаха - продължава се от най-стария
+            uint32_t oldest = log_head() - LOG_RING_SIZE;
+            snprintf(line, sizeof(line), "... пропуснати %lu записа\r\n", (unsigned long)(oldest - cli_log_seq));
+            cli_puts(line);
+            cli_log_seq = oldest;
+            continue;
+        }
+        cli_log_seq++;
+        
+        if (cli_log_raw) {
+            snprintf(line, sizeof(line), "L %08lX %04X %04X %08lX %08lX\r\n",
+                     (unsigned long)record.time_us, record.event, record.seq,
+                     (unsigned long)record.arg[0], (unsigned long)record.arg[1]);
+        } else {
+            log_format(&record, line, sizeof(line));
+        }
+        cli_puts(line);
+    }
+}
+
 // Печат на помощна информация
 void cli_print_help(void) {
-    cli_uart_puts(UART_ID, "\r\n=== CLI Команди ===\r\n");
-    cli_uart_puts(UART_ID, "help, ?          - Показва този списък\r\n");
-    cli_uart_puts(UART_ID, "status, stat     - Показва статус на системата\r\n");
-    cli_uart_puts(UART_ID, "motor [on|off]   - Управление на мотора\r\n");
-    cli_uart_puts(UART_ID, "track [num]      - Задава/показва текущата пътека\r\n");
-    cli_uart_puts(UART_ID, "disk [num]       - Показва списък или избира диск\r\n");
-    cli_uart_puts(UART_ID, "wprotect, wp [on|off] - Управление на write protect\r\n");
-    cli_uart_puts(UART_ID, "reset            - Рестартиране на системата\r\n");
-    cli_uart_puts(UART_ID, "clear, cls       - Изчистване на екрана\r\n");
-    cli_uart_puts(UART_ID, "\r\n");
+    cli_puts("\r\n=== CLI Команди ===\r\n");
+    cli_puts("help, ?          - Показва този списък\r\n");
+    cli_puts("status, stat     - Показва статус на системата\r\n");
+    cli_puts("drive, drv [1|2] - Избор на устройство за disk/track/wp\r\n");
+    cli_puts("smartport, sp [on|off] - SmartPort режим (.po/.hdv томове)\r\n");
+    cli_puts("motor [on|off]   - Управление на мотора\r\n");
+    cli_puts("track [num]      - Задава/показва текущата пътека\r\n");
+    cli_puts("disk [num]       - Показва списък или избира диск\r\n");
+    cli_puts("disk list [pos]  - Списък с дискове от позиция pos\r\n");
+    cli_puts("disk find <name> - Търсене по начало на името\r\n");
+    cli_puts("rescan           - Ново сканиране и каталог на картата\r\n");
+    cli_puts("wprotect, wp [on|off] - Управление на write protect\r\n");
+    cli_puts("log [raw] [n]    - Последните n записа от лога\r\n");
+    cli_puts("log level [lvl]  - Ниво на лога (error|warn|info|debug)\r\n");
+    cli_puts("log stream on|off [raw] - Извеждане на новите записи\r\n");
+    cli_puts("log clear        - Изчистване на лога\r\n");
+    cli_puts("perf [keep]      - Хистограми на закъсненията (и нулиране)\r\n");
+    cli_puts("bench [kb]       - Тест на скоростта на SD картата (" BENCH_FILENAME ")\r\n");
+    cli_puts("spindown [ms]    - Забавяне на спирането на мотора\r\n");
+    cli_puts("journal, jnl [on|off|fold] - Журнал на записаните сектори\r\n");
+    cli_puts("profile, prf     - Профили на достъпа до пътеките\r\n");
+    cli_puts("profile record|replay on|off - Записване/възпроизвеждане на профили\r\n");
+    cli_puts("profile clear    - Изтриване на профила на имиджа в устройството\r\n");
+    cli_puts("reset            - Рестартиране на системата\r\n");
+    cli_puts("clear, cls       - Изчистване на екрана\r\n");
+    cli_puts("\r\n");
 }
 
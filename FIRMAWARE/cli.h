@@ -11,9 +11,12 @@
 // Инициализация на CLI
 void cli_init(void);
 
-// Обработка на CLI команди (трябва да се извиква периодично)
+// Изпълнение на въведените команди (само от главния цикъл; символите се приемат в прекъсване)
 void cli_process(void);
 
+// Извеждане на записите от лога (когато главният цикъл няма SD операции)
+void cli_log_task(void);
+
 // Печат на помощна информация
 void cli_print_help(void);
 
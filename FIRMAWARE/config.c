@@ -11,6 +11,7 @@ gpio_config_t gpio_config = {
     .ph2 = 5,
     .ph3 = 6,
     .motor_on = 7,
+    .drive2_enable = 22,
     .write_enable = 8,
     .write_data = 9,
     .read_data = 10,
@@ -25,6 +26,7 @@ gpio_config_t gpio_config = {
     .sd_cs = 17,
     .sd_sck = 18,
     .sd_mosi = 19,
+    .sd_detect = GPIO_NONE,
 
     .i2c_sda = 20,
     .i2c_scl = 21,
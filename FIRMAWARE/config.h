@@ -18,6 +18,12 @@ typedef enum {
     DISK_FORMAT_AUTO = 2        // Автоматично определяне
 } disk_format_t;
 
+// Брой емулирани устройства (Disk II контролерът управлява две)
+#define DRIVE_COUNT 2
+
+// Незададен (неизползван) пин
+#define GPIO_NONE 0xFF
+
 // ============================================================================
 // GPIO конфигурация
 // ============================================================================
@@ -29,7 +35,8 @@ typedef struct {
     uint8_t ph3;
     
     // Сигнали от Apple II
-    uint8_t motor_on;
+    uint8_t motor_on;        // ENABLE на устройство 1 (включва и мотора му)
+    uint8_t drive2_enable;   // ENABLE на устройство 2
     uint8_t write_enable;
     uint8_t write_data;
     
@@ -43,6 +50,7 @@ typedef struct {
     uint8_t sd_cs;
     uint8_t sd_sck;
     uint8_t sd_mosi;
+    uint8_t sd_detect;       // Card-detect ключ на гнездото (ниско = картата е поставена), GPIO_NONE ако няма
     
     // I2C за OLED
     uint8_t i2c_sda;
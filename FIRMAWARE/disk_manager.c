@@ -4,10 +4,13 @@
 
 #include "disk_manager.h"
 #include "ff.h"
-#include "cli.h"
+#include "log.h"
+#include "profile.h"
+#include "journal.h"
 #include <string.h>
 #include <stdio.h>
-#include "pico/time.h"
+#include <stdlib.h>
+#include <ctype.h>
 
 // FatFS file access mode definitions (ако не са дефинирани в ff.h)
 #ifndef FA_READ
@@ -32,268 +35,792 @@
 #define AM_MASK 0x3F    // Mask of defined bits
 #endif
 
-void disk_manager_init(disk_manager_t *dm) {
-    memset(dm, 0, sizeof(disk_manager_t));
-    dm->current_index = 0;
-    dm->disk_loaded = false;
-    strncpy(dm->current_path, "", MAX_PATH_LEN - 1);
-    dm->current_path[MAX_PATH_LEN - 1] = '\0';
+// Заглавие на каталога (DSKCAT.BIN)
+// След него следват count записа: размер (4 байта), формат (1), дължина на името (1), име
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t signature;   // Подпис на директориите към момента на сканиране
+    uint16_t flags;
+    uint16_t reserved;
+} catalog_header_t;
+
+// Запис в индекса (DSKCAT.IDX) - сортиран по ключ, после по позиция
+typedef struct {
+    uint32_t offset;               // Позиция на записа в DSKCAT.BIN
+    char key[CATALOG_KEY_LEN];     // Името без пътя, с главни букви
+} catalog_index_t;
+
+#define CATALOG_RECORD_META 6      // Размер, формат и дължина на името
+#define CATALOG_SORT_RUN 64        // Записи от индекса, сортирани наведнъж в RAM (и слети на стъпка)
+
+// Работни файлове и буфер при сортиране на индекса (използват се само при изграждане)
+static FIL sort_src_a;
+static FIL sort_src_b;
+static FIL sort_dst;
+static catalog_index_t sort_run[CATALOG_SORT_RUN];
+
+// Докъде е стигнало сортирането между стъпките на сканирането
+static struct {
+    uint16_t count;                // Записи в индекса
+    uint32_t width;                // Дължина на сливаните участъци (0 - сортиране на участъци в RAM)
+    uint32_t lo, mid, hi;          // Текущата двойка участъци [lo, mid) и [mid, hi)
+    uint32_t i, j;                 // Следващият запис от всеки участък
+    catalog_index_t a, b;          // Прочетените записи i и j
+    bool to_temp;                  // Текущото сливане пише в DSKCAT.TMP
+} sort;
+
+// Определяне на формата по размера на файла
+static disk_format_t disk_format_from_size(uint32_t file_size) {
+    if (file_size == 35 * 13 * 256) {
+        return DISK_FORMAT_13_SECTOR;  // DOS 3.3
+    }
+    // ProDOS и по подразбиране - 16 сектора
+    return DISK_FORMAT_16_SECTOR;
+}
+
+// FNV-1a хеш за подписа на директориите
+static uint32_t catalog_hash(uint32_t hash, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len--) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Ключ за сортиране: името без пътя, с главни букви, допълнено с нули
+static void catalog_make_key(const char *name, char *key) {
+    memset(key, 0, CATALOG_KEY_LEN);
+    for (int i = 0; i < CATALOG_KEY_LEN && name[i] != '\0'; i++) {
+        key[i] = (char)toupper((unsigned char)name[i]);
+    }
+}
+
+static const char* catalog_basename(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int catalog_index_compare(const void *a, const void *b) {
+    const catalog_index_t *ea = (const catalog_index_t *)a;
+    const catalog_index_t *eb = (const catalog_index_t *)b;
+    int c = memcmp(ea->key, eb->key, CATALOG_KEY_LEN);
+    if (c != 0) {
+        return c;
+    }
+    return (ea->offset > eb->offset) - (ea->offset < eb->offset);
 }
 
-// Стандартно сканиране (само корнева директория)
-bool disk_manager_scan(disk_manager_t *dm) {
-    FRESULT res;
-    DIR dir;
+// Затваряне на отворения за четене каталог
+static void catalog_close(disk_manager_t *dm) {
+    if (dm->catalog_open) {
+        f_close(&dm->catalog_file);
+        f_close(&dm->index_file);
+        dm->catalog_open = false;
+    }
+    dm->count = 0;
+    dm->page_start = 0;
+    dm->page_count = 0;
+}
+
+// Отваряне на каталога за четене; signature получава подписа от заглавието
+static bool catalog_open(disk_manager_t *dm, uint16_t flags, uint32_t *signature) {
+    UINT br;
+    catalog_header_t header;
     FILINFO fno;
-    uint8_t count = 0;
-    uint8_t total_files = 0;
-    
-    printf("=== Сканиране за .dsk файлове (само корнева директория) ===\n");
-    printf("Започване на сканиране...\n");
-    
-    // Проверка дали използваме правилната версия на FatFS
-    #ifdef FF_DEFINED
-    printf("FatFS версия: FF_DEFINED = %d (пълна версия)\n", FF_DEFINED);
-    #else
-    printf("ВНИМАНИЕ: FF_DEFINED не е дефиниран - използва се опростена версия!\n");
-    printf("  За пълна функционалност, уверете се че fatfs/ff.c се компилира!\n");
-    #endif
-    
-    // Забавяне преди започване на сканиране за стабилност
-    sleep_ms(50);
-    
-    // Проверка дали файловата система е монтирана
-    // (няма директен начин да проверим, но опитът за отваряне на директория ще покаже)
-    
-#if FF_USE_FIND
-    // Използване на f_findfirst/f_findnext за по-надеждно търсене
-    res = f_findfirst(&dir, &fno, "", "*.DSK");
-    if (res == FR_OK) {
-        // Търсене на .DSK файлове (главни букви)
-        while (count < MAX_DISK_IMAGES && fno.fname[0] != 0) {
-            if (!(fno.fattrib & AM_DIR) && !(fno.fattrib & AM_HID)) {
-                strncpy(dm->images[count].filename, fno.fname, MAX_FILENAME_LEN - 1);
-                dm->images[count].filename[MAX_FILENAME_LEN - 1] = '\0';
-                dm->images[count].file_size = fno.fsize;
-                dm->images[count].format = DISK_FORMAT_AUTO;
-                dm->images[count].loaded = false;
-                printf("Намерен .DSK файл: %s (размер: %lu байта)\n", 
-                       dm->images[count].filename, 
-                       (unsigned long)dm->images[count].file_size);
-                count++;
+    
+    catalog_close(dm);
+    
+    if (f_open(&dm->catalog_file, CATALOG_FILENAME, FA_READ) != FR_OK) {
+        return false;
+    }
+    
+    if (f_read(&dm->catalog_file, &header, sizeof(header), &br) != FR_OK || br != sizeof(header) ||
+        header.magic != CATALOG_MAGIC || header.version != CATALOG_VERSION ||
+        header.flags != flags || header.count > CATALOG_MAX_IMAGES) {
+        f_close(&dm->catalog_file);
+        return false;
+    }
+    
+    // Индексът трябва да съдържа точно count записа
+    if (f_stat(CATALOG_INDEX_FILENAME, &fno) != FR_OK ||
+        fno.fsize != (FSIZE_t)header.count * sizeof(catalog_index_t) ||
+        f_open(&dm->index_file, CATALOG_INDEX_FILENAME, FA_READ) != FR_OK) {
+        f_close(&dm->catalog_file);
+        return false;
+    }
+    
+    dm->count = header.count;
+    dm->catalog_open = true;
+    *signature = header.signature;
+    return true;
+}
+
+// Начало на изграждане на нов каталог
+// Записите се добавят директно на картата - паметта не зависи от броя имиджи
+static bool catalog_begin(disk_manager_t *dm) {
+    UINT bw;
+    catalog_header_t header;
+    
+    catalog_close(dm);
+    dm->catalog_building = false;
+    
+    if (f_open(&dm->catalog_file, CATALOG_FILENAME, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        printf("ПРЕДУПРЕЖДЕНИЕ: Каталогът не може да се създаде\n");
+        return false;
+    }
+    if (f_open(&dm->index_file, CATALOG_INDEX_FILENAME, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        printf("ПРЕДУПРЕЖДЕНИЕ: Индексът на каталога не може да се създаде\n");
+        f_close(&dm->catalog_file);
+        return false;
+    }
+    
+    // Празно заглавие - каталогът е невалиден докато не бъде завършен
+    memset(&header, 0, sizeof(header));
+    if (f_write(&dm->catalog_file, &header, sizeof(header), &bw) != FR_OK || bw != sizeof(header)) {
+        f_close(&dm->catalog_file);
+        f_close(&dm->index_file);
+        return false;
+    }
+    
+    dm->catalog_building = true;
+    return true;
+}
+
+// Добавяне на имидж към изгражданият каталог
+static bool catalog_add(disk_manager_t *dm, const char *path, uint32_t file_size) {
+    UINT bw;
+    
+    if (!dm->catalog_building || dm->count >= CATALOG_MAX_IMAGES) {
+        return false;
+    }
+    
+    size_t name_len = strlen(path);
+    if (name_len >= MAX_FILENAME_LEN) {
+        return false;
+    }
+    
+    catalog_index_t entry;
+    entry.offset = (uint32_t)f_tell(&dm->catalog_file);
+    catalog_make_key(catalog_basename(path), entry.key);
+    
+    uint8_t meta[CATALOG_RECORD_META] = {
+        file_size & 0xFF, (file_size >> 8) & 0xFF,
+        (file_size >> 16) & 0xFF, (file_size >> 24) & 0xFF,
+        (uint8_t)disk_format_from_size(file_size), (uint8_t)name_len
+    };
+    
+    if (f_write(&dm->catalog_file, meta, sizeof(meta), &bw) != FR_OK || bw != sizeof(meta) ||
+        f_write(&dm->catalog_file, path, name_len, &bw) != FR_OK || bw != name_len ||
+        f_write(&dm->index_file, &entry, sizeof(entry), &bw) != FR_OK || bw != sizeof(entry)) {
+        printf("ПРЕДУПРЕЖДЕНИЕ: Грешка при запис в каталога\n");
+        dm->catalog_building = false;
+        return false;
+    }
+    
+    dm->count++;
+    return true;
+}
+
+// Сортиране на индекса на картата (външно сливане с постоянна памет)
+// Първо се сортират участъци по CATALOG_SORT_RUN записа в RAM, после участъците
+// се сливат по двойки между DSKCAT.IDX и DSKCAT.TMP до един сортиран файл.
+// Сортирането върви на стъпки от сканирането: по един участък или по
+// CATALOG_SORT_RUN слети записа на стъпка.
+
+static void catalog_sort_close(void) {
+    f_close(&sort_src_a);
+    f_close(&sort_src_b);
+    f_close(&sort_dst);
+}
+
+// Начало на сливането на двойката участъци от sort.lo
+static bool catalog_sort_pair(void) {
+    UINT br;
+    
+    sort.mid = (sort.lo + sort.width < sort.count) ? sort.lo + sort.width : sort.count;
+    sort.hi = (sort.lo + 2 * sort.width < sort.count) ? sort.lo + 2 * sort.width : sort.count;
+    sort.i = sort.lo;
+    sort.j = sort.mid;
+    
+    if (f_lseek(&sort_src_a, (FSIZE_t)sort.lo * sizeof(sort.a)) != FR_OK ||
+        f_lseek(&sort_src_b, (FSIZE_t)sort.mid * sizeof(sort.b)) != FR_OK) {
+        return false;
+    }
+    if (sort.i < sort.mid && (f_read(&sort_src_a, &sort.a, sizeof(sort.a), &br) != FR_OK || br != sizeof(sort.a))) {
+        return false;
+    }
+    if (sort.j < sort.hi && (f_read(&sort_src_b, &sort.b, sizeof(sort.b), &br) != FR_OK || br != sizeof(sort.b))) {
+        return false;
+    }
+    return true;
+}
+
+// Начало на проход на сливането с участъци от sort.width записа
+static bool catalog_sort_pass(void) {
+    const char *src = sort.to_temp ? CATALOG_INDEX_FILENAME : CATALOG_TEMP_FILENAME;
+    const char *dst = sort.to_temp ? CATALOG_TEMP_FILENAME : CATALOG_INDEX_FILENAME;
+    
+    if (f_open(&sort_src_a, src, FA_READ) != FR_OK) {
+        return false;
+    }
+    if (f_open(&sort_src_b, src, FA_READ) != FR_OK) {
+        f_close(&sort_src_a);
+        return false;
+    }
+    if (f_open(&sort_dst, dst, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        f_close(&sort_src_a);
+        f_close(&sort_src_b);
+        return false;
+    }
+    sort.lo = 0;
+    return catalog_sort_pair();
+}
+
+// Начало на сортирането на индекса с count записа (файлът е затворен)
+static bool catalog_sort_begin(uint16_t count) {
+    memset(&sort, 0, sizeof(sort));
+    sort.count = count;
+    if (f_open(&sort_dst, CATALOG_INDEX_FILENAME, FA_READ | FA_WRITE) != FR_OK) {
+        return false;
+    }
+    return true;
+}
+
+// Участък в RAM: sort.lo е началото му в DSKCAT.IDX
+static bool catalog_sort_run(void) {
+    UINT br, bw;
+    uint32_t n = sort.count - sort.lo;
+    if (n > CATALOG_SORT_RUN) {
+        n = CATALOG_SORT_RUN;
+    }
+    UINT bytes = n * sizeof(catalog_index_t);
+    
+    if (f_lseek(&sort_dst, (FSIZE_t)sort.lo * sizeof(catalog_index_t)) != FR_OK ||
+        f_read(&sort_dst, sort_run, bytes, &br) != FR_OK || br != bytes) {
+        return false;
+    }
+    qsort(sort_run, n, sizeof(catalog_index_t), catalog_index_compare);
+    if (f_lseek(&sort_dst, (FSIZE_t)sort.lo * sizeof(catalog_index_t)) != FR_OK ||
+        f_write(&sort_dst, sort_run, bytes, &bw) != FR_OK || bw != bytes) {
+        return false;
+    }
+    sort.lo += n;
+    return true;
+}
+
+// Най-много CATALOG_SORT_RUN записа от сливането на текущата двойка участъци
+static bool catalog_sort_merge(void) {
+    UINT br, bw;
+    
+    for (uint16_t n = 0; n < CATALOG_SORT_RUN && (sort.i < sort.mid || sort.j < sort.hi); n++) {
+        bool take_a = (sort.j >= sort.hi) || (sort.i < sort.mid && catalog_index_compare(&sort.a, &sort.b) <= 0);
+        if (take_a) {
+            if (f_write(&sort_dst, &sort.a, sizeof(sort.a), &bw) != FR_OK || bw != sizeof(sort.a)) {
+                return false;
             }
-            res = f_findnext(&dir, &fno);
-            if (res != FR_OK) break;
-        }
-        f_closedir(&dir);
-    }
-    
-    // Търсене на .dsk файлове (малки букви)
-    res = f_findfirst(&dir, &fno, "", "*.dsk");
-    if (res == FR_OK) {
-        while (count < MAX_DISK_IMAGES && fno.fname[0] != 0) {
-            if (!(fno.fattrib & AM_DIR) && !(fno.fattrib & AM_HID)) {
-                strncpy(dm->images[count].filename, fno.fname, MAX_FILENAME_LEN - 1);
-                dm->images[count].filename[MAX_FILENAME_LEN - 1] = '\0';
-                dm->images[count].file_size = fno.fsize;
-                dm->images[count].format = DISK_FORMAT_AUTO;
-                dm->images[count].loaded = false;
-                printf("Намерен .dsk файл: %s (размер: %lu байта)\n", 
-                       dm->images[count].filename, 
-                       (unsigned long)dm->images[count].file_size);
-                count++;
+            if (++sort.i < sort.mid && (f_read(&sort_src_a, &sort.a, sizeof(sort.a), &br) != FR_OK || br != sizeof(sort.a))) {
+                return false;
+            }
+        } else {
+            if (f_write(&sort_dst, &sort.b, sizeof(sort.b), &bw) != FR_OK || bw != sizeof(sort.b)) {
+                return false;
+            }
+            if (++sort.j < sort.hi && (f_read(&sort_src_b, &sort.b, sizeof(sort.b), &br) != FR_OK || br != sizeof(sort.b))) {
+                return false;
             }
-            res = f_findnext(&dir, &fno);
-            if (res != FR_OK) break;
         }
-        f_closedir(&dir);
     }
-#endif
+    return true;
+}
+
+// Една стъпка от сортирането; done става true, когато индексът е сортиран в DSKCAT.IDX
+// При грешка работните файлове се затварят.
+static bool catalog_sort_step(bool *done) {
+    bool ok = true;
+    *done = false;
     
-    // Fallback: Стандартно сканиране на директорията
-    printf("Опит за отваряне на корневата директория...\n");
-    res = f_opendir(&dir, "");
-    if (res != FR_OK) {
-        printf("ГРЕШКА: Не може да се отвори директория (код: %d)\n", res);
-        switch (res) {
-            case FR_DISK_ERR:
-                printf("  -> Грешка при достъп до диска\n");
-                break;
-            case FR_INT_ERR:
-                printf("  -> Вътрешна грешка на файловата система\n");
-                break;
-            case FR_NOT_READY:
-                printf("  -> Дискът не е готов\n");
-                break;
-            case FR_NO_FILESYSTEM:
-                printf("  -> Няма валидна FAT файлова система\n");
-                break;
-            default:
-                printf("  -> Непозната грешка\n");
-                break;
+    if (sort.width == 0) {
+        // Участъците в RAM
+        ok = (sort.lo < sort.count) ? catalog_sort_run() : true;
+        if (ok && sort.lo >= sort.count) {
+            ok = (f_close(&sort_dst) == FR_OK);
+            sort.width = CATALOG_SORT_RUN;
+            sort.to_temp = true;
+            if (ok && sort.width < sort.count) {
+                ok = catalog_sort_pass();
+            }
         }
-        if (count > 0) {
-            dm->count = count;
-            printf("Намерени са %d файла преди грешката\n", count);
-            return true;
+    } else {
+        ok = catalog_sort_merge();
+        if (ok && sort.i >= sort.mid && sort.j >= sort.hi) {
+            sort.lo += 2 * sort.width;
+            if (sort.lo < sort.count) {
+                ok = catalog_sort_pair();
+            } else {
+                // Край на прохода - следващият е с двойно по-дълги участъци в обратната посока
+                catalog_sort_close();
+                sort.width *= 2;
+                sort.to_temp = !sort.to_temp;
+                if (sort.width < sort.count) {
+                    ok = catalog_sort_pass();
+                }
+            }
         }
+    }
+    
+    if (!ok) {
+        catalog_sort_close();
         return false;
     }
+    if (sort.width == 0 || sort.width < sort.count) {
+        return true;
+    }
     
-    printf("Директорията е отворена успешно. Започване на четене на файлове...\n");
+    // Резултатът трябва да е в DSKCAT.IDX (последният проход е писал в DSKCAT.TMP, ако to_temp е false)
+    *done = true;
+    if (!sort.to_temp) {
+        f_unlink(CATALOG_INDEX_FILENAME);
+        if (f_rename(CATALOG_TEMP_FILENAME, CATALOG_INDEX_FILENAME) != FR_OK) {
+            return false;
+        }
+    } else {
+        f_unlink(CATALOG_TEMP_FILENAME);
+    }
+    return true;
+}
+
+// Край на записа на новия каталог: файловете се затварят и индексът се подготвя за сортиране
+static bool catalog_end_build(disk_manager_t *dm) {
+    uint16_t count = dm->count;
     
-    // Забавяне преди започване на четене
-    sleep_ms(10);
+    if (!dm->catalog_building) {
+        f_close(&dm->catalog_file);
+        f_close(&dm->index_file);
+        dm->count = 0;
+        return false;
+    }
+    dm->catalog_building = false;
     
-    // Инициализация на FILINFO структурата
-    memset(&fno, 0, sizeof(fno));
+    bool ok = (f_close(&dm->catalog_file) == FR_OK) && (f_close(&dm->index_file) == FR_OK);
+    dm->count = 0;
     
-    // Търсене на .dsk файлове
-    while (count < MAX_DISK_IMAGES) {
-        // Забавяне между четенията за стабилност
-        sleep_ms(5);
-        
-        res = f_readdir(&dir, &fno);
-        printf("f_readdir[%d]: код=%d", total_files + 1, res);
-        
-        // Проверка за грешка или край на директорията
-        if (res != FR_OK) {
-            printf(" - ГРЕШКА\n");
-            if (res == FR_NO_FILE) {
-                printf("  FR_NO_FILE - край на директорията или празна директория\n");
-                printf("  Прочетени общо %d елемента преди края\n", total_files);
-            } else {
-                printf("  Други грешки: код %d\n", res);
-            }
-            break;
-        }
-        
-        if (fno.fname[0] == 0) {
-            printf(" - празно име (край на директорията)\n");
-            printf("  Прочетени общо %d елемента\n", total_files);
-            break;
+    return ok && catalog_sort_begin(count);
+}
+
+// Завършване на каталога след сортирането: запис на заглавието и отваряне за четене
+// Заглавието се записва последно, за да не остане валиден каталог с несортиран индекс.
+static bool catalog_finish(disk_manager_t *dm, bool ok, uint32_t signature, uint16_t flags) {
+    UINT bw;
+    
+    if (ok) {
+        catalog_header_t header = {
+            .magic = CATALOG_MAGIC,
+            .version = CATALOG_VERSION,
+            .count = sort.count,
+            .signature = signature,
+            .flags = flags,
+            .reserved = 0
+        };
+        ok = (f_open(&dm->catalog_file, CATALOG_FILENAME, FA_WRITE | FA_OPEN_EXISTING) == FR_OK);
+        if (ok) {
+            ok = (f_write(&dm->catalog_file, &header, sizeof(header), &bw) == FR_OK && bw == sizeof(header));
+            ok = (f_close(&dm->catalog_file) == FR_OK) && ok;
         }
-        
-        printf(", файл: '%s', размер: %lu, атрибути: 0x%02X\n", 
-               fno.fname, (unsigned long)fno.fsize, fno.fattrib);
-        
-        total_files++;
-        
-        // Пропускане на директории и скрити файлове
-        if (fno.fattrib & (AM_DIR | AM_HID)) {
-            continue;
+    }
+    
+    uint32_t stored = 0;
+    if (!ok || !catalog_open(dm, flags, &stored) || stored != signature) {
+        catalog_close(dm);
+        // Непълен каталог не трябва да остава на картата
+        f_unlink(CATALOG_FILENAME);
+        f_unlink(CATALOG_INDEX_FILENAME);
+        f_unlink(CATALOG_TEMP_FILENAME);
+        printf("ПРЕДУПРЕЖДЕНИЕ: Грешка при запис на каталога\n");
+        return false;
+    }
+    
+    printf("Каталогът е записан (%d дискови имиджа)\n", dm->count);
+    return true;
+}
+
+// Четене на ключа на index-ия запис от сортирания индекс
+static bool catalog_read_index(disk_manager_t *dm, uint16_t index, catalog_index_t *entry) {
+    UINT br;
+    return f_lseek(&dm->index_file, (FSIZE_t)index * sizeof(*entry)) == FR_OK &&
+           f_read(&dm->index_file, entry, sizeof(*entry), &br) == FR_OK && br == sizeof(*entry);
+}
+
+// Четене на index-ия (по сортиран ред) запис от каталога
+static bool catalog_read_entry(disk_manager_t *dm, uint16_t index, catalog_entry_t *entry) {
+    catalog_index_t ie;
+    uint8_t meta[CATALOG_RECORD_META];
+    UINT br;
+    
+    if (!catalog_read_index(dm, index, &ie) ||
+        f_lseek(&dm->catalog_file, ie.offset) != FR_OK ||
+        f_read(&dm->catalog_file, meta, sizeof(meta), &br) != FR_OK || br != sizeof(meta) ||
+        meta[5] >= MAX_FILENAME_LEN ||
+        f_read(&dm->catalog_file, entry->filename, meta[5], &br) != FR_OK || br != meta[5]) {
+        return false;
+    }
+    
+    entry->filename[meta[5]] = '\0';
+    entry->file_size = (uint32_t)meta[0] | ((uint32_t)meta[1] << 8) |
+                       ((uint32_t)meta[2] << 16) | ((uint32_t)meta[3] << 24);
+    entry->format = (disk_format_t)meta[4];
+    return true;
+}
+
+// Зареждане на страница от каталога, съдържаща index
+// При превъртане нагоре страницата завършва на index, иначе започва от него
+static bool catalog_load_page(disk_manager_t *dm, uint16_t index) {
+    uint16_t start = index;
+    if (dm->page_count > 0 && index < dm->page_start) {
+        start = (index >= CATALOG_PAGE_SIZE - 1) ? index - (CATALOG_PAGE_SIZE - 1) : 0;
+    }
+    if (start + CATALOG_PAGE_SIZE > dm->count) {
+        start = (dm->count > CATALOG_PAGE_SIZE) ? dm->count - CATALOG_PAGE_SIZE : 0;
+    }
+    
+    dm->page_start = start;
+    dm->page_count = 0;
+    
+    for (uint16_t i = start; i < dm->count && dm->page_count < CATALOG_PAGE_SIZE; i++) {
+        if (!catalog_read_entry(dm, i, &dm->page[dm->page_count])) {
+            return false;
         }
-        
-        // Проверка за .dsk разширение (case-insensitive)
-        size_t len = strlen(fno.fname);
-        if (len < 4) {
-            continue;
+        dm->page_count++;
+    }
+    return true;
+}
+
+// Първият запис с ключ >= key (двоично търсене в индекса на картата)
+static uint16_t catalog_lower_bound(disk_manager_t *dm, const char *key) {
+    uint16_t lo = 0;
+    uint16_t hi = dm->count;
+    catalog_index_t ie;
+    
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (!catalog_read_index(dm, mid, &ie)) {
+            return lo;
         }
-        
-        const char *ext = fno.fname + len - 4;
-        bool is_dsk = (ext[0] == '.' && 
-                      (ext[1] == 'd' || ext[1] == 'D') &&
-                      (ext[2] == 's' || ext[2] == 'S') &&
-                      (ext[3] == 'k' || ext[3] == 'K'));
-        
-        if (is_dsk) {
-            // Проверка дали файлът вече не е добавен (от f_findfirst)
-            bool already_added = false;
-            for (uint8_t i = 0; i < count; i++) {
-                if (strcmp(dm->images[i].filename, fno.fname) == 0) {
-                    already_added = true;
-                    break;
-                }
-            }
-            
-            if (!already_added) {
-                strncpy(dm->images[count].filename, fno.fname, MAX_FILENAME_LEN - 1);
-                dm->images[count].filename[MAX_FILENAME_LEN - 1] = '\0';
-                dm->images[count].file_size = fno.fsize;
-                dm->images[count].format = DISK_FORMAT_AUTO;
-                dm->images[count].loaded = false;
-                printf("Намерен .dsk файл: %s (размер: %lu байта)\n", 
-                       dm->images[count].filename, 
-                       (unsigned long)dm->images[count].file_size);
-                count++;
-            }
+        if (memcmp(ie.key, key, CATALOG_KEY_LEN) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
+}
+
+// Проверка за поддържано разширение на дисков имидж
+// .dsk - Disk II имиджи, .po/.hdv - ProDOS томове (SmartPort)
+// Разширението на name с главни букви в upper (празно, ако не е от 2-3 знака)
+static void image_name_ext(const char *name, char *upper) {
+    const char *ext = strrchr(name, '.');
+    upper[0] = '\0';
+    if (ext == NULL) {
+        return;
+    }
+    ext++;
     
-    f_closedir(&dir);
-    dm->count = count;
+    size_t len = strlen(ext);
+    if (len < 2 || len > 3) {
+        return;
+    }
+    for (size_t i = 0; i <= len; i++) {
+        upper[i] = toupper((unsigned char)ext[i]);
+    }
+}
+
+// .dsk са дискети за Disk II; .po и .hdv са томове в реда на ProDOS блоковете
+bool disk_manager_is_image_name(const char *name) {
+    char upper[4];
+    image_name_ext(name, upper);
+    return strcmp(upper, "DSK") == 0 || strcmp(upper, "PO") == 0 || strcmp(upper, "HDV") == 0;
+}
+
+static bool is_block_order_name(const char *name) {
+    char upper[4];
+    image_name_ext(name, upper);
+    return strcmp(upper, "PO") == 0 || strcmp(upper, "HDV") == 0;
+}
+
+// Размер на 5.25" дискета в някой от форматите (35 пътеки по 13 или 16 сектора)
+bool disk_manager_is_floppy_size(uint32_t file_size) {
+    const disk_format_t formats[] = { DISK_FORMAT_13_SECTOR, DISK_FORMAT_16_SECTOR };
+    for (uint8_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        const disk_config_t *config = get_disk_config(formats[i]);
+        if (config && file_size == (uint32_t)config->tracks_per_disk * config->sectors_per_track * config->bytes_per_sector) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Служебни файлове в корена - не влизат в каталога и в подписа
+static bool is_catalog_file_name(const char *name) {
+    return strcmp(name, CATALOG_FILENAME) == 0 ||
+           strcmp(name, CATALOG_INDEX_FILENAME) == 0 ||
+           strcmp(name, CATALOG_TEMP_FILENAME) == 0 ||
+           strcmp(name, LAST_IMAGE_FILENAME) == 0;
+}
+
+// Придружаващи файлове до имиджите (профил, журнал) - сменят се при работа,
+// затова не влизат в подписа на каталога и не се показват в навигацията
+static bool is_sidecar_name(const char *name) {
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL) {
+        return false;
+    }
     
-    printf("Общо файлове в директорията: %d\n", total_files);
-    printf("Намерени %d дискови имиджа\n", count);
+    char upper[5];
+    size_t len = strlen(ext);
+    if (len >= sizeof(upper)) {
+        return false;
+    }
+    for (size_t i = 0; i <= len; i++) {
+        upper[i] = toupper((unsigned char)ext[i]);
+    }
+    return strcmp(upper, PROFILE_EXT) == 0 || strcmp(upper, JOURNAL_EXT) == 0;
+}
+
+void disk_manager_init(disk_manager_t *dm) {
+    memset(dm, 0, sizeof(disk_manager_t));
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        dm->current_index[i] = CATALOG_INDEX_NONE;
+        dm->disk_loaded[i] = false;
+    }
+    dm->drive = 0;
+    strncpy(dm->current_path, "", MAX_PATH_LEN - 1);
+    dm->current_path[MAX_PATH_LEN - 1] = '\0';
+}
+
+// Избор на устройството, към което се отнасят load/unload/next/prev/get_current
+bool disk_manager_select_drive(disk_manager_t *dm, uint8_t drive) {
+    if (drive >= DRIVE_COUNT) {
+        return false;
+    }
+    dm->drive = drive;
+    return true;
+}
+
+uint8_t disk_manager_get_drive(disk_manager_t *dm) {
+    return dm->drive;
+}
+
+// Зареденият имидж в дадено устройство (NULL ако е празно)
+disk_image_t* disk_manager_get_image(disk_manager_t *dm, uint8_t drive) {
+    if (drive >= DRIVE_COUNT || !dm->disk_loaded[drive]) {
+        return NULL;
+    }
+    return &dm->images[drive];
+}
+
+// Ключ на имиджа: път и размер, без датата (тя се сменя при всеки запис в имиджа)
+uint32_t disk_manager_image_key(const disk_image_t *image) {
+    if (!image || !image->loaded) {
+        return 0;
+    }
+    uint32_t key = catalog_hash(2166136261u, image->filename, strlen(image->filename));
+    key = catalog_hash(key, &image->file_size, sizeof(image->file_size));
+    return key ? key : 1;
+}
+
+// Път до придружаващ файл на заредения имидж: разширението се заменя с ext
+// (GAME.DSK -> GAME.PRF); ext включва точката
+bool disk_manager_sidecar_path(disk_manager_t *dm, uint8_t drive, const char *ext, char *path, size_t size) {
+    disk_image_t *image = disk_manager_get_image(dm, drive);
+    if (!image || !image->loaded) {
+        return false;
+    }
     
-    if (count == 0 && total_files > 0) {
-        printf("ПРЕДУПРЕЖДЕНИЕ: Намерени са файлове, но никой не е .dsk файл!\n");
-        printf("Моля, проверете че файловете имат разширение .dsk (малки или главни букви)\n");
-    } else if (count == 0 && total_files == 0) {
-        printf("ПРЕДУПРЕЖДЕНИЕ: Директорията е празна или не може да се прочете!\n");
+    size_t len = strlen(image->filename);
+    const char *slash = strrchr(image->filename, '/');
+    const char *dot = strrchr(image->filename, '.');
+    if (dot && (!slash || dot > slash)) {
+        len = dot - image->filename;
+    }
+    if (len + strlen(ext) + 1 > size) {
+        return false;
     }
     
-    return count > 0;
+    memcpy(path, image->filename, len);
+    strcpy(path + len, ext);
+    return true;
+}
+
+// Запомняне на заредените имиджи (за монтиране при следващо стартиране)
+// По един ред на устройство; празен ред за празно устройство
+static void last_image_save(disk_manager_t *dm) {
+    FIL file;
+    UINT bw;
+    
+    if (f_open(&file, LAST_IMAGE_FILENAME, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        return;
+    }
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        if (dm->disk_loaded[i]) {
+            f_write(&file, dm->images[i].filename, strlen(dm->images[i].filename), &bw);
+        }
+        f_write(&file, "\n", 1, &bw);
+    }
+    f_close(&file);
 }
 
-bool disk_manager_load(disk_manager_t *dm, uint8_t index) {
-    if (index >= dm->count) {
+// Отваряне на имидж по път в избраното устройство
+// (index е позицията му в каталога или CATALOG_INDEX_NONE)
+static bool disk_manager_open_image(disk_manager_t *dm, const char *path, uint32_t file_size,
+                                    uint16_t index, bool remember) {
+    disk_image_t *image = &dm->images[dm->drive];
+    
+    if (strlen(path) >= MAX_FILENAME_LEN) {
         return false;
     }
     
-    // Затваряне на текущия файл ако е отворен
-    if (dm->disk_loaded && dm->images[dm->current_index].loaded) {
-        f_close(&dm->images[dm->current_index].file_handle);
-        dm->images[dm->current_index].loaded = false;
+    // Един имидж не може да бъде отворен за запис в две устройства
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        if (i != dm->drive && dm->disk_loaded[i] && strcmp(dm->images[i].filename, path) == 0) {
+            printf("ГРЕШКА: %s вече е зареден в устройство %d\n", path, i + 1);
+            return false;
+        }
     }
     
+    // Затваряне на текущия файл ако е отворен
+    disk_manager_unload(dm);
+    
     // Отваряне на новия файл
-    FRESULT res = f_open(&dm->images[index].file_handle, 
-                        dm->images[index].filename, 
-                        FA_READ | FA_WRITE);
+    FRESULT res = f_open(&image->file_handle, path, FA_READ | FA_WRITE);
     if (res != FR_OK) {
         return false;
     }
     
+    strncpy(image->filename, path, MAX_FILENAME_LEN - 1);
+    image->filename[MAX_FILENAME_LEN - 1] = '\0';
+    image->file_size = file_size;
+    
+    // Отпечатък - същият непроменен файл след повторно монтиране (или смяна на картата)
+    // дава същия id и заредената пътека не се чете наново
+    FILINFO fno;
+    uint32_t id = catalog_hash(2166136261u, path, strlen(path));
+    id = catalog_hash(id, &file_size, sizeof(file_size));
+    if (f_stat(path, &fno) == FR_OK) {
+        id = catalog_hash(id, &fno.fdate, sizeof(fno.fdate));
+        id = catalog_hash(id, &fno.ftime, sizeof(fno.ftime));
+    }
+    image->id = id ? id : 1;
+    
     // Автоматично определяне на формат
-    uint32_t file_size = dm->images[index].file_size;
-    uint32_t size_13 = 35 * 13 * 256;  // DOS 3.3
-    uint32_t size_16 = 35 * 16 * 256;  // ProDOS
-    
-    if (file_size == size_13) {
-        dm->images[index].format = DISK_FORMAT_13_SECTOR;
-    } else if (file_size == size_16) {
-        dm->images[index].format = DISK_FORMAT_16_SECTOR;
-    } else {
-        // По подразбиране използваме 16 сектора
-        dm->images[index].format = DISK_FORMAT_16_SECTOR;
+    image->format = disk_format_from_size(file_size);
+    image->floppy = disk_manager_is_floppy_size(file_size);
+    image->block_order = is_block_order_name(path);
+    if (!image->floppy) {
+        printf("ПРЕДУПРЕЖДЕНИЕ: %s не е 5.25\" дискета - достъпен е само като SmartPort том\n", path);
     }
     
-    dm->current_index = index;
-    dm->images[index].loaded = true;
-    dm->disk_loaded = true;
+    dm->current_index[dm->drive] = index;
+    image->loaded = true;
+    dm->disk_loaded[dm->drive] = true;
     
     // Обновяване на конфигурацията
-    set_disk_format(dm->images[index].format);
+    set_disk_format(image->format);
     
-    printf("Зареден диск: %s (формат: %s)\n", 
-           dm->images[index].filename,
-           get_disk_config(dm->images[index].format)->format_name);
+    printf("Зареден диск в устройство %d: %s (формат: %s)\n", 
+           dm->drive + 1,
+           image->filename,
+           get_disk_config(image->format)->format_name);
+    
+    if (remember) {
+        last_image_save(dm);
+    }
     
     return true;
 }
 
+bool disk_manager_load(disk_manager_t *dm, uint16_t index) {
+    catalog_entry_t *entry = disk_manager_get_disk(dm, index);
+    if (entry == NULL) {
+        return false;
+    }
+    
+    // Копие - страницата може да се смени докато се отваря файлът
+    char path[MAX_FILENAME_LEN];
+    strncpy(path, entry->filename, MAX_FILENAME_LEN - 1);
+    path[MAX_FILENAME_LEN - 1] = '\0';
+    
+    return disk_manager_open_image(dm, path, entry->file_size, index, true);
+}
+
+// Зареждане на имидж по път (например от навигацията в директориите)
+bool disk_manager_load_path(disk_manager_t *dm, const char *path) {
+    FILINFO fno;
+    
+    if (f_stat(path, &fno) != FR_OK || (fno.fattrib & AM_DIR)) {
+        return false;
+    }
+    
+    return disk_manager_open_image(dm, path, (uint32_t)fno.fsize, disk_manager_find(dm, path), true);
+}
+
+// Зареждане на последно използваните имиджи във всички устройства (не изисква каталог)
+// Връща true ако поне едно устройство е заредено
+bool disk_manager_load_last(disk_manager_t *dm) {
+    FIL file;
+    FILINFO fno;
+    UINT br;
+    char buffer[DRIVE_COUNT * MAX_FILENAME_LEN];
+    bool loaded = false;
+    
+    if (f_open(&file, LAST_IMAGE_FILENAME, FA_READ) != FR_OK) {
+        return false;
+    }
+    bool ok = (f_read(&file, buffer, sizeof(buffer) - 1, &br) == FR_OK && br > 0);
+    f_close(&file);
+    if (!ok) {
+        return false;
+    }
+    buffer[br] = '\0';
+    
+    uint8_t selected = dm->drive;
+    char *line = buffer;
+    for (uint8_t i = 0; i < DRIVE_COUNT && line != NULL; i++) {
+        char *end = strchr(line, '\n');
+        if (end != NULL) {
+            *end = '\0';
+        }
+        
+        if (line[0] != '\0' && f_stat(line, &fno) == FR_OK &&
+            !(fno.fattrib & AM_DIR) && disk_manager_is_image_name(line)) {
+            dm->drive = i;
+            if (disk_manager_open_image(dm, line, (uint32_t)fno.fsize, disk_manager_find(dm, line), false)) {
+                loaded = true;
+            }
+        }
+        
+        line = (end != NULL) ? end + 1 : NULL;
+    }
+    dm->drive = selected;
+    
+    return loaded;
+}
+
 bool disk_manager_unload(disk_manager_t *dm) {
-    if (!dm->disk_loaded) {
+    disk_image_t *image = &dm->images[dm->drive];
+    
+    if (!dm->disk_loaded[dm->drive]) {
         return false;
     }
     
-    if (dm->images[dm->current_index].loaded) {
-        f_close(&dm->images[dm->current_index].file_handle);
-        dm->images[dm->current_index].loaded = false;
+    if (image->loaded) {
+        f_close(&image->file_handle);
+        image->loaded = false;
     }
     
-    dm->disk_loaded = false;
+    dm->disk_loaded[dm->drive] = false;
     return true;
 }
 
@@ -302,7 +829,10 @@ bool disk_manager_next(disk_manager_t *dm) {
         return false;
     }
     
-    uint8_t next = (dm->current_index + 1) % dm->count;
+    uint16_t next = 0;
+    if (dm->current_index[dm->drive] != CATALOG_INDEX_NONE) {
+        next = (dm->current_index[dm->drive] + 1) % dm->count;
+    }
     return disk_manager_load(dm, next);
 }
 
@@ -311,15 +841,15 @@ bool disk_manager_prev(disk_manager_t *dm) {
         return false;
     }
     
-    uint8_t prev = (dm->current_index - 1 + dm->count) % dm->count;
+    uint16_t prev = dm->count - 1;
+    if (dm->current_index[dm->drive] != CATALOG_INDEX_NONE) {
+        prev = (dm->current_index[dm->drive] + dm->count - 1) % dm->count;
+    }
     return disk_manager_load(dm, prev);
 }
 
 disk_image_t* disk_manager_get_current(disk_manager_t *dm) {
-    if (!dm->disk_loaded || dm->current_index >= dm->count) {
-        return NULL;
-    }
-    return &dm->images[dm->current_index];
+    return disk_manager_get_image(dm, dm->drive);
 }
 
 const char* disk_manager_get_current_name(disk_manager_t *dm) {
@@ -330,192 +860,305 @@ const char* disk_manager_get_current_name(disk_manager_t *dm) {
     return "None";
 }
 
-uint8_t disk_manager_get_count(disk_manager_t *dm) {
+uint16_t disk_manager_get_count(disk_manager_t *dm) {
     return dm->count;
 }
 
-disk_image_t* disk_manager_get_disk(disk_manager_t *dm, uint8_t index) {
-    if (index >= dm->count) {
+// Запис от каталога по позиция; указателят е валиден до следващото извикване
+// с позиция извън заредената страница
+catalog_entry_t* disk_manager_get_disk(disk_manager_t *dm, uint16_t index) {
+    if (!dm->catalog_open || index >= dm->count) {
         return NULL;
     }
-    return &dm->images[index];
+    
+    if (index < dm->page_start || index >= dm->page_start + dm->page_count) {
+        if (!catalog_load_page(dm, index)) {
+            dm->page_count = 0;
+            return NULL;
+        }
+    }
+    return &dm->page[index - dm->page_start];
 }
 
-uint8_t disk_manager_get_current_index(disk_manager_t *dm) {
-    return dm->current_index;
+uint16_t disk_manager_get_current_index(disk_manager_t *dm) {
+    return dm->current_index[dm->drive];
 }
 
-// Рекурсивно сканиране на директории за .dsk файлове
-static void scan_directory_recursive(disk_manager_t *dm, const char *path, uint8_t *count) {
-    FRESULT res;
-    DIR dir;
-    FILINFO fno;
-    char full_path[MAX_PATH_LEN];
-    char sub_path[MAX_PATH_LEN];
-    uint8_t items_in_dir = 0;
+// Позиция на имидж в каталога по пълния му път
+uint16_t disk_manager_find(disk_manager_t *dm, const char *path) {
+    char key[CATALOG_KEY_LEN];
+    catalog_entry_t entry;
+    catalog_index_t ie;
     
-    printf(">>> Сканиране на директория: '%s'\n", path ? path : "(root)");
+    if (!dm->catalog_open) {
+        return CATALOG_INDEX_NONE;
+    }
     
-    // Отваряне на директорията
-    res = f_opendir(&dir, path);
-    if (res != FR_OK) {
-        printf("  ГРЕШКА: Не може да се отвори директория '%s' (код: %d)\n", path ? path : "(root)", res);
-        return;
+    catalog_make_key(catalog_basename(path), key);
+    for (uint16_t i = catalog_lower_bound(dm, key); i < dm->count; i++) {
+        if (!catalog_read_index(dm, i, &ie) || memcmp(ie.key, key, CATALOG_KEY_LEN) != 0) {
+            break;
+        }
+        if (catalog_read_entry(dm, i, &entry) && strcmp(entry.filename, path) == 0) {
+            return i;
+        }
     }
+    return CATALOG_INDEX_NONE;
+}
+
+// Първият имидж, чието име е >= prefix (за прескачане по буква)
+// Ако няма такъв, връща последния; CATALOG_INDEX_NONE само при празен каталог
+uint16_t disk_manager_find_prefix(disk_manager_t *dm, const char *prefix) {
+    char key[CATALOG_KEY_LEN];
     
-    printf("  Директорията е отворена успешно\n");
+    if (!dm->catalog_open || dm->count == 0) {
+        return CATALOG_INDEX_NONE;
+    }
     
-    // Забавяне преди започване на четене
-    sleep_ms(10);
+    catalog_make_key(prefix, key);
+    uint16_t index = catalog_lower_bound(dm, key);
+    return (index < dm->count) ? index : dm->count - 1;
+}
+
+// Позициите на заредените имиджи в току-що отворения каталог
+static void catalog_locate_images(disk_manager_t *dm) {
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        if (dm->disk_loaded[i]) {
+            dm->current_index[i] = disk_manager_find(dm, dm->images[i].filename);
+        }
+    }
+}
+
+// Отваряне на директория от сканирането (path е в scan_path)
+static bool scan_push(disk_manager_t *dm) {
+    if (dm->scan_depth >= SCAN_MAX_DEPTH ||
+        f_opendir(&dm->scan_dirs[dm->scan_depth], dm->scan_path) != FR_OK) {
+        return false;
+    }
+    dm->scan_path_len[dm->scan_depth] = strlen(dm->scan_path);
+    dm->scan_depth++;
+    dm->scan_hash = catalog_hash(dm->scan_hash, dm->scan_path, strlen(dm->scan_path) + 1);
+    return true;
+}
+
+// Начало на обхождане на картата от корена
+static bool scan_walk_start(disk_manager_t *dm) {
+    dm->scan_depth = 0;
+    dm->scan_path[0] = '\0';
+    dm->scan_hash = 2166136261u;
+    return scan_push(dm);
+}
+
+static void scan_walk_close(disk_manager_t *dm) {
+    while (dm->scan_depth > 0) {
+        f_closedir(&dm->scan_dirs[--dm->scan_depth]);
+    }
+}
+
+// Край на сортирането: заглавие на новия каталог и позицията на заредените имиджи в него
+static void scan_sort_done(disk_manager_t *dm, bool ok) {
+    catalog_finish(dm, ok, dm->scan_hash, dm->scan_recursive ? CATALOG_FLAG_RECURSIVE : 0);
+    dm->scan_phase = SCAN_PHASE_IDLE;
     
-    // Четене на всички елементи в директорията
-    // Защита срещу безкрайни цикли - максимум 1000 опита
-    uint16_t max_iterations = 1000;
-    uint16_t iteration_count = 0;
+    catalog_locate_images(dm);
     
-    while (*count < MAX_DISK_IMAGES && iteration_count < max_iterations) {
-        iteration_count++;
-        
-        // Забавяне между четенията за стабилност
-        sleep_ms(5);
-        
-        // Обработка на CLI команди по време на сканиране
-        cli_process();
-        
-        res = f_readdir(&dir, &fno);
-        printf("  f_readdir[%d]: код=%d", iteration_count, res);
+    printf("=== РЕЗУЛТАТ: Намерени %d дискови имиджа (%lu елемента) ===\n",
+           dm->count, (unsigned long)dm->scan_entries);
+}
+
+// Край на обхождането: проверка на подписа или завършване на новия каталог
+static void scan_walk_done(disk_manager_t *dm) {
+    uint16_t flags = dm->scan_recursive ? CATALOG_FLAG_RECURSIVE : 0;
+    
+    if (dm->scan_phase == SCAN_PHASE_VERIFY) {
+        if (dm->scan_hash == dm->scan_expected) {
+            printf("Каталогът е валиден: %d дискови имиджа (%lu елемента проверени)\n",
+                   dm->count, (unsigned long)dm->scan_entries);
+            dm->scan_phase = SCAN_PHASE_IDLE;
+            return;
+        }
         
-        if (res != FR_OK) {
-            printf(" - ГРЕШКА\n");
-            if (res == FR_NO_FILE) {
-                printf("  Край на директорията (FR_NO_FILE) - прочетени %d елемента\n", items_in_dir);
-                break;
+        // Съдържанието е променено - каталогът се изгражда наново
+        printf("Каталогът е остарял, ново сканиране...\n");
+        if (!catalog_begin(dm) || !scan_walk_start(dm)) {
+            scan_walk_close(dm);
+            if (catalog_end_build(dm)) {
+                catalog_sort_close();
             }
-            // При други грешки опитваме се още веднъж с по-дълго забавяне
-            printf("  Опит за повторно четене след забавяне...\n");
-            sleep_ms(20);
-            cli_process();  // CLI обработка по време на забавяне
-            res = f_readdir(&dir, &fno);
-            printf("  Повторен опит: код=%d\n", res);
-            if (res != FR_OK) {
-                if (res == FR_NO_FILE) {
-                    printf("  Край на директорията (FR_NO_FILE при повторен опит)\n");
-                    break;
-                }
-                printf("  Повторен опит също неуспешен (код: %d), спиране\n", res);
-                break;
+            catalog_finish(dm, false, 0, flags);
+            dm->scan_phase = SCAN_PHASE_IDLE;
+            return;
+        }
+        dm->scan_phase = SCAN_PHASE_BUILD;
+        dm->scan_entries = 0;
+        return;
+    }
+    
+    // Индексът се сортира на следващите стъпки
+    if (catalog_end_build(dm)) {
+        dm->scan_phase = SCAN_PHASE_SORT;
+        return;
+    }
+    catalog_sort_close();
+    scan_sort_done(dm, false);
+}
+
+// Начало на фоново сканиране
+// Ако на картата има каталог със същия вид, той се отваря веднага и се проверява
+// при обхождането; иначе (или при force) се изгражда нов каталог.
+bool disk_manager_scan_begin(disk_manager_t *dm, bool recursive, bool force) {
+    uint16_t flags = recursive ? CATALOG_FLAG_RECURSIVE : 0;
+    
+    disk_manager_scan_abort(dm);
+    
+    dm->scan_recursive = recursive;
+    dm->scan_entries = 0;
+    
+    if (!force && catalog_open(dm, flags, &dm->scan_expected)) {
+        printf("Каталог: %d дискови имиджа, проверка на картата във фонов режим\n", dm->count);
+        catalog_locate_images(dm);
+        dm->scan_phase = SCAN_PHASE_VERIFY;
+    } else {
+        printf("=== Сканиране за .dsk файлове (%s) във фонов режим ===\n",
+               recursive ? "рекурсивно" : "само корнева директория");
+        if (!catalog_begin(dm)) {
+            return false;
+        }
+        dm->scan_phase = SCAN_PHASE_BUILD;
+    }
+    
+    if (!scan_walk_start(dm)) {
+        printf("ГРЕШКА: Не може да се отвори корневата директория\n");
+        disk_manager_scan_abort(dm);
+        return false;
+    }
+    return true;
+}
+
+// Една стъпка от сканирането: обработват се най-много max_entries елемента
+// или една стъпка от сортирането на индекса (само при idle - никое устройство не се върти)
+// Връща true докато сканирането не е завършило
+bool disk_manager_scan_step(disk_manager_t *dm, uint16_t max_entries, bool idle) {
+    FILINFO fno;
+    
+    if (dm->scan_phase == SCAN_PHASE_SORT) {
+        bool done = false;
+        if (idle) {
+            bool ok = catalog_sort_step(&done);
+            if (!ok || done) {
+                scan_sort_done(dm, ok);
             }
-        } else {
-            printf(", име: '%s'\n", fno.fname[0] ? fno.fname : "(празно)");
         }
+        return dm->scan_phase != SCAN_PHASE_IDLE;
+    }
+    
+    while ((dm->scan_phase == SCAN_PHASE_VERIFY || dm->scan_phase == SCAN_PHASE_BUILD) && max_entries > 0) {
+        DIR *dir = &dm->scan_dirs[dm->scan_depth - 1];
+        FRESULT res = f_readdir(dir, &fno);
         
-        if (fno.fname[0] == 0) {
-            printf("  Край на директорията (празно име) - прочетени %d елемента\n", items_in_dir);
-            break;
+        if (res != FR_OK || fno.fname[0] == 0) {
+            // Край на директорията - връщане към родителската
+            if (res != FR_OK) {
+                log_event(LOG_SCAN_READ_FAIL, res, dm->scan_depth);
+            }
+            f_closedir(dir);
+            dm->scan_depth--;
+            if (dm->scan_depth == 0) {
+                scan_walk_done(dm);
+            } else {
+                dm->scan_path[dm->scan_path_len[dm->scan_depth - 1]] = '\0';
+            }
+            continue;
         }
         
-        items_in_dir++;
+        max_entries--;
+        dm->scan_entries++;
         
-        // Конструиране на пълен път
-        if (strlen(path) == 0) {
-            snprintf(full_path, MAX_PATH_LEN, "%s", fno.fname);
-        } else {
-            snprintf(full_path, MAX_PATH_LEN, "%s/%s", path, fno.fname);
+        bool at_root = (dm->scan_depth == 1);
+        if (at_root && is_catalog_file_name(fno.fname)) {
+            continue;
+        }
+        if (!(fno.fattrib & AM_DIR) && is_sidecar_name(fno.fname)) {
+            continue;
         }
         
-        printf("  [%d] Елемент: '%s' (път: '%s', атрибути: 0x%02X, размер: %lu)\n", 
-               items_in_dir, fno.fname, full_path, fno.fattrib, (unsigned long)fno.fsize);
+        // Подписът покрива името, размера, датата, часа и атрибутите на всеки елемент
+        dm->scan_hash = catalog_hash(dm->scan_hash, fno.fname, strlen(fno.fname));
+        dm->scan_hash = catalog_hash(dm->scan_hash, &fno.fsize, sizeof(fno.fsize));
+        dm->scan_hash = catalog_hash(dm->scan_hash, &fno.fdate, sizeof(fno.fdate));
+        dm->scan_hash = catalog_hash(dm->scan_hash, &fno.ftime, sizeof(fno.ftime));
+        dm->scan_hash = catalog_hash(dm->scan_hash, &fno.fattrib, sizeof(fno.fattrib));
         
         // Пропускане на скрити файлове и системни файлове
         if (fno.fattrib & (AM_HID | AM_SYS | AM_VOL)) {
-            printf("    -> Пропуснат (скрит/системен/volume label)\n");
             continue;
         }
         
-        // Проверка дали е директория
-        if (fno.fattrib & AM_DIR) {
-            printf("    -> Директория, рекурсивно сканиране...\n");
-            // Рекурсивно сканиране на поддиректорията
-            scan_directory_recursive(dm, full_path, count);
+        // Пълен път на елемента
+        size_t len = dm->scan_path_len[dm->scan_depth - 1];
+        if (len + strlen(fno.fname) + 2 > MAX_PATH_LEN) {
+            continue;
+        }
+        if (len > 0) {
+            dm->scan_path[len] = '/';
+            strcpy(dm->scan_path + len + 1, fno.fname);
         } else {
-            printf("    -> Файл\n");
-            // Проверка за .dsk разширение
-            size_t len = strlen(fno.fname);
-            printf("    -> Дължина на името: %zu\n", len);
-            if (len >= 4) {
-                const char *ext = fno.fname + len - 4;
-                printf("    -> Разширение: '%s'\n", ext);
-                bool is_dsk = (ext[0] == '.' && 
-                              (ext[1] == 'd' || ext[1] == 'D') &&
-                              (ext[2] == 's' || ext[2] == 'S') &&
-                              (ext[3] == 'k' || ext[3] == 'K'));
-                
-                printf("    -> Е .dsk файл: %s\n", is_dsk ? "ДА" : "НЕ");
-                
-                if (is_dsk) {
-                    strncpy(dm->images[*count].filename, full_path, MAX_FILENAME_LEN - 1);
-                    dm->images[*count].filename[MAX_FILENAME_LEN - 1] = '\0';
-                    dm->images[*count].file_size = fno.fsize;
-                    dm->images[*count].format = DISK_FORMAT_AUTO;
-                    dm->images[*count].loaded = false;
-                    printf("    *** НАМЕРЕН .dsk ФАЙЛ: %s (размер: %lu байта) ***\n", 
-                           full_path, (unsigned long)fno.fsize);
-                    (*count)++;
-                    
-                    // CLI обработка след намиране на файл
-                    cli_process();
-                    
-                    // Проверка дали сме достигнали максимума
-                    if (*count >= MAX_DISK_IMAGES) {
-                        printf("  Достигнат е максималният брой дискови имиджи (%d), спиране на сканирането\n", MAX_DISK_IMAGES);
-                        break;
-                    }
-                }
-            } else {
-                printf("    -> Пропуснат (името е твърде кратко)\n");
-            }
+            strcpy(dm->scan_path, fno.fname);
         }
         
-        // CLI обработка след обработка на всеки елемент
-        cli_process();
+        if (fno.fattrib & AM_DIR) {
+            if (dm->scan_recursive && scan_push(dm)) {
+                continue;  // Следващата стъпка чете поддиректорията
+            }
+        } else if (dm->scan_phase == SCAN_PHASE_BUILD && disk_manager_is_image_name(fno.fname)) {
+            if (!catalog_add(dm, dm->scan_path, fno.fsize)) {
+                log_event(LOG_SCAN_FULL, dm->count, dm->scan_entries);
+                dm->scan_path[len] = '\0';
+                scan_walk_close(dm);
+                scan_walk_done(dm);
+                break;
+            }
+        }
+        dm->scan_path[len] = '\0';
     }
     
-    if (iteration_count >= max_iterations) {
-        printf("  ПРЕДУПРЕЖДЕНИЕ: Достигнат е максималният брой итерации (%d), спиране на сканирането\n", max_iterations);
+    return dm->scan_phase != SCAN_PHASE_IDLE;
+}
+
+// Прекъсване на сканирането (например при премахване на картата)
+// Недовършен каталог остава с празно заглавие и се изгражда наново следващия път.
+void disk_manager_scan_abort(disk_manager_t *dm) {
+    scan_walk_close(dm);
+    if (dm->scan_phase == SCAN_PHASE_SORT) {
+        catalog_sort_close();
     }
-    
-    f_closedir(&dir);
-    printf("<<< Завършено сканиране на директория '%s' (намерени %d .dsk файла общо)\n", 
-           path ? path : "(root)", *count);
+    if (dm->catalog_building) {
+        dm->catalog_building = false;
+        f_close(&dm->catalog_file);
+        f_close(&dm->index_file);
+        dm->count = 0;
+    }
+    dm->scan_phase = SCAN_PHASE_IDLE;
 }
 
-// Рекурсивно сканиране на всички поддиректории
-bool disk_manager_scan_recursive(disk_manager_t *dm, const char *path) {
-    uint8_t count = 0;
-    
-    printf("========================================\n");
-    printf("=== РЕКУРСИВНО СКАНИРАНЕ ЗА .DSK ФАЙЛОВЕ ===\n");
-    printf("Път: %s\n", path ? path : "(root)");
-    printf("========================================\n");
-    
-    // CLI обработка преди сканиране
-    extern void cli_process(void);
-    cli_process();
-    
-    scan_directory_recursive(dm, path ? path : "", &count);
-    
-    // CLI обработка след сканиране
-    cli_process();
-    
-    dm->count = count;
-    printf("========================================\n");
-    printf("=== РЕЗУЛТАТ: Намерени %d дискови имиджа (рекурсивно) ===\n", count);
-    printf("========================================\n");
+bool disk_manager_scan_busy(disk_manager_t *dm) {
+    return dm->scan_phase != SCAN_PHASE_IDLE;
+}
+
+// Принудително сканиране (каталогът се изтрива и създава наново във фонов режим)
+// Заредените имиджи остават отворени.
+bool disk_manager_rescan(disk_manager_t *dm, bool recursive) {
+    disk_manager_scan_abort(dm);
+    catalog_close(dm);
+    f_unlink(CATALOG_FILENAME);
+    f_unlink(CATALOG_INDEX_FILENAME);
+    f_unlink(CATALOG_TEMP_FILENAME);
     
-    // CLI обработка преди връщане
-    cli_process();
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        dm->current_index[i] = CATALOG_INDEX_NONE;
+    }
     
-    return count > 0;
+    return disk_manager_scan_begin(dm, recursive, true);
 }
 
 // Получаване на текущия път
@@ -539,57 +1182,142 @@ bool disk_manager_set_path(disk_manager_t *dm, const char *path) {
     return true;
 }
 
-// Списък на елементите в директория (файлове и поддиректории)
-bool disk_manager_list_directory(disk_manager_t *dm, const char *path, 
-                                  char items[][MAX_FILENAME_LEN], 
-                                  bool is_dir[], 
-                                  uint8_t *count, 
-                                  uint8_t max_items) {
-    FRESULT res;
-    DIR dir;
+// Видим ли е елементът при навигация
+static bool dir_entry_visible(const FILINFO *fno) {
+    return !(fno->fattrib & (AM_HID | AM_SYS | AM_VOL)) &&
+           ((fno->fattrib & AM_DIR) || !is_sidecar_name(fno->fname));
+}
+
+// Отваряне на директория за навигация
+// Елементите се преброяват веднъж; на всеки dir_stride елемента се запазва позицията
+// на DIR, така че всяка страница се чете с най-много dir_stride излишни f_readdir.
+bool disk_manager_open_directory(disk_manager_t *dm, const char *path) {
     FILINFO fno;
-    uint8_t item_count = 0;
+    uint16_t visible = 0;
     
-    // Добавяне на опция за връщане назад (ако не сме в корневата директория)
-    if (path != NULL && strlen(path) > 0) {
-        strncpy(items[item_count], "..", MAX_FILENAME_LEN - 1);
-        items[item_count][MAX_FILENAME_LEN - 1] = '\0';
-        is_dir[item_count] = true;
-        item_count++;
+    if (dm->dir_open) {
+        f_closedir(&dm->dir);
+        dm->dir_open = false;
     }
+    dm->dir_count = 0;
+    dm->dir_pos = 0;
+    dm->dir_page_start = 0;
+    dm->dir_page_count = 0;
+    dm->dir_bookmark_count = 0;
+    dm->dir_stride = CATALOG_PAGE_SIZE;
     
-    // Отваряне на директорията
-    res = f_opendir(&dir, path ? path : "");
-    if (res != FR_OK) {
-        *count = item_count;
-        return item_count > 0;  // Връщаме true ако имаме поне ".."
+    if (!disk_manager_set_path(dm, path)) {
+        return false;
     }
     
-    // Четене на всички елементи
-    while (item_count < max_items) {
-        res = f_readdir(&dir, &fno);
-        if (res != FR_OK || fno.fname[0] == 0) {
+    if (f_opendir(&dm->dir, dm->current_path) != FR_OK) {
+        // Връщането назад остава възможно
+        dm->dir_count = (dm->current_path[0] != '\0') ? 1 : 0;
+        return dm->dir_count > 0;
+    }
+    dm->dir_open = true;
+    
+    while (visible < CATALOG_MAX_IMAGES) {
+        DIR mark = dm->dir;
+        if (f_readdir(&dm->dir, &fno) != FR_OK || fno.fname[0] == 0) {
             break;
         }
-        
-        // Пропускане на скрити файлове и системни файлове
-        if (fno.fattrib & (AM_HID | AM_SYS | AM_VOL)) {
+        if (!dir_entry_visible(&fno)) {
             continue;
         }
         
-        // Проверка дали е директория
-        is_dir[item_count] = (fno.fattrib & AM_DIR) != 0;
-        
-        // Копиране на името
-        strncpy(items[item_count], fno.fname, MAX_FILENAME_LEN - 1);
-        items[item_count][MAX_FILENAME_LEN - 1] = '\0';
-        
-        item_count++;
+        if (visible % dm->dir_stride == 0) {
+            // Всички позиции са заети - запазва се всяка втора, стъпката се удвоява
+            if (dm->dir_bookmark_count == DIR_BOOKMARKS) {
+                for (uint8_t i = 0; i < DIR_BOOKMARKS / 2; i++) {
+                    dm->dir_bookmarks[i] = dm->dir_bookmarks[i * 2];
+                }
+                dm->dir_bookmark_count = DIR_BOOKMARKS / 2;
+                dm->dir_stride *= 2;
+            }
+            if (visible % dm->dir_stride == 0) {
+                dm->dir_bookmarks[dm->dir_bookmark_count++] = mark;
+            }
+        }
+        visible++;
     }
     
-    f_closedir(&dir);
-    *count = item_count;
-    
+    dm->dir_pos = visible;
+    dm->dir_count = visible + ((dm->current_path[0] != '\0') ? 1 : 0);
     return true;
 }
 
+uint16_t disk_manager_dir_count(disk_manager_t *dm) {
+    return dm->dir_count;
+}
+
+// Зареждане на страница от директорията, започваща от видимия елемент start
+static bool dir_load_page(disk_manager_t *dm, uint16_t start) {
+    FILINFO fno;
+    
+    dm->dir_page_start = start;
+    dm->dir_page_count = 0;
+    
+    if (!dm->dir_open) {
+        return false;
+    }
+    
+    // Връщане към най-близката запазена позиция, ако текущата е след start или далеч преди него
+    if (dm->dir_pos > start || start - dm->dir_pos >= dm->dir_stride) {
+        uint8_t mark = start / dm->dir_stride;
+        if (mark >= dm->dir_bookmark_count) {
+            return false;
+        }
+        dm->dir = dm->dir_bookmarks[mark];
+        dm->dir_pos = mark * dm->dir_stride;
+    }
+    
+    while (dm->dir_page_count < CATALOG_PAGE_SIZE) {
+        if (f_readdir(&dm->dir, &fno) != FR_OK || fno.fname[0] == 0) {
+            break;
+        }
+        if (!dir_entry_visible(&fno)) {
+            continue;
+        }
+        
+        if (dm->dir_pos >= start) {
+            dir_item_t *item = &dm->dir_page[dm->dir_page_count++];
+            strncpy(item->name, fno.fname, DIR_NAME_LEN - 1);
+            item->name[DIR_NAME_LEN - 1] = '\0';
+            item->is_dir = (fno.fattrib & AM_DIR) != 0;
+        }
+        dm->dir_pos++;
+    }
+    
+    return dm->dir_page_count > 0;
+}
+
+// Елемент от текущата директория; указателят е валиден до следващото извикване
+const dir_item_t* disk_manager_dir_item(disk_manager_t *dm, uint16_t index) {
+    static const dir_item_t parent_item = { "..", true };
+    
+    if (index >= dm->dir_count) {
+        return NULL;
+    }
+    
+    // Опция за връщане назад (ако не сме в корневата директория)
+    if (dm->current_path[0] != '\0') {
+        if (index == 0) {
+            return &parent_item;
+        }
+        index--;
+    }
+    
+    if (index < dm->dir_page_start || index >= dm->dir_page_start + dm->dir_page_count) {
+        // При превъртане нагоре страницата завършва на index, иначе започва от него
+        uint16_t start = index;
+        if (dm->dir_page_count > 0 && index < dm->dir_page_start) {
+            start = (index >= CATALOG_PAGE_SIZE - 1) ? index - (CATALOG_PAGE_SIZE - 1) : 0;
+        }
+        if (!dir_load_page(dm, start) || index >= dm->dir_page_start + dm->dir_page_count) {
+            dm->dir_page_count = 0;
+            return NULL;
+        }
+    }
+    return &dm->dir_page[index - dm->dir_page_start];
+}
@@ -9,43 +9,137 @@
 #include "config.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-#define MAX_DISK_IMAGES 50  // Поддръжка на до 50 дискови имиджи
 #define MAX_FILENAME_LEN 128  // Увеличено за поддръжка на пълни пътища
 #define MAX_PATH_LEN 256     // Максимална дължина на път
 
+// Каталог на дисковите имиджи, съхраняван в корена на SD картата
+#define CATALOG_FILENAME "DSKCAT.BIN"
+#define CATALOG_INDEX_FILENAME "DSKCAT.IDX"  // Сортиран индекс към записите в каталога
+#define CATALOG_TEMP_FILENAME "DSKCAT.TMP"   // Работен файл при сортиране на индекса
+#define CATALOG_MAGIC 0x54414344     // "DCAT"
+#define CATALOG_VERSION 3           // 3: включва и .po/.hdv томовете
+#define CATALOG_FLAG_RECURSIVE 0x0001  // Каталогът е от рекурсивно сканиране
+
+#define CATALOG_MAX_IMAGES 0xFFFE    // Горна граница на броя имиджи в каталога
+#define CATALOG_INDEX_NONE 0xFFFF    // Имиджът не е в каталога
+#define CATALOG_KEY_LEN 12           // Ключ за сортиране (име 8.3 без пътя)
+#define CATALOG_PAGE_SIZE 8          // Записи от каталога, държани в RAM
+
+#define LAST_IMAGE_FILENAME "DSKLAST.TXT"  // Пътища до последно заредените имиджи (по ред на устройство)
+
+#define SCAN_MAX_DEPTH 8             // Максимална дълбочина на поддиректориите при сканиране
+
+#define DIR_NAME_LEN 13              // Име 8.3 + '\0'
+#define DIR_BOOKMARKS 32             // Запазени позиции в директорията за бързо прелистване
+
+// Фаза на фоновото сканиране
+typedef enum {
+    SCAN_PHASE_IDLE = 0,   // Няма сканиране
+    SCAN_PHASE_VERIFY,     // Проверка на подписа на заредения каталог
+    SCAN_PHASE_BUILD,      // Изграждане на нов каталог
+    SCAN_PHASE_SORT        // Сортиране на индекса на новия каталог
+} scan_phase_t;
+
+// Зареден (отворен) дисков имидж
 typedef struct {
     char filename[MAX_FILENAME_LEN];
     disk_format_t format;
     bool loaded;
     FIL file_handle;
     uint32_t file_size;
+    uint32_t id;                      // Отпечатък на файла (път, размер, дата на промяна), никога 0
+    bool floppy;                      // Размер на 5.25" дискета - може да се чете като Disk II
+    bool block_order;                 // .po/.hdv - блоковете са в реда на ProDOS (SmartPort том)
 } disk_image_t;
 
+// Запис от каталога (без отворен файл)
 typedef struct {
-    disk_image_t images[MAX_DISK_IMAGES];
-    uint8_t count;
-    uint8_t current_index;
-    bool disk_loaded;
+    char filename[MAX_FILENAME_LEN];
+    disk_format_t format;
+    uint32_t file_size;
+} catalog_entry_t;
+
+// Елемент от текущата директория при навигация
+typedef struct {
+    char name[DIR_NAME_LEN];
+    bool is_dir;
+} dir_item_t;
+
+typedef struct {
+    // Заредените имиджи - по един на устройство
+    disk_image_t images[DRIVE_COUNT];
+    uint16_t current_index[DRIVE_COUNT];   // Позиция в каталога или CATALOG_INDEX_NONE
+    bool disk_loaded[DRIVE_COUNT];
+    uint8_t drive;                         // Устройство за load/unload/next/prev
+
+    // Каталог - на картата се пази целият, в RAM само една страница
+    uint16_t count;
+    FIL catalog_file;
+    FIL index_file;
+    bool catalog_open;
+    bool catalog_building;    // Каталогът се изгражда (файловете са отворени за запис)
+    catalog_entry_t page[CATALOG_PAGE_SIZE];
+    uint16_t page_start;
+    uint8_t page_count;
+
+    // Фоново сканиране - обхождане с явен стек вместо рекурсия
+    scan_phase_t scan_phase;
+    bool scan_recursive;
+    uint8_t scan_depth;
+    DIR scan_dirs[SCAN_MAX_DEPTH];
+    uint16_t scan_path_len[SCAN_MAX_DEPTH];
+    char scan_path[MAX_PATH_LEN];
+    uint32_t scan_hash;               // Подпис на обходеното досега
+    uint32_t scan_expected;           // Подпис от заглавието на заредения каталог
+    uint32_t scan_entries;            // Обработени елементи (за индикация)
+
+    // Навигация в директории - също на страници
     char current_path[MAX_PATH_LEN];  // Текущ път за навигация
+    DIR dir;
+    bool dir_open;
+    uint16_t dir_count;               // Брой елементи (включително "..")
+    uint16_t dir_pos;                 // Следващият елемент, който f_readdir ще върне
+    uint16_t dir_stride;              // Елементи между две запазени позиции
+    uint8_t dir_bookmark_count;
+    DIR dir_bookmarks[DIR_BOOKMARKS];
+    dir_item_t dir_page[CATALOG_PAGE_SIZE];
+    uint16_t dir_page_start;
+    uint8_t dir_page_count;
 } disk_manager_t;
 
 // Функции
 void disk_manager_init(disk_manager_t *dm);
-bool disk_manager_scan(disk_manager_t *dm);
-bool disk_manager_scan_recursive(disk_manager_t *dm, const char *path);
-bool disk_manager_load(disk_manager_t *dm, uint8_t index);
+bool disk_manager_is_image_name(const char *name);
+bool disk_manager_is_floppy_size(uint32_t file_size);
+bool disk_manager_select_drive(disk_manager_t *dm, uint8_t drive);
+uint8_t disk_manager_get_drive(disk_manager_t *dm);
+disk_image_t* disk_manager_get_image(disk_manager_t *dm, uint8_t drive);
+uint32_t disk_manager_image_key(const disk_image_t *image);
+bool disk_manager_sidecar_path(disk_manager_t *dm, uint8_t drive, const char *ext, char *path, size_t size);
+bool disk_manager_scan_begin(disk_manager_t *dm, bool recursive, bool force);
+bool disk_manager_scan_step(disk_manager_t *dm, uint16_t max_entries, bool idle);
+void disk_manager_scan_abort(disk_manager_t *dm);
+bool disk_manager_scan_busy(disk_manager_t *dm);
+bool disk_manager_rescan(disk_manager_t *dm, bool recursive);
+bool disk_manager_load(disk_manager_t *dm, uint16_t index);
+bool disk_manager_load_path(disk_manager_t *dm, const char *path);
+bool disk_manager_load_last(disk_manager_t *dm);
 bool disk_manager_unload(disk_manager_t *dm);
 bool disk_manager_next(disk_manager_t *dm);
 bool disk_manager_prev(disk_manager_t *dm);
 disk_image_t* disk_manager_get_current(disk_manager_t *dm);
 const char* disk_manager_get_current_name(disk_manager_t *dm);
-uint8_t disk_manager_get_count(disk_manager_t *dm);
-disk_image_t* disk_manager_get_disk(disk_manager_t *dm, uint8_t index);
-uint8_t disk_manager_get_current_index(disk_manager_t *dm);
+uint16_t disk_manager_get_count(disk_manager_t *dm);
+catalog_entry_t* disk_manager_get_disk(disk_manager_t *dm, uint16_t index);
+uint16_t disk_manager_get_current_index(disk_manager_t *dm);
+uint16_t disk_manager_find(disk_manager_t *dm, const char *path);
+uint16_t disk_manager_find_prefix(disk_manager_t *dm, const char *prefix);
 const char* disk_manager_get_current_path(disk_manager_t *dm);
 bool disk_manager_set_path(disk_manager_t *dm, const char *path);
-bool disk_manager_list_directory(disk_manager_t *dm, const char *path, char items[][MAX_FILENAME_LEN], bool is_dir[], uint8_t *count, uint8_t max_items);
+bool disk_manager_open_directory(disk_manager_t *dm, const char *path);
+uint16_t disk_manager_dir_count(disk_manager_t *dm);
+const dir_item_t* disk_manager_dir_item(disk_manager_t *dm, uint16_t index);
 
 #endif // DISK_MANAGER_H
-
@@ -21,22 +21,9 @@
 #include "diskio.h"
 #include "ff.h"
 #include "pico/stdlib.h"
-#include "hardware/spi.h"
+#include "sd_card.h"
 #include <stdio.h>
 
-// SD Card SPI pins (дефинирани в основния файл)
-extern spi_inst_t* SPI_PORT;
-extern uint PIN_MISO;
-extern uint PIN_CS;
-extern uint PIN_SCK;
-extern uint PIN_MOSI;
-
-// Функции за SD карта (дефинирани в основния файл)
-extern bool sd_init(void);
-extern bool sd_read_block(uint32_t block_addr, uint8_t *buffer);
-extern bool sd_write_block(uint32_t block_addr, const uint8_t *buffer);
-extern bool sd_check_ready(void);
-
 static bool sd_initialized = false;
 
 /*-----------------------------------------------------------------------*/
@@ -129,10 +116,12 @@ DRESULT disk_write (
 	if (pdrv != 0) return RES_PARERR;
 	if (!sd_initialized) return RES_NOTRDY;
 	
-	for (UINT i = 0; i < count; i++) {
-		if (!sd_write_block(sector + i, buff + (i * 512))) {
-			return RES_ERROR;
-		}
+	// Няколко сектора наведнъж (напр. цяла пътека) - ACMD23 + CMD25
+	if (count > 1) {
+		return sd_write_blocks(sector, buff, count) ? RES_OK : RES_ERROR;
+	}
+	if (!sd_write_block(sector, buff)) {
+		return RES_ERROR;
 	}
 	
 	return RES_OK;
@@ -152,7 +141,8 @@ DRESULT disk_ioctl (
 	
 	switch (cmd) {
 		case CTRL_SYNC:
-			return RES_OK;
+			// Записът завършва преди картата да е програмирала последния блок
+			return sd_card_sync() ? RES_OK : RES_ERROR;
 		
 		case GET_SECTOR_COUNT:
 			*(LBA_t*)buff = 0xFFFFFFFF;  // Неизвестен размер
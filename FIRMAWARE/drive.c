@@ -0,0 +1,817 @@
+/*
+ * Емулация на Disk II устройства
+ *
+ * Всяко устройство има собствена глава, буфер на пътеката, кодиран поток
+ * и състояние на записа. READ_DATA се подава от един DMA канал, който
+ * възпроизвежда потока на активното устройство в кръг (втори канал
+ * презарежда адреса в края на всяко минаване). Четенето и записът на
+ * пътеки в SD картата се изпълняват само от главния цикъл (drive_service_io).
+ */
+
+#include "drive.h"
+#include "disk_manager.h"
+#include "sector_detector.h"
+#include "track_cache.h"
+#include "profile.h"
+#include "journal.h"
+#include "log.h"
+#include "perf.h"
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include <stdio.h>
+#include <string.h>
+
+extern disk_manager_t disk_manager;
+
+static drive_t drives[DRIVE_COUNT];
+static uint8_t active_drive = 0;
+static uint8_t service_next = 0;      // Следващото устройство при обслужване по ред
+static uint32_t prefetch_loaded = 0;  // Пътеки, заредени предварително в кеша
+static uint32_t prefetch_cancelled = 0; // Отменени при обръщане на главата
+static uint32_t loads_skipped = 0;    // Зареждания, спестени от етикета на буфера
+static uint32_t spin_down_us = DRIVE_SPIN_DOWN_MS * 1000;
+static uint32_t spin_ups = 0;         // Пускания от спрян шпиндел
+static uint32_t spin_resumed = 0;     // ENABLE се върна, докато шпинделът спираше
+static uint32_t sectors_written = 0;  // Сектори, записани от Apple II в буфера
+static uint32_t sectors_elided = 0;   // От тях еднакви с буфера - без запис в картата
+
+// READ_DATA поток
+static PIO stream_pio;
+static uint stream_sm = 0;
+static int dma_channel_data = -1;     // Прехвърля потока към PIO TX FIFO
+static int dma_channel_ctrl = -1;     // Презарежда адреса на потока
+static const uint8_t *stream_read_addr = NULL;  // Чете се от контролния канал
+
+// GCR кодиране таблица (5-битови кодове за 4-битови данни)
+static const uint8_t gcr_encode_table[16] = {
+    0x0A, 0x0B, 0x12, 0x13,  // 0-3
+    0x0E, 0x0F, 0x16, 0x17,  // 4-7
+    0x09, 0x19, 0x1A, 0x1B,  // 8-11
+    0x0D, 0x1D, 0x1E, 0x15   // 12-15
+};
+
+// GCR декодиране таблица
+static const uint8_t gcr_decode_table[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF,  // 0x00-0x03 (невалидни)
+    0xFF, 0xFF, 0xFF, 0xFF,  // 0x04-0x07
+    0xFF, 0x08, 0x00, 0x01,  // 0x08-0x0B
+    0xFF, 0x0C, 0x04, 0x05,  // 0x0C-0x0F
+    0xFF, 0xFF, 0x02, 0x03,  // 0x10-0x13
+    0xFF, 0x0F, 0x06, 0x07,  // 0x14-0x17
+    0xFF, 0x09, 0x0A, 0x0B,  // 0x18-0x1B
+    0xFF, 0x0D, 0x0E, 0xFF   // 0x1C-0x1F
+};
+
+// ============================================================================
+// GCR кодиране/декодиране
+// ============================================================================
+
+// Кодиране на байт в GCR формат (2 байта = 10 бита)
+static void gcr_encode_byte(uint8_t data, uint8_t *gcr_out) {
+    uint8_t high_nibble = (data >> 4) & 0x0F;
+    uint8_t low_nibble = data & 0x0F;
+
+    gcr_out[0] = gcr_encode_table[high_nibble];
+    gcr_out[1] = gcr_encode_table[low_nibble];
+}
+
+// Декодиране на GCR байт (2 байта -> 1 байт)
+static bool gcr_decode_byte(uint8_t *gcr_in, uint8_t *data_out) {
+    uint8_t high = gcr_decode_table[gcr_in[0] & 0x1F];
+    uint8_t low = gcr_decode_table[gcr_in[1] & 0x1F];
+
+    if (high == 0xFF || low == 0xFF) {
+        return false;  // Невалиден GCR код
+    }
+
+    *data_out = (high << 4) | low;
+    return true;
+}
+
+// ============================================================================
+// Помощни функции
+// ============================================================================
+
+// Имиджът в устройството, ако може да се чете като Disk II
+// Томовете с друг размер (например 32 MB .hdv) са само за SmartPort - устройството е празно
+static disk_image_t* drive_image(drive_t *d) {
+    disk_image_t *image = disk_manager_get_image(&disk_manager, d->id);
+    return (image && image->loaded && image->floppy) ? image : NULL;
+}
+
+// Форматът на имиджа в устройството (всяко устройство може да е различен)
+static disk_config_t* drive_format(drive_t *d) {
+    disk_image_t *image = disk_manager_get_image(&disk_manager, d->id);
+    if (!image || !image->loaded) {
+        return get_current_disk_format();
+    }
+    return get_disk_config(image->format);
+}
+
+// Кодиране на един сектор от секторните данни в поток
+static void encode_sector(const disk_config_t *format, const uint8_t *track_data, uint8_t *stream, uint8_t sector) {
+    uint8_t *out = stream + (uint32_t)sector * DRIVE_STREAM_SECTOR_SIZE;
+    const uint8_t *data = track_data + (uint32_t)sector * format->bytes_per_sector;
+
+    memset(out, 0xFF, DRIVE_STREAM_SYNC_BYTES);
+    out += DRIVE_STREAM_SYNC_BYTES;
+    for (uint16_t i = 0; i < format->bytes_per_sector; i++) {
+        gcr_encode_byte(data[i], &out[i * 2]);
+    }
+}
+
+// Кодиране на цяла пътека - връща дължината на потока
+static uint16_t encode_track(const disk_config_t *format, const uint8_t *track_data, uint8_t *stream) {
+    for (uint8_t s = 0; s < format->sectors_per_track; s++) {
+        encode_sector(format, track_data, stream, s);
+    }
+    return format->sectors_per_track * DRIVE_STREAM_SECTOR_SIZE;
+}
+
+static void drive_encode_sector(drive_t *d, uint8_t sector) {
+    encode_sector(drive_format(d), d->track_buffer, d->stream, sector);
+}
+
+static void drive_encode_track(drive_t *d) {
+    d->stream_len = encode_track(drive_format(d), d->track_buffer, d->stream);
+}
+
+// Празна пътека (няма диск или пътеката още не е заредена) - само синхронизация
+static void drive_blank_stream(drive_t *d) {
+    memset(d->stream, 0xFF, DRIVE_STREAM_SECTOR_SIZE);
+    d->stream_len = DRIVE_STREAM_SECTOR_SIZE;
+}
+
+// Стартиране на потока на активното устройство
+static void drive_stream_start(void) {
+    if (dma_channel_data < 0) {
+        return;
+    }
+
+    drive_t *d = &drives[active_drive];
+
+    dma_channel_abort(dma_channel_data);
+    dma_channel_abort(dma_channel_ctrl);
+
+    stream_read_addr = d->stream;
+    dma_channel_set_trans_count(dma_channel_data, d->stream_len, false);
+    dma_channel_set_read_addr(dma_channel_data, d->stream, true);
+}
+
+// Обновяване на потока след промяна на буфера
+static void drive_stream_update(drive_t *d) {
+    if (d->id == active_drive) {
+        drive_stream_start();
+    }
+}
+
+// Буферът вече съвпада с имиджа (или промените са изоставени)
+static void drive_clear_dirty(drive_t *d) {
+    d->flush_pending = false;
+    d->dirty_sectors = 0;
+    d->dirty_image = 0;
+    d->dirty_track = DRIVE_TRACK_NONE;
+    d->flush_failures = 0;
+}
+
+// Неуспешен запис на пътеката: нов опит по-късно, след DRIVE_FLUSH_ATTEMPTS - отказ
+static void drive_flush_failed(drive_t *d) {
+    if (++d->flush_failures >= DRIVE_FLUSH_ATTEMPTS) {
+        log_event(LOG_TRACK_LOST, d->id + 1, d->dirty_track);
+        drive_clear_dirty(d);
+        return;
+    }
+    d->flush_retry_ms = to_ms_since_boot(get_absolute_time()) + DRIVE_FLUSH_RETRY_MS;
+}
+
+// Четене на секторните данни на пътека от имиджа в буфер
+static bool drive_read_image(drive_t *d, uint8_t track, uint8_t *buffer) {
+    disk_image_t *image = drive_image(d);
+    if (!image) {
+        return false;
+    }
+
+    disk_config_t *format = drive_format(d);
+    uint32_t track_size = (uint32_t)format->sectors_per_track * format->bytes_per_sector;
+    UINT bytes_read;
+
+    // Изчисляване на позицията в файла
+    FRESULT res = f_lseek(&image->file_handle, (FSIZE_t)track * track_size);
+    if (res != FR_OK) {
+        log_event(LOG_TRACK_SEEK_FAIL, d->id + 1, res);
+        return false;
+    }
+
+    res = f_read(&image->file_handle, buffer, track_size, &bytes_read);
+    if (res != FR_OK || bytes_read != track_size) {
+        log_event(LOG_TRACK_READ_FAIL, track, res);
+        return false;
+    }
+
+    // Секторите, които още са само в журнала
+    journal_overlay(d->id, track, buffer);
+    return true;
+}
+
+static uint32_t drive_image_id(drive_t *d) {
+    disk_image_t *image = disk_manager_get_image(&disk_manager, d->id);
+    return (image && image->loaded) ? image->id : 0;
+}
+
+// Буферът съвпада с пътеката от текущия имидж
+static void drive_mark_resident(drive_t *d, uint8_t track) {
+    d->resident.image = drive_image_id(d);
+    d->resident.generation = d->generation;
+    d->resident.track = track;
+}
+
+static bool drive_is_resident(drive_t *d, uint8_t track) {
+    return d->resident.image != 0 && d->resident.image == drive_image_id(d) &&
+           d->resident.generation == d->generation && d->resident.track == track;
+}
+
+// Четене на пътеката на главата от имиджа
+static bool drive_read_track(drive_t *d) {
+    uint32_t start = time_us_32();
+    if (!drive_image(d)) {
+        return false;
+    }
+
+    // Главата може да се премести, докато картата се чете
+    uint8_t track = d->track;
+
+    profile_note(d->id, track);
+
+    // Пътеката, на която главата е стояла, отива в кеша преди буферът да се презапише
+    track_cache_keep(d);
+
+    // Пътеката вече е кодирана в кеша - без четене от картата
+    if (track_cache_fetch(d, track)) {
+        d->buffer_track = track;
+        drive_mark_resident(d, track);
+        drive_stream_update(d);
+        perf_record(PERF_TRACK_LOAD, start);
+        return true;
+    }
+
+    d->resident.image = 0;
+    if (!drive_read_image(d, track, d->track_buffer)) {
+        return false;
+    }
+
+    d->buffer_track = track;
+    drive_mark_resident(d, track);
+    drive_encode_track(d);
+    drive_stream_update(d);
+    perf_record(PERF_TRACK_LOAD, start);
+    return true;
+}
+
+// ============================================================================
+// Публични функции
+// ============================================================================
+
+void drive_init(void) {
+    memset(drives, 0, sizeof(drives));
+
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        drives[i].id = i;
+        drives[i].buffer_track = DRIVE_TRACK_NONE;
+        drives[i].prefetch_track = DRIVE_TRACK_NONE;
+        drive_blank_stream(&drives[i]);
+    }
+
+    active_drive = 0;
+    service_next = 0;
+    track_cache_init();
+}
+
+// Инициализация на DMA за READ_DATA
+// Каналът за данни е верижно свързан с контролен канал, който записва
+// началото на потока обратно в него - потокът се върти без намеса на CPU
+void drive_stream_init(PIO pio, uint sm) {
+    stream_pio = pio;
+    stream_sm = sm;
+
+    dma_channel_data = dma_claim_unused_channel(true);
+    dma_channel_ctrl = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(dma_channel_data);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, pio_get_dreq(stream_pio, stream_sm, true));  // DREQ от PIO
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_chain_to(&c, dma_channel_ctrl);
+
+    dma_channel_configure(
+        dma_channel_data,
+        &c,
+        &stream_pio->txf[stream_sm],  // Destination: PIO TX FIFO
+        NULL,                         // Source (задава се от drive_stream_start)
+        0,
+        false
+    );
+
+    dma_channel_config cc = dma_channel_get_default_config(dma_channel_ctrl);
+    channel_config_set_transfer_data_size(&cc, DMA_SIZE_32);
+    channel_config_set_read_increment(&cc, false);
+    channel_config_set_write_increment(&cc, false);
+
+    dma_channel_configure(
+        dma_channel_ctrl,
+        &cc,
+        &dma_hw->ch[dma_channel_data].al3_read_addr_trig,  // Рестартира канала за данни
+        &stream_read_addr,
+        1,
+        false
+    );
+
+    printf("DMA READ_DATA канали инициализирани (данни %d, контрол %d)\n",
+           dma_channel_data, dma_channel_ctrl);
+
+    drive_stream_start();
+}
+
+drive_t* drive_get(uint8_t id) {
+    if (id >= DRIVE_COUNT) {
+        return NULL;
+    }
+    return &drives[id];
+}
+
+drive_t* drive_active(void) {
+    return &drives[active_drive];
+}
+
+uint8_t drive_active_id(void) {
+    return active_drive;
+}
+
+// Смяна на активното устройство (по сигналите ENABLE от контролера)
+void drive_select(uint8_t id) {
+    if (id >= DRIVE_COUNT || id == active_drive) {
+        return;
+    }
+
+    // Незавършен запис не може да продължи на другото устройство
+    drive_abort_write(&drives[active_drive]);
+
+    active_drive = id;
+    drive_stream_start();
+}
+
+// Шпиндел: ENABLE включва мотора веднага, а при изключване той спира след spin_down_us.
+// Докато спира, потокът, буферът и записът остават - бързото изключване и включване
+// на мотора от DOS не презарежда нищо. Отложеният запис на пътеката става при спиране.
+void drive_spindle_update(drive_t *d, bool enabled) {
+    if (!d) {
+        return;
+    }
+
+    if (enabled) {
+        if (d->spindle == DRIVE_SPINDLE_STOPPED) {
+            spin_ups++;
+            drive_request_load(d);
+        } else if (d->spindle == DRIVE_SPINDLE_SPINNING_DOWN) {
+            spin_resumed++;
+        }
+        d->spindle = DRIVE_SPINDLE_RUNNING;
+    } else if (d->spindle == DRIVE_SPINDLE_RUNNING) {
+        d->spindle = DRIVE_SPINDLE_SPINNING_DOWN;
+        d->spin_down_deadline = time_us_32() + spin_down_us;
+    } else if (d->spindle == DRIVE_SPINDLE_SPINNING_DOWN &&
+               (int32_t)(time_us_32() - d->spin_down_deadline) >= 0) {
+        d->spindle = DRIVE_SPINDLE_STOPPED;
+        drive_abort_write(d);
+    }
+}
+
+bool drive_spinning(const drive_t *d) {
+    return d && d->spindle != DRIVE_SPINDLE_STOPPED;
+}
+
+void drive_set_spin_down_ms(uint32_t ms) {
+    spin_down_us = ms * 1000;
+}
+
+uint32_t drive_get_spin_down_ms(void) {
+    return spin_down_us / 1000;
+}
+
+void drive_spindle_stats(uint32_t *ups, uint32_t *resumed) {
+    if (ups) *ups = spin_ups;
+    if (resumed) *resumed = spin_resumed;
+}
+
+// Следваща пътека за предварително зареждане според посоката и скоростта на главата
+static void drive_plan_prefetch(drive_t *d, uint8_t track) {
+    uint32_t now = time_us_32();
+    bool fast = (now - d->step_time) < DRIVE_FAST_STEP_US;
+    int8_t dir = (track > d->track) ? 1 : ((track < d->track) ? -1 : 0);
+    d->step_time = now;
+
+    if (dir == 0) {
+        return;
+    }
+    if (dir != d->step_dir) {
+        // Главата обърна посоката - заявеното зареждане вече е безполезно
+        if (d->prefetch_track != DRIVE_TRACK_NONE) {
+            prefetch_cancelled++;
+        }
+        d->prefetch_track = DRIVE_TRACK_NONE;
+        d->step_dir = dir;
+        return;
+    }
+
+    int16_t target = (int16_t)track + dir * (fast ? 2 : 1);
+    if (target < 0 || target >= get_tracks_per_disk()) {
+        d->prefetch_track = DRIVE_TRACK_NONE;
+    } else {
+        d->prefetch_track = (uint8_t)target;
+    }
+}
+
+// Зареждане на пътека в кеша, без да се пипа буферът на главата
+// (пътеката пред главата или следващата от профила на имиджа)
+bool drive_prefetch_track(drive_t *d, uint8_t track) {
+    // Записът се обработва в главния цикъл - не се забавя с четене
+    if (!d || d->write_in_progress || d->flush_pending) {
+        return false;
+    }
+    if (track == d->buffer_track || track_cache_contains(d->id, track)) {
+        return false;
+    }
+
+    uint32_t start = time_us_32();
+    track_cache_entry_t *entry = track_cache_claim_speculative(d->id, track);
+    if (!drive_read_image(d, track, entry->data)) {
+        return false;
+    }
+    entry->stream_len = encode_track(drive_format(d), entry->data, entry->stream);
+    track_cache_commit(entry);
+
+    prefetch_loaded++;
+    perf_record(PERF_TRACK_LOAD, start);
+    return true;
+}
+
+// Спекулативно зареждане на пътеката пред главата, докато текущата се възпроизвежда
+static bool drive_prefetch(drive_t *d) {
+    uint8_t track = d->prefetch_track;
+    if (track == DRIVE_TRACK_NONE || d->write_in_progress || d->flush_pending) {
+        return false;
+    }
+    d->prefetch_track = DRIVE_TRACK_NONE;
+    return drive_prefetch_track(d, track);
+}
+
+// Преместване на главата - пътеката се зарежда от главния цикъл
+void drive_set_track(drive_t *d, uint8_t track) {
+    if (!d) {
+        return;
+    }
+
+    track_cache_leave(d, time_us_32());
+    drive_plan_prefetch(d, track);
+    d->track = track;
+    if (d->buffer_track != track) {
+        drive_request_load(d);
+    }
+}
+
+void drive_request_load(drive_t *d) {
+    if (!d) {
+        return;
+    }
+
+    // Пътеката вече е в буфера (DOS включва и изключва мотора при всеки достъп;
+    // стъпка напред и обратно отменя и заявеното зареждане)
+    if (d->buffer_track == d->track) {
+        d->load_pending = false;
+        loads_skipped++;
+        return;
+    }
+
+    if (drive_image(d)) {
+        d->load_pending = true;
+    }
+}
+
+// Новият имидж е зареден - текущата пътека се чете наново
+void drive_reload(drive_t *d) {
+    if (!d) {
+        return;
+    }
+
+    // Незаписана пътека от същия имидж (картата е била извадена) се записва сега
+    bool keep_dirty = d->flush_pending &&
+                      d->dirty_image == disk_manager_image_key(disk_manager_get_image(&disk_manager, d->id));
+
+    d->buffer_track = DRIVE_TRACK_NONE;
+    d->buffer_dwelt = false;
+    if (!keep_dirty) {
+        drive_clear_dirty(d);
+    }
+    d->prefetch_track = DRIVE_TRACK_NONE;
+    track_cache_invalidate_drive(d->id);
+    journal_mount(d->id);
+    profile_mount(d->id);
+
+    if (keep_dirty) {
+        d->buffer_track = d->dirty_track;
+        d->flush_failures = 0;
+        d->flush_retry_ms = to_ms_since_boot(get_absolute_time());
+        drive_encode_track(d);
+        drive_stream_update(d);
+        drive_request_load(d);
+        log_event(LOG_TRACK_RESTORED, d->id + 1, d->dirty_track);
+        return;
+    }
+
+    // Същият непроменен имидж (напр. картата е извадена и поставена отново) -
+    // пътеката под главата е в буфера и само се кодира наново
+    if (drive_is_resident(d, d->track)) {
+        d->buffer_track = d->track;
+        drive_encode_track(d);
+        drive_stream_update(d);
+        loads_skipped++;
+        return;
+    }
+
+    drive_blank_stream(d);
+    drive_stream_update(d);
+    drive_request_load(d);
+}
+
+// Имиджът е променен без устройството (SmartPort блокове) - копието в буфера е остаряло
+void drive_image_changed(drive_t *d) {
+    if (d) {
+        d->generation++;
+    }
+}
+
+// Синхронно зареждане на пътеката на главата (CLI)
+bool drive_load_now(drive_t *d) {
+    if (!d) {
+        return false;
+    }
+
+    if (!drive_flush(d)) {
+        return false;
+    }
+    d->load_pending = false;
+    return drive_read_track(d);
+}
+
+// Запис на променената пътека в имиджа
+// flush_pending остава до успешен запис: при грешка се опитва наново след
+// DRIVE_FLUSH_RETRY_MS, а без карта - след поставянето ѝ (drive_reload)
+bool drive_flush(drive_t *d) {
+    if (!d || !d->flush_pending) {
+        return true;
+    }
+
+    uint32_t start = time_us_32();
+    disk_image_t *image = disk_manager_get_image(&disk_manager, d->id);
+    if (!image || !image->loaded || d->buffer_track == DRIVE_TRACK_NONE) {
+        // Няма карта/имидж - пътеката чака drive_reload, без да се опитва на всеки цикъл
+        d->flush_retry_ms = to_ms_since_boot(get_absolute_time()) + DRIVE_FLUSH_RETRY_MS;
+        return false;
+    }
+    if (d->write_protected) {
+        // Write protect е включен след записа - промените не отиват в имиджа
+        drive_clear_dirty(d);
+        return false;
+    }
+
+    disk_config_t *format = drive_format(d);
+
+    // Режим на журнал: само променените сектори, последователно в журнала до имиджа
+    if (journal_enabled() &&
+        journal_append(d->id, d->buffer_track, d->track_buffer, d->dirty_sectors, format->bytes_per_sector)) {
+        drive_clear_dirty(d);
+        track_cache_store(d);
+        drive_mark_resident(d, d->buffer_track);
+        perf_record(PERF_TRACK_SAVE, start);
+        log_event(LOG_TRACK_JOURNALED, d->id + 1, d->buffer_track);
+        return true;
+    }
+
+    // По-старите записи от журнала не трябва да покрият пътеката след записа ѝ на място
+    if (journal_pending(d->id) > 0 && !journal_fold(d->id)) {
+        drive_flush_failed(d);
+        return false;
+    }
+
+    uint32_t track_size = (uint32_t)format->sectors_per_track * format->bytes_per_sector;
+    UINT bytes_written;
+
+    FRESULT res = f_lseek(&image->file_handle, (FSIZE_t)d->buffer_track * track_size);
+    if (res != FR_OK) {
+        log_event(LOG_TRACK_SEEK_FAIL, d->id + 1, res);
+        drive_flush_failed(d);
+        return false;
+    }
+
+    res = f_write(&image->file_handle, d->track_buffer, track_size, &bytes_written);
+    if (res == FR_OK && bytes_written == track_size) {
+        res = f_sync(&image->file_handle);
+    }
+    if (res != FR_OK || bytes_written != track_size) {
+        log_event(LOG_TRACK_WRITE_FAIL, d->buffer_track, res);
+        drive_flush_failed(d);
+        return false;
+    }
+
+    // Кешът получава записаното съдържание, а буферът отново съвпада с имиджа
+    drive_clear_dirty(d);
+    track_cache_store(d);
+    drive_mark_resident(d, d->buffer_track);
+
+    perf_record(PERF_TRACK_SAVE, start);
+    log_event(LOG_TRACK_SAVED, d->id + 1, d->buffer_track);
+    return true;
+}
+
+// Изваждане на диска от устройството (преди смяна или при премахване на картата)
+void drive_eject(drive_t *d, bool flush) {
+    if (!d) {
+        return;
+    }
+
+    drive_abort_write(d);
+    if (flush) {
+        // Смяна на диска: пътека, която не може да се запише, се губи
+        if (!drive_flush(d) && d->flush_pending) {
+            log_event(LOG_TRACK_LOST, d->id + 1, d->dirty_track);
+        }
+        drive_clear_dirty(d);
+    }
+    // Без flush (картата е извадена) незаписаната пътека остава в буфера до drive_reload
+    journal_unmount(d->id, flush);
+
+    d->load_pending = false;
+    d->buffer_track = DRIVE_TRACK_NONE;
+    d->buffer_dwelt = false;
+    d->prefetch_track = DRIVE_TRACK_NONE;
+    track_cache_invalidate_drive(d->id);
+    profile_unmount(d->id);
+    drive_blank_stream(d);
+    drive_stream_update(d);
+}
+
+// Обслужване на чакащите операции с SD картата - по една на извикване
+// Активното устройство е с предимство, иначе устройствата се редуват
+bool drive_service_io(void) {
+    for (uint8_t i = 0; i <= DRIVE_COUNT; i++) {
+        drive_t *d = (i == 0) ? &drives[active_drive] : &drives[service_next];
+        if (i > 0) {
+            service_next = (service_next + 1) % DRIVE_COUNT;
+        }
+
+        // Промените се записват при спиране на шпиндела (всички сектори на пътеката
+        // наведнъж) или преди буферът да бъде презареден
+        if (d->flush_pending && !d->write_in_progress &&
+            (d->spindle == DRIVE_SPINDLE_STOPPED || d->load_pending) &&
+            (int32_t)(to_ms_since_boot(get_absolute_time()) - d->flush_retry_ms) >= 0) {
+            drive_flush(d);
+            return true;
+        }
+        // Буферът не се презарежда, докато промените в него не са записани
+        if (d->load_pending && !d->flush_pending) {
+            d->load_pending = false;
+            drive_read_track(d);
+            return true;
+        }
+    }
+
+    // Нищо спешно - пътеката пред главата на активното устройство
+    return drive_prefetch(&drives[active_drive]);
+}
+
+bool drive_io_pending(void) {
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        if (drives[i].load_pending || drives[i].flush_pending) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Обработка на байт от WRITE_DATA (GCR формат)
+void drive_process_write_byte(drive_t *d, uint8_t gcr_byte) {
+    if (!d) {
+        return;
+    }
+
+    disk_config_t *format = drive_format(d);
+    uint16_t bytes_per_sector = format->bytes_per_sector;
+
+    if (!d->write_in_progress) {
+        // Търсене на синхронизационни битове (0xFF)
+        if (gcr_byte == 0xFF) {
+            d->write_sync_count++;
+            if (d->write_sync_count > 3) {
+                // Започваме запис
+                d->write_in_progress = true;
+                d->write_bit_count = 0;
+                d->write_gcr_index = 0;
+                d->write_sync_count = 0;
+                memset(d->write_buffer, 0, bytes_per_sector);
+                log_event(LOG_WRITE_START, d->id + 1, d->track);
+            }
+        } else {
+            d->write_sync_count = 0;
+        }
+        return;
+    }
+
+    // Събиране на GCR байтове (2 байта = 1 данен байт)
+    d->write_gcr_buffer[d->write_gcr_index] = gcr_byte;
+    d->write_gcr_index++;
+
+    if (d->write_gcr_index < 2) {
+        return;
+    }
+
+    // Декодиране на GCR байт
+    uint8_t decoded_byte;
+    if (gcr_decode_byte(d->write_gcr_buffer, &decoded_byte)) {
+        uint32_t byte_index = d->write_bit_count / 10;  // 10 бита на байт (8 данни + 2 sync)
+        if (byte_index < bytes_per_sector) {
+            d->write_buffer[byte_index] = decoded_byte;
+        }
+    }
+    d->write_gcr_index = 0;
+    d->write_bit_count += 10;
+
+    // Проверка за край на сектора
+    if (d->write_bit_count < (uint32_t)bytes_per_sector * 10) {
+        return;
+    }
+
+    // Автоматично определяне на номера на сектора
+    sector_address_t sector_addr = detect_sector_from_data(d->write_buffer, bytes_per_sector, d->track);
+    if (sector_addr.valid) {
+        d->write_sector = sector_addr.sector;
+        log_event(LOG_WRITE_SECTOR, sector_addr.sector, sector_addr.track);
+    }
+
+    // Завършване на записа
+    d->write_in_progress = false;
+    log_event(LOG_WRITE_DONE, d->write_sector, d->write_bit_count);
+
+    // Секторът се записва в буфера, само ако той е на пътеката на главата
+    if (d->write_sector >= format->sectors_per_track || d->buffer_track != d->track) {
+        return;
+    }
+
+    // DOS често записва наново непроменени сектори (VTOC, каталог) - те не стигат до картата
+    uint8_t *sector = d->track_buffer + (uint32_t)d->write_sector * bytes_per_sector;
+    sectors_written++;
+    if (memcmp(sector, d->write_buffer, bytes_per_sector) == 0) {
+        sectors_elided++;
+        return;
+    }
+
+    memcpy(sector, d->write_buffer, bytes_per_sector);
+    drive_encode_sector(d, d->write_sector);
+    track_cache_invalidate(d->id, d->buffer_track);
+    d->resident.image = 0;
+    d->dirty_sectors |= 1u << d->write_sector;
+
+    // Записът в картата се прави от главния цикъл
+    if (!d->write_protected) {
+        if (!d->flush_pending) {
+            d->flush_failures = 0;
+            d->flush_retry_ms = to_ms_since_boot(get_absolute_time());
+        }
+        d->flush_pending = true;
+        d->dirty_image = disk_manager_image_key(disk_manager_get_image(&disk_manager, d->id));
+        d->dirty_track = d->buffer_track;
+    }
+}
+
+void drive_abort_write(drive_t *d) {
+    if (!d) {
+        return;
+    }
+
+    d->write_in_progress = false;
+    d->write_sync_count = 0;
+    d->write_gcr_index = 0;
+}
+
+void drive_write_stats(uint32_t *written, uint32_t *elided) {
+    if (written) *written = sectors_written;
+    if (elided) *elided = sectors_elided;
+}
+
+uint32_t drive_loads_skipped(void) {
+    return loads_skipped;
+}
+
+void drive_prefetch_stats(uint32_t *loaded, uint32_t *cancelled) {
+    if (loaded) *loaded = prefetch_loaded;
+    if (cancelled) *cancelled = prefetch_cancelled;
+}
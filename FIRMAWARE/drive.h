@@ -0,0 +1,112 @@
+/*
+ * Емулация на Disk II устройства (до DRIVE_COUNT механизма на един контролер)
+ */
+
+#ifndef DRIVE_H
+#define DRIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/pio.h"
+#include "config.h"
+
+#define DRIVE_MAX_SECTORS 16
+#define DRIVE_SECTOR_SIZE 256
+#define DRIVE_TRACK_BUFFER_SIZE (DRIVE_MAX_SECTORS * DRIVE_SECTOR_SIZE)
+#define DRIVE_TRACK_NONE 0xFF        // Няма заредена пътека
+#define DRIVE_FAST_STEP_US 8000      // Стъпки по-близо от това са бързо позициониране (предварително +-2 пътеки)
+#define DRIVE_SPIN_DOWN_MS 1000      // Шпинделът се върти още толкова след като ENABLE падне
+#define DRIVE_FLUSH_RETRY_MS 500     // Пауза след неуспешен запис на пътека
+#define DRIVE_FLUSH_ATTEMPTS 5       // След толкова неуспешни записа пътеката се изоставя
+
+// Шпиндел на устройството - DOS изключва и включва мотора при всеки достъп
+typedef enum {
+    DRIVE_SPINDLE_STOPPED = 0,
+    DRIVE_SPINDLE_RUNNING,           // ENABLE е активен
+    DRIVE_SPINDLE_SPINNING_DOWN      // ENABLE падна, потокът, буферът и записът се пазят
+} drive_spindle_t;
+
+// Поток към READ_DATA: синхронизация + GCR кодирани данни за всеки сектор
+#define DRIVE_STREAM_SYNC_BYTES 5
+#define DRIVE_STREAM_SECTOR_SIZE (DRIVE_STREAM_SYNC_BYTES + DRIVE_SECTOR_SIZE * 2)
+#define DRIVE_STREAM_SIZE (DRIVE_MAX_SECTORS * DRIVE_STREAM_SECTOR_SIZE)
+
+// Етикет на съдържанието на track_buffer: пътека от конкретен имидж
+typedef struct {
+    uint32_t image;                   // disk_image_t.id или 0 (буферът се различава от имиджа)
+    uint32_t generation;              // drive_t.generation при зареждането
+    uint8_t track;
+} drive_resident_t;
+
+typedef struct {
+    uint8_t id;                       // 0 = устройство 1, 1 = устройство 2
+    bool write_protected;
+
+    // Глава
+    uint8_t track;                    // Позиция на главата
+    uint8_t last_phase_state;         // Последно състояние на фазите за това устройство
+    int8_t step_dir;                  // Посока на последната стъпка (+1 навътре, -1 навън)
+    uint32_t step_time;               // time_us_32() на последната стъпка
+    uint8_t prefetch_track;           // Пътека за предварително зареждане в кеша или DRIVE_TRACK_NONE
+
+    // Мотор
+    drive_spindle_t spindle;
+    uint32_t spin_down_deadline;      // time_us_32() на спирането при DRIVE_SPINDLE_SPINNING_DOWN
+
+    // Буфер на пътеката (секторни данни от имиджа)
+    uint8_t track_buffer[DRIVE_TRACK_BUFFER_SIZE];
+    uint8_t buffer_track;             // Пътеката в буфера или DRIVE_TRACK_NONE
+    bool buffer_dwelt;                // Главата е стояла на пътеката в буфера (влиза в кеша при напускане)
+    bool load_pending;                // Чака зареждане от SD картата
+    bool flush_pending;               // Буферът е променен и чака запис
+    uint32_t dirty_sectors;           // Маска на променените сектори (за журнала)
+    uint32_t dirty_image;             // disk_manager_image_key на имиджа на незаписаната пътека
+    uint8_t dirty_track;              // Незаписаната пътека (пази се и след изваждане на картата)
+    uint8_t flush_failures;
+    uint32_t flush_retry_ms;          // Следващ опит след неуспешен запис
+    drive_resident_t resident;        // Кое копие е в буфера (пази се и при изваждане)
+    uint32_t generation;              // Сменя се, когато имиджът е променен извън устройството
+
+    // Кодирана пътека, която READ_DATA DMA възпроизвежда в кръг
+    uint8_t stream[DRIVE_STREAM_SIZE];
+    uint16_t stream_len;
+
+    // Състояние на записа
+    uint8_t write_buffer[DRIVE_SECTOR_SIZE];
+    bool write_in_progress;
+    uint8_t write_sector;
+    uint32_t write_bit_count;
+    uint8_t write_gcr_buffer[2];
+    uint8_t write_gcr_index;
+    uint32_t write_sync_count;
+} drive_t;
+
+// Функции
+void drive_init(void);
+void drive_stream_init(PIO pio, uint sm);
+drive_t* drive_get(uint8_t id);
+drive_t* drive_active(void);
+uint8_t drive_active_id(void);
+void drive_select(uint8_t id);
+void drive_spindle_update(drive_t *d, bool enabled);
+bool drive_spinning(const drive_t *d);
+void drive_set_spin_down_ms(uint32_t ms);
+uint32_t drive_get_spin_down_ms(void);
+void drive_spindle_stats(uint32_t *spin_ups, uint32_t *resumed);
+void drive_set_track(drive_t *d, uint8_t track);
+void drive_request_load(drive_t *d);
+void drive_reload(drive_t *d);
+bool drive_load_now(drive_t *d);
+bool drive_flush(drive_t *d);
+void drive_eject(drive_t *d, bool flush);
+bool drive_service_io(void);
+bool drive_io_pending(void);
+void drive_process_write_byte(drive_t *d, uint8_t gcr_byte);
+void drive_abort_write(drive_t *d);
+bool drive_prefetch_track(drive_t *d, uint8_t track);
+void drive_image_changed(drive_t *d);
+uint32_t drive_loads_skipped(void);
+void drive_write_stats(uint32_t *written, uint32_t *elided);
+void drive_prefetch_stats(uint32_t *loaded, uint32_t *cancelled);
+
+#endif // DRIVE_H
@@ -1,9 +1,16 @@
 /*
  * Rotary Encoder Driver Implementation
+ *
+ * Квадратурният сигнал се следи от PIO машина, а посоката се декодира в
+ * прекъсване - позицията е абсолютна и не зависи от главния цикъл.
+ * Бутонът се филтрира от отскок от втора PIO машина.
  */
 
+#include <stdio.h>
 #include "encoder.h"
 #include "pico/time.h"
+#include "hardware/irq.h"
+#include "encoder.pio.h"
 
 // Таблица за декодиране на енкодер (Gray code)
 static const int8_t encoder_table[] = {
@@ -13,16 +20,117 @@ static const int8_t encoder_table[] = {
     0, -1, 1, 0
 };
 
-void encoder_init(encoder_t *enc, uint8_t pin_a, uint8_t pin_b, uint8_t pin_button) {
+// Енкодерът, обслужван от прекъсването (има само един)
+static encoder_t *irq_encoder = NULL;
+
+// Нова стъпка (един преход на квадратурата; между две фиксирани позиции са няколко)
+// Скоростта се мери между фиксираните позиции - преходите в едно щракване
+// идват на няколко ms един от друг и не са бързо въртене.
+// Смяната на посоката (отскок на контактите) винаги е единична стъпка
+static void encoder_step(encoder_t *enc, int8_t delta, bool detent) {
+    uint32_t now = time_us_32();
+    
+    if (delta != enc->last_dir) {
+        enc->step = 1;
+        enc->last_detent_time = now - ENCODER_MEDIUM_US;
+    } else if (detent) {
+        uint32_t interval = now - enc->last_detent_time;
+        if (interval < ENCODER_FAST_US) {
+            enc->step = ENCODER_FAST_STEP;
+        } else if (interval < ENCODER_MEDIUM_US) {
+            enc->step = ENCODER_MEDIUM_STEP;
+        } else {
+            enc->step = 1;
+        }
+    }
+    if (detent) {
+        enc->last_detent_time = now;
+    } else if (now - enc->last_detent_time >= ENCODER_MEDIUM_US) {
+        // Първото щракване след пауза
+        enc->step = 1;
+    }
+    
+    enc->position += delta;
+    enc->accel_position += delta * enc->step;
+    enc->last_dir = delta;
+}
+
+static void encoder_decode(encoder_t *enc, uint8_t state) {
+    int8_t delta = encoder_table[(enc->last_state << 2) | state];
+    
+    enc->state = state;
+    enc->last_state = state;
+    if (delta != 0) {
+        encoder_step(enc, delta, state == enc->rest_state);
+    }
+}
+
+// RX FIFO на квадратурната машина не е празен
+static void encoder_irq_handler(void) {
+    encoder_t *enc = irq_encoder;
+    
+    while (!pio_sm_is_rx_fifo_empty(enc->pio, enc->sm_quadrature)) {
+        // PIO подава бит 0 = A, бит 1 = B; таблицата очаква (A << 1) | B
+        uint32_t s = pio_sm_get(enc->pio, enc->sm_quadrature);
+        encoder_decode(enc, ((s & 1) << 1) | ((s >> 1) & 1));
+    }
+}
+
+// Пускане на PIO машините (A и B трябва да са съседни пинове)
+static bool encoder_init_pio(encoder_t *enc, PIO pio) {
+    if (enc->pin_b != enc->pin_a + 1 || !pio_can_add_program(pio, &encoder_quadrature_program)) {
+        return false;
+    }
+    
+    int sm_quadrature = pio_claim_unused_sm(pio, false);
+    int sm_button = pio_claim_unused_sm(pio, false);
+    if (sm_quadrature < 0 || sm_button < 0) {
+        if (sm_quadrature >= 0) {
+            pio_sm_unclaim(pio, sm_quadrature);
+        }
+        return false;
+    }
+    
+    uint offset_quadrature = pio_add_program(pio, &encoder_quadrature_program);
+    if (!pio_can_add_program(pio, &encoder_button_program)) {
+        pio_remove_program(pio, &encoder_quadrature_program, offset_quadrature);
+        pio_sm_unclaim(pio, sm_quadrature);
+        pio_sm_unclaim(pio, sm_button);
+        return false;
+    }
+    uint offset_button = pio_add_program(pio, &encoder_button_program);
+    
+    enc->pio = pio;
+    enc->sm_quadrature = sm_quadrature;
+    enc->sm_button = sm_button;
+    
+    // Прекъсване при всяка промяна на A/B
+    irq_encoder = enc;
+    uint irq = pio_get_index(pio) ? PIO1_IRQ_0 : PIO0_IRQ_0;
+    pio_set_irq0_source_enabled(pio, pis_sm0_rx_fifo_not_empty + sm_quadrature, true);
+    irq_set_exclusive_handler(irq, encoder_irq_handler);
+    irq_set_enabled(irq, true);
+    
+    encoder_quadrature_program_init(pio, sm_quadrature, offset_quadrature, enc->pin_a);
+    encoder_button_program_init(pio, sm_button, offset_button, enc->pin_button);
+    return true;
+}
+
+void encoder_init(encoder_t *enc, PIO pio, uint8_t pin_a, uint8_t pin_b, uint8_t pin_button) {
     enc->pin_a = pin_a;
     enc->pin_b = pin_b;
     enc->pin_button = pin_button;
     enc->position = 0;
+    enc->accel_position = 0;
     enc->last_position = 0;
     enc->button_pressed = false;
     enc->button_last_state = false;
     enc->state = 0;
     enc->last_state = 0;
+    enc->last_dir = 0;
+    enc->step = 1;
+    enc->last_detent_time = 0;
+    enc->pio = NULL;
     
     gpio_init(pin_a);
     gpio_init(pin_b);
@@ -35,27 +143,47 @@ void encoder_init(encoder_t *enc, uint8_t pin_a, uint8_t pin_b, uint8_t pin_butt
     gpio_pull_up(pin_button);
     
     // Четене на начално състояние
+    // Енкодерът е във фиксирана позиция - това състояние отбелязва всяко щракване
     enc->state = (gpio_get(pin_a) << 1) | gpio_get(pin_b);
     enc->last_state = enc->state;
+    enc->rest_state = enc->state;
+    
+    if (pio == NULL || !encoder_init_pio(enc, pio)) {
+        printf("Енкодер: няма PIO машина или A/B не са съседни - четене от главния цикъл\n");
+    }
 }
 
-int8_t encoder_read(encoder_t *enc) {
-    uint8_t a = gpio_get(enc->pin_a);
-    uint8_t b = gpio_get(enc->pin_b);
-    enc->state = (a << 1) | b;
-    
-    int8_t delta = encoder_table[(enc->last_state << 2) | enc->state];
-    
-    if (delta != 0) {
-        enc->position += delta;
-        enc->last_state = enc->state;
-        return delta;
+// Стъпки (с ускорение) от последното четене
+int32_t encoder_read(encoder_t *enc) {
+    if (enc->pio == NULL) {
+        uint8_t state = (gpio_get(enc->pin_a) << 1) | gpio_get(enc->pin_b);
+        if (state != enc->last_state) {
+            encoder_decode(enc, state);
+        }
     }
     
-    return 0;
+    int32_t position = enc->accel_position;
+    int32_t delta = position - enc->last_position;
+    enc->last_position = position;
+    return delta;
+}
+
+// Абсолютна позиция (без ускорение)
+int32_t encoder_get_position(encoder_t *enc) {
+    return enc->position;
 }
 
 bool encoder_button_pressed(encoder_t *enc) {
+    if (enc->pio != NULL) {
+        // Всяко стабилно натискане е едно събитие в FIFO
+        if (pio_sm_is_rx_fifo_empty(enc->pio, enc->sm_button)) {
+            return false;
+        }
+        pio_sm_get(enc->pio, enc->sm_button);
+        enc->button_pressed = true;
+        return true;
+    }
+    
     bool current_state = !gpio_get(enc->pin_button);  // Active low
     bool pressed = current_state && !enc->button_last_state;
     enc->button_last_state = current_state;
@@ -67,4 +195,3 @@ bool encoder_button_pressed(encoder_t *enc) {
     
     return false;
 }
-
@@ -6,22 +6,37 @@
 #define ENCODER_H
 
 #include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+// Ускорение при бързо въртене (интервал между щракванията в една посока)
+#define ENCODER_FAST_US 15000        // По-бързо - x ENCODER_FAST_STEP (над ~65 щраквания/s)
+#define ENCODER_MEDIUM_US 40000      // По-бързо - x ENCODER_MEDIUM_STEP (над 25 щраквания/s)
+#define ENCODER_FAST_STEP 16
+#define ENCODER_MEDIUM_STEP 4
 
 typedef struct {
     uint8_t pin_a;
     uint8_t pin_b;
     uint8_t pin_button;
-    int32_t position;
-    int32_t last_position;
+    volatile int32_t position;       // Абсолютна позиция (стъпки без ускорение)
+    volatile int32_t accel_position; // Позиция с ускорение
+    int32_t last_position;           // accel_position при последното четене
     bool button_pressed;
     bool button_last_state;
     uint8_t state;
     uint8_t last_state;
+    uint8_t rest_state;              // Състояние във фиксирана позиция (при включване)
+    int8_t last_dir;                 // Посока на последната стъпка
+    int8_t step;                     // Множител от скоростта на последното щракване
+    uint32_t last_detent_time;       // Време на последното щракване (µs)
+    PIO pio;                         // NULL - четене на пиновете от главния цикъл
+    uint sm_quadrature;
+    uint sm_button;
 } encoder_t;
 
-void encoder_init(encoder_t *enc, uint8_t pin_a, uint8_t pin_b, uint8_t pin_button);
-int8_t encoder_read(encoder_t *enc);
+void encoder_init(encoder_t *enc, PIO pio, uint8_t pin_a, uint8_t pin_b, uint8_t pin_button);
+int32_t encoder_read(encoder_t *enc);
+int32_t encoder_get_position(encoder_t *enc);
 bool encoder_button_pressed(encoder_t *enc);
 
 #endif // ENCODER_H
-
@@ -41,6 +41,13 @@
 //   - Сигнал за включване/изключване на мотора
 //   - Насочване: INPUT
 //   - Логика: HIGH = мотор включен, LOW = мотор изключен
+//   - Действа и като ENABLE на устройство 1
+//
+// DRIVE2_ENABLE - GPIO 22 (по подразбиране)
+//   - ENABLE на устройство 2 (втори Disk II механизъм)
+//   - Насочване: INPUT
+//   - Логика: HIGH = устройство 2 избрано и моторът му включен
+//   - READ_DATA, TRACK0 и WRITE_PROTECT следват избраното устройство
 //
 // WRITE_ENABLE - GPIO 6 (по подразбиране)
 //   - Сигнал за разрешаване на запис
@@ -101,6 +108,12 @@
 //   - Данни от Pico към SD картата
 //   - Насочване: OUTPUT
 //   - SPI функция: MOSI
+//
+// SD_DETECT (Card Detect) - не е свързан (по подразбиране, GPIO_NONE)
+//   - Ключ в гнездото на картата
+//   - Насочване: INPUT с pull-up
+//   - Логика: LOW = картата е поставена, HIGH = гнездото е празно
+//   - Без него наличността се проверява с SD команди, само когато моторът е изключен
 
 // ============================================================================
 // I2C интерфейс за OLED дисплей
@@ -131,11 +144,14 @@
 //   - Канал B на ротационния енкодер
 //   - Насочване: INPUT
 //   - Използва се за определяне на посоката на въртене
+//   - Трябва да е ENCODER_A + 1 - двата канала се четат от PIO машина;
+//     иначе енкодерът се чете от главния цикъл
 //
 // ENCODER_BUTTON - GPIO 13 (по подразбиране)
 //   - Бутон на ротационния енкодер
 //   - Насочване: INPUT
 //   - Логика: LOW = натиснат, HIGH = не натиснат
+//   - Отскокът се потиска от PIO машина (5 ms)
 //   - Използва се за избор на меню опции
 
 // ============================================================================
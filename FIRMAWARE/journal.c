@@ -0,0 +1,409 @@
+/*
+ * Журнал на записаните сектори
+ */
+
+#include "journal.h"
+#include "config.h"
+#include "disk_manager.h"
+#include "drive.h"
+#include "log.h"
+#include "ff.h"
+#include "pico/stdlib.h"
+#include <stddef.h>
+#include <string.h>
+
+// FatFS file access mode definitions (ако не са дефинирани в ff.h)
+#ifndef FA_READ
+#define FA_READ         0x01
+#define FA_WRITE        0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW   0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS  0x10
+#define FA_OPEN_APPEND  0x30
+#endif
+
+#define JOURNAL_FILE_SIZE ((FSIZE_t)(JOURNAL_RECORDS + 1) * JOURNAL_BLOCK_SIZE)
+
+extern disk_manager_t disk_manager;
+
+// Един SD блок: сектор с пътека, номер и контролна сума
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;                  // Епохата на журнала при записа
+    uint16_t slot;                   // Позиция в журнала (стар запис на друго място е невалиден)
+    uint8_t track;
+    uint8_t sector;
+    uint16_t size;                   // Байтове в сектора
+    uint16_t reserved;
+    uint32_t image;                  // Ключ на имиджа, за който е журналът
+    uint32_t check;                  // FNV-1a на полетата преди check и на данните
+    uint8_t data[DRIVE_SECTOR_SIZE];
+    uint8_t pad[JOURNAL_BLOCK_SIZE - 24 - DRIVE_SECTOR_SIZE];
+} journal_record_t;
+
+typedef struct {
+    bool open;
+    bool foreign;                    // Журналът със същото име е на друг имидж - запис на място
+    FIL file;
+    uint32_t epoch;
+    uint32_t image;                  // Ключ на имиджа от заглавието
+    uint16_t count;                  // Записи след последното сгъване
+    uint16_t folded;                 // От тях вече прехвърлени в имиджа
+    uint32_t last_append_ms;
+    uint8_t track[JOURNAL_RECORDS];  // Индекс на записите (за четене на пътеки)
+    uint8_t sector[JOURNAL_RECORDS];
+} journal_t;
+
+static journal_t journals[DRIVE_COUNT];
+static journal_record_t record;      // Общ буфер за блок от журнала
+static bool journal_on = false;
+
+static uint32_t journal_check(const journal_record_t *rec) {
+    const uint8_t *p = (const uint8_t *)rec;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(journal_record_t, check); i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    for (uint16_t i = 0; i < rec->size; i++) {
+        hash ^= rec->data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool journal_record_valid(const journal_t *j, uint16_t slot) {
+    return record.magic == JOURNAL_RECORD_MAGIC && record.epoch == j->epoch && record.slot == slot &&
+           record.image == j->image &&
+           record.sector < DRIVE_MAX_SECTORS && record.size <= DRIVE_SECTOR_SIZE &&
+           record.check == journal_check(&record);
+}
+
+static bool journal_block_io(journal_t *j, uint16_t block, bool write, void *data) {
+    UINT n;
+    if (f_lseek(&j->file, (FSIZE_t)block * JOURNAL_BLOCK_SIZE) != FR_OK) {
+        return false;
+    }
+    if (write) {
+        return f_write(&j->file, data, JOURNAL_BLOCK_SIZE, &n) == FR_OK && n == JOURNAL_BLOCK_SIZE;
+    }
+    return f_read(&j->file, data, JOURNAL_BLOCK_SIZE, &n) == FR_OK && n == JOURNAL_BLOCK_SIZE;
+}
+
+// Заглавие с епохата - след f_sync новата епоха е окончателна
+static bool journal_write_header(journal_t *j) {
+    memset(&record, 0, sizeof(record));
+    record.magic = JOURNAL_MAGIC;
+    record.epoch = j->epoch;
+    record.image = j->image;
+    return journal_block_io(j, 0, true, &record) && f_sync(&j->file) == FR_OK;
+}
+
+// Журналът в j->file (заглавието му е в record) има непрехвърлени записи
+static bool journal_has_records(journal_t *j) {
+    j->epoch = record.epoch;
+    j->image = record.image;
+    bool pending = journal_block_io(j, 1, false, &record) && journal_record_valid(j, 0);
+    j->epoch = 0;
+    j->image = 0;
+    return pending;
+}
+
+// Журналът на друг имидж със същото име (GAME.DSK и GAME.PO -> GAME.JNL) не се
+// презаписва: този имидж пише на място, докато дискът не бъде сменен
+static bool journal_foreign(uint8_t drive, uint32_t other) {
+    journal_t *j = &journals[drive];
+    j->foreign = true;
+    log_event(LOG_JOURNAL_FOREIGN, drive + 1, other);
+    return false;
+}
+
+// Отваряне на журнала на имиджа; create - създаване и заделяне на място, ако го няма
+static bool journal_open(uint8_t drive, bool create) {
+    journal_t *j = &journals[drive];
+    disk_image_t *image = disk_manager_get_image(&disk_manager, drive);
+    char path[MAX_FILENAME_LEN];
+    char other[MAX_FILENAME_LEN];
+
+    if (j->open) {
+        return true;
+    }
+    if (j->foreign || !image ||
+        !disk_manager_sidecar_path(&disk_manager, drive, JOURNAL_EXT, path, sizeof(path))) {
+        return false;
+    }
+
+    // Същият журнал е отворен от другото устройство
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        if (i != drive && journals[i].open &&
+            disk_manager_sidecar_path(&disk_manager, i, JOURNAL_EXT, other, sizeof(other)) &&
+            strcmp(path, other) == 0) {
+            return journal_foreign(drive, i + 1);
+        }
+    }
+
+    // Съществуващ журнал: валидно заглавие за този имидж и цялото заделено място
+    // (празен журнал на друг имидж или на предишно копие на файла се създава наново)
+    if (f_open(&j->file, path, FA_READ | FA_WRITE) == FR_OK) {
+        uint32_t key = disk_manager_image_key(image);
+        if (journal_block_io(j, 0, false, &record) && record.magic == JOURNAL_MAGIC) {
+            if (record.image == key &&
+                f_lseek(&j->file, JOURNAL_FILE_SIZE) == FR_OK && f_tell(&j->file) == JOURNAL_FILE_SIZE) {
+                j->epoch = record.epoch;
+                j->image = record.image;
+                j->open = true;
+                return true;
+            }
+            if (record.image != key && journal_has_records(j)) {
+                f_close(&j->file);
+                return journal_foreign(drive, 0);
+            }
+        }
+        f_close(&j->file);
+    }
+    if (!create) {
+        return false;
+    }
+
+    // Мястото се заделя наведнъж - добавянето на записи не променя FAT
+    if (f_open(&j->file, path, FA_CREATE_ALWAYS | FA_READ | FA_WRITE) != FR_OK) {
+        log_event(LOG_JOURNAL_FAIL, drive + 1, 0);
+        return false;
+    }
+    // Заделените клъстери не се изчистват - стари записи от изтрит журнал може да са в тях.
+    // Нова епоха, която не зависи от предишни файлове, ги прави невалидни
+    j->image = disk_manager_image_key(image);
+    j->epoch = (time_us_32() ^ j->image) | 1;
+    if (f_lseek(&j->file, JOURNAL_FILE_SIZE) != FR_OK || f_tell(&j->file) != JOURNAL_FILE_SIZE ||
+        !journal_write_header(j)) {
+        f_close(&j->file);
+        f_unlink(path);
+        log_event(LOG_JOURNAL_FAIL, drive + 1, 0);
+        return false;
+    }
+    j->open = true;
+    return true;
+}
+
+static void journal_close(journal_t *j) {
+    if (j->open) {
+        f_close(&j->file);
+    }
+    memset(j, 0, sizeof(*j));
+}
+
+// Прехвърляне на следващия запис в имиджа; след последния - нова епоха
+static bool journal_fold_step(uint8_t drive) {
+    journal_t *j = &journals[drive];
+    disk_image_t *image = disk_manager_get_image(&disk_manager, drive);
+    if (!image || !image->loaded) {
+        return false;
+    }
+
+    if (j->folded < j->count) {
+        disk_config_t *format = get_disk_config(image->format);
+        uint32_t track_size = (uint32_t)format->sectors_per_track * format->bytes_per_sector;
+        UINT bw;
+
+        if (!journal_block_io(j, 1 + j->folded, false, &record) || !journal_record_valid(j, j->folded) ||
+            record.size != format->bytes_per_sector || record.track >= format->tracks_per_disk) {
+            log_event(LOG_JOURNAL_FAIL, drive + 1, j->folded + 1);
+            return false;
+        }
+        FSIZE_t offset = (FSIZE_t)record.track * track_size + (FSIZE_t)record.sector * record.size;
+        if (f_lseek(&image->file_handle, offset) != FR_OK ||
+            f_write(&image->file_handle, record.data, record.size, &bw) != FR_OK || bw != record.size) {
+            log_event(LOG_JOURNAL_FAIL, drive + 1, j->folded + 1);
+            return false;
+        }
+
+        j->folded++;
+        if (j->folded < j->count) {
+            return true;
+        }
+    }
+
+    // Всички записи са в имиджа - новата епоха изпразва журнала
+    if (f_sync(&image->file_handle) != FR_OK) {
+        return false;
+    }
+    j->epoch++;
+    if (!journal_write_header(j)) {
+        j->epoch--;
+        return false;
+    }
+
+    log_event(LOG_JOURNAL_FOLDED, drive + 1, j->count);
+    j->count = 0;
+    j->folded = 0;
+    return true;
+}
+
+void journal_set_enabled(bool enabled) {
+    journal_on = enabled;
+    if (!enabled) {
+        // Журналите се изпразват; неуспешно сгъване остава за следващото монтиране
+        for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+            if (journals[i].open && journal_fold(i)) {
+                journal_close(&journals[i]);
+            }
+        }
+    }
+}
+
+bool journal_enabled(void) {
+    return journal_on;
+}
+
+// Нов имидж в устройството: незавършен журнал (прекъснато захранване,
+// извадена карта) се прехвърля в имиджа преди първото четене на пътека
+void journal_mount(uint8_t drive) {
+    if (drive >= DRIVE_COUNT) {
+        return;
+    }
+
+    journal_t *j = &journals[drive];
+    journal_close(j);
+    if (!journal_open(drive, false)) {
+        return;
+    }
+
+    // Записите са поредни: първото място, незаписано в тази епоха за този имидж, е краят
+    while (j->count < JOURNAL_RECORDS && journal_block_io(j, 1 + j->count, false, &record) &&
+           journal_record_valid(j, j->count)) {
+        j->track[j->count] = record.track;
+        j->sector[j->count] = record.sector;
+        j->count++;
+    }
+
+    if (j->count > 0) {
+        log_event(LOG_JOURNAL_REPLAY, drive + 1, j->count);
+        journal_fold(drive);
+    }
+
+    // Без режим на журнал файлът остава отворен, само ако сгъването не е успяло
+    if (!journal_on && j->count == 0) {
+        journal_close(j);
+    }
+}
+
+// Изваждане на диска; fold - журналът се прехвърля в имиджа (картата е налична)
+void journal_unmount(uint8_t drive, bool fold) {
+    if (drive >= DRIVE_COUNT) {
+        return;
+    }
+    if (fold && journals[drive].count > 0) {
+        journal_fold(drive);
+    }
+    journal_close(&journals[drive]);
+}
+
+// Добавяне на променените сектори на пътека (sectors - маска)
+// Един f_sync за всички; false - пътеката трябва да се запише направо в имиджа
+bool journal_append(uint8_t drive, uint8_t track, const uint8_t *track_data,
+                    uint32_t sectors, uint16_t bytes_per_sector) {
+    if (drive >= DRIVE_COUNT || bytes_per_sector > DRIVE_SECTOR_SIZE || !journal_open(drive, true)) {
+        return false;
+    }
+    journal_t *j = &journals[drive];
+
+    // Няма място за цяла пътека - журналът се сгъва преди новите записи
+    if (j->count + DRIVE_MAX_SECTORS > JOURNAL_RECORDS && !journal_fold(drive)) {
+        return false;
+    }
+
+    for (uint8_t s = 0; s < DRIVE_MAX_SECTORS; s++) {
+        if (!(sectors & (1u << s))) {
+            continue;
+        }
+
+        memset(&record, 0, sizeof(record));
+        record.magic = JOURNAL_RECORD_MAGIC;
+        record.epoch = j->epoch;
+        record.slot = j->count;
+        record.track = track;
+        record.sector = s;
+        record.size = bytes_per_sector;
+        record.image = j->image;
+        memcpy(record.data, track_data + (uint32_t)s * bytes_per_sector, bytes_per_sector);
+        record.check = journal_check(&record);
+
+        if (!journal_block_io(j, 1 + j->count, true, &record)) {
+            log_event(LOG_JOURNAL_FAIL, drive + 1, j->count + 1);
+            return false;
+        }
+        j->track[j->count] = track;
+        j->sector[j->count] = s;
+        j->count++;
+    }
+
+    if (f_sync(&j->file) != FR_OK) {
+        log_event(LOG_JOURNAL_FAIL, drive + 1, j->count);
+        return false;
+    }
+    j->last_append_ms = to_ms_since_boot(get_absolute_time());
+    return true;
+}
+
+// Пътеката е прочетена от имиджа - отгоре се слагат още несгънатите ѝ сектори
+// (най-новият запис за всеки сектор)
+void journal_overlay(uint8_t drive, uint8_t track, uint8_t *track_data) {
+    if (drive >= DRIVE_COUNT || !journals[drive].open) {
+        return;
+    }
+    journal_t *j = &journals[drive];
+    uint32_t applied = 0;
+
+    for (uint16_t slot = j->count; slot-- > 0;) {
+        if (j->track[slot] != track || (applied & (1u << j->sector[slot]))) {
+            continue;
+        }
+        applied |= 1u << j->sector[slot];
+        if (journal_block_io(j, 1 + slot, false, &record) && journal_record_valid(j, slot)) {
+            memcpy(track_data + (uint32_t)record.sector * record.size, record.data, record.size);
+        }
+    }
+}
+
+// Синхронно прехвърляне на целия журнал в имиджа
+bool journal_fold(uint8_t drive) {
+    if (drive >= DRIVE_COUNT || !journals[drive].open) {
+        return true;
+    }
+    while (journals[drive].count > 0) {
+        if (!journal_fold_step(drive)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Сгъване по един запис на извикване, когато моторът е изключен
+// и в журнала не е добавяно от JOURNAL_FOLD_IDLE_MS; връща true при операция с картата
+bool journal_task(bool idle) {
+    if (!idle) {
+        return false;
+    }
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        journal_t *j = &journals[i];
+        if (!j->open || j->count == 0 || now - j->last_append_ms < JOURNAL_FOLD_IDLE_MS) {
+            continue;
+        }
+        if (!journal_fold_step(i)) {
+            // Нов опит след JOURNAL_FOLD_IDLE_MS
+            j->last_append_ms = now;
+        }
+        return true;
+    }
+    return false;
+}
+
+uint16_t journal_pending(uint8_t drive) {
+    if (drive >= DRIVE_COUNT) {
+        return 0;
+    }
+    return journals[drive].count - journals[drive].folded;
+}
@@ -0,0 +1,46 @@
+/*
+ * Журнал на записаните сектори
+ *
+ * В режим на журнал променените сектори не се записват на място в имиджа,
+ * а последователно се добавят в предварително заделен файл до него
+ * (GAME.DSK -> GAME.JNL), по един SD блок на сектор. При изключен мотор
+ * и при изваждане на диска журналът се прехвърля (сгъва) в имиджа.
+ * Прекъсване на захранването не може да остави имиджа наполовина записан:
+ * незавършеният журнал се прехвърля наново при следващото монтиране.
+ *
+ * Файл: блок 0 - заглавие (magic, епоха, ключ на имиджа), след него
+ * JOURNAL_RECORDS записа. Валидни са поредните записи с текущата епоха и
+ * ключа на имиджа (път и размер); сгъването завършва с нова епоха в заглавието,
+ * което обезсилва всички записи наведнъж. Новият журнал започва от случайна
+ * епоха - стари записи в преизползвани клъстери не минават проверката.
+ * Журнал на друг имидж със същото име (GAME.DSK и GAME.PO) с непрехвърлени
+ * записи или отворен от другото устройство не се презаписва - тогава
+ * секторите се записват направо в имиджа.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JOURNAL_EXT ".JNL"
+#define JOURNAL_MAGIC 0x314C4E4A          // "JNL1" - заглавие
+#define JOURNAL_RECORD_MAGIC 0x5243454A   // "JECR" - запис
+#define JOURNAL_BLOCK_SIZE 512
+#define JOURNAL_RECORDS 64                // Сектори между две сгъвания (~33 KB файл)
+#define JOURNAL_FOLD_IDLE_MS 2000         // Сгъване след толкова без нов запис при изключен мотор
+
+// Функции
+void journal_set_enabled(bool enabled);
+bool journal_enabled(void);
+void journal_mount(uint8_t drive);
+void journal_unmount(uint8_t drive, bool fold);
+bool journal_append(uint8_t drive, uint8_t track, const uint8_t *track_data,
+                    uint32_t sectors, uint16_t bytes_per_sector);
+void journal_overlay(uint8_t drive, uint8_t track, uint8_t *track_data);
+bool journal_fold(uint8_t drive);
+bool journal_task(bool idle);
+uint16_t journal_pending(uint8_t drive);
+
+#endif // JOURNAL_H
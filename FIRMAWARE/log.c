@@ -0,0 +1,103 @@
+/*
+ * Отложен двоичен лог - буфер със записи с фиксиран размер
+ */
+
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+typedef struct {
+    uint8_t level;
+    const char *name;
+    const char *format;
+} log_event_info_t;
+
+static const log_event_info_t log_events[LOG_EVENT_COUNT] = {
+#define LOG_EVENT_INFO(id, level, format) { level, #id, format },
+    LOG_EVENTS(LOG_EVENT_INFO)
+#undef LOG_EVENT_INFO
+};
+
+static const char *log_level_names[] = { "error", "warn", "info", "debug" };
+
+static log_record_t log_ring[LOG_RING_SIZE];
+static volatile uint32_t log_next_seq = 0;   // Пореден номер на следващия запис
+static log_level_t log_level = LOG_LEVEL_INFO;
+
+// Записът е няколко думи - без printf и без изчакване
+void log_event(log_event_t event, uint32_t arg0, uint32_t arg1) {
+    if (event >= LOG_EVENT_COUNT || log_events[event].level > log_level) {
+        return;
+    }
+
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t seq = log_next_seq++;
+    log_record_t *record = &log_ring[seq & (LOG_RING_SIZE - 1)];
+    record->time_us = time_us_32();
+    record->event = event;
+    record->seq = (uint16_t)seq;
+    record->arg[0] = arg0;
+    record->arg[1] = arg1;
+    restore_interrupts(save);
+}
+
+void log_set_level(log_level_t level) {
+    log_level = level;
+}
+
+log_level_t log_get_level(void) {
+    return log_level;
+}
+
+const char* log_level_name(log_level_t level) {
+    return (level <= LOG_LEVEL_DEBUG) ? log_level_names[level] : "?";
+}
+
+bool log_parse_level(const char *name, log_level_t *level) {
+    for (uint8_t i = 0; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcmp(name, log_level_names[i]) == 0) {
+            *level = (log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t log_head(void) {
+    return log_next_seq;
+}
+
+// Запис с пореден номер seq (false - още не е записан или е презаписан)
+bool log_get(uint32_t seq, log_record_t *record) {
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t head = log_next_seq;
+    bool valid = (head - seq - 1) < LOG_RING_SIZE;
+    if (valid) {
+        *record = log_ring[seq & (LOG_RING_SIZE - 1)];
+    }
+    restore_interrupts(save);
+    return valid;
+}
+
+// Текст на записа: "[време ms] ниво: съобщение"
+int log_format(const log_record_t *record, char *buf, size_t size) {
+    if (record->event >= LOG_EVENT_COUNT) {
+        return snprintf(buf, size, "[%10lu] ? събитие %u\r\n",
+                        (unsigned long)(record->time_us / 1000), record->event);
+    }
+
+    const log_event_info_t *info = &log_events[record->event];
+    int len = snprintf(buf, size, "[%10lu] %s: ", (unsigned long)(record->time_us / 1000),
+                       log_level_name((log_level_t)info->level));
+    if (len < 0 || (size_t)len >= size) {
+        return len;
+    }
+    len += snprintf(buf + len, size - len, info->format,
+                    (unsigned)record->arg[0], (unsigned)record->arg[1]);
+    if ((size_t)len < size) {
+        len += snprintf(buf + len, size - len, "\r\n");
+    }
+    return len;
+}
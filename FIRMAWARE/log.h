@@ -0,0 +1,86 @@
+/*
+ * Отложен двоичен лог
+ *
+ * Горещите пътища записват само запис с фиксиран размер (време, събитие,
+ * два аргумента) в RAM буфер. Текстът се форматира по-късно - от CLI или
+ * на хоста с tools/log_decode.py, който чете таблицата LOG_EVENTS от този файл.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LOG_RING_SIZE 256            // Записи в буфера (степен на 2), по 16 байта
+
+typedef enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN = 1,
+    LOG_LEVEL_INFO = 2,
+    LOG_LEVEL_DEBUG = 3
+} log_level_t;
+
+// Събития: идентификатор, ниво и формат за двата аргумента (%u/%d/%X)
+// Новите събития се добавят в края - номерата им се пазят в записите
+#define LOG_EVENTS(X) \
+    X(LOG_TRACK_SEEK_FAIL,   LOG_LEVEL_ERROR, "Устройство %u: грешка при позициониране (код: %u)") \
+    X(LOG_TRACK_READ_FAIL,   LOG_LEVEL_ERROR, "Не може да се прочете пътека %u (код: %u)") \
+    X(LOG_TRACK_WRITE_FAIL,  LOG_LEVEL_ERROR, "Не може да се запише пътека %u (код: %u)") \
+    X(LOG_TRACK_SAVED,       LOG_LEVEL_INFO,  "Устройство %u: пътека %u е записана") \
+    X(LOG_TRACK_LOST,        LOG_LEVEL_ERROR, "Устройство %u: промените в пътека %u не са записани") \
+    X(LOG_TRACK_RESTORED,    LOG_LEVEL_WARN,  "Устройство %u: незаписаната пътека %u се записва след поставяне на картата") \
+    X(LOG_STEP,              LOG_LEVEL_DEBUG, "Устройство %u: стъпка -> пътека %u") \
+    X(LOG_WRITE_START,       LOG_LEVEL_DEBUG, "Устройство %u: започва запис на пътека %u") \
+    X(LOG_WRITE_SECTOR,      LOG_LEVEL_DEBUG, "Определен сектор: %u на пътека %u") \
+    X(LOG_WRITE_DONE,        LOG_LEVEL_INFO,  "Запис на сектор %u завършен (%u бита)") \
+    X(LOG_WRITE_ABORT,       LOG_LEVEL_WARN,  "Устройство %u: запис прекъснат (%u бита)") \
+    X(LOG_SD_CMD17_FAIL,     LOG_LEVEL_ERROR, "CMD17 неуспешна: 0x%02X за блок %u") \
+    X(LOG_SD_TOKEN_FAIL,     LOG_LEVEL_ERROR, "Старт токен 0x%02X (очаквано 0xFE) за блок %u") \
+    X(LOG_SCAN_READ_FAIL,    LOG_LEVEL_ERROR, "Грешка при четене на директория (код: %u, ниво %u)") \
+    X(LOG_SCAN_FULL,         LOG_LEVEL_WARN,  "Каталогът не приема повече записи (%u имиджа, %u елемента)") \
+    X(LOG_SP_READ_FAIL,      LOG_LEVEL_ERROR, "SmartPort том %u: грешка при четене на блок %u") \
+    X(LOG_SP_WRITE_FAIL,     LOG_LEVEL_ERROR, "SmartPort том %u: грешка при запис на блок %u") \
+    X(LOG_SP_RESET,          LOG_LEVEL_INFO,  "SmartPort: нулиране на шината (след %u команди)") \
+    X(LOG_SD_CMD24_FAIL,     LOG_LEVEL_ERROR, "CMD24 неуспешна: 0x%02X за блок %u") \
+    X(LOG_SD_DATA_REJECT,    LOG_LEVEL_ERROR, "Данните са отхвърлени: 0x%02X за блок %u") \
+    X(LOG_SD_BUSY_TIMEOUT,   LOG_LEVEL_ERROR, "Изтекъл срок за запис (0x%02X) на блок %u") \
+    X(LOG_SD_RETRY,          LOG_LEVEL_WARN,  "SD: опит %u за блок %u") \
+    X(LOG_SD_DMA_TIMEOUT,    LOG_LEVEL_ERROR, "SD: DMA не завърши (остават %u байта) за блок %u") \
+    X(LOG_SD_CMD25_FAIL,     LOG_LEVEL_ERROR, "CMD25 неуспешна: 0x%02X за блок %u") \
+    X(LOG_SD_DATA_CRC,       LOG_LEVEL_WARN,  "SD: грешен CRC16 0x%04X на блок %u - четене наново") \
+    X(LOG_PROFILE_LOADED,    LOG_LEVEL_INFO,  "Устройство %u: профил с %u пътеки") \
+    X(LOG_PROFILE_SAVED,     LOG_LEVEL_INFO,  "Устройство %u: записан профил с %u пътеки") \
+    X(LOG_TRACK_JOURNALED,   LOG_LEVEL_DEBUG, "Устройство %u: пътека %u записана в журнала") \
+    X(LOG_JOURNAL_REPLAY,    LOG_LEVEL_WARN,  "Устройство %u: незавършен журнал с %u сектора - прехвърля се") \
+    X(LOG_JOURNAL_FOLDED,    LOG_LEVEL_INFO,  "Устройство %u: журналът (%u сектора) е прехвърлен в имиджа") \
+    X(LOG_JOURNAL_FAIL,      LOG_LEVEL_ERROR, "Устройство %u: грешка в журнала (запис %u)") \
+    X(LOG_SP_INIT,           LOG_LEVEL_INFO,  "SmartPort: том %u получи адрес %u") \
+    X(LOG_JOURNAL_FOREIGN,   LOG_LEVEL_WARN,  "Устройство %u: журналът е на друг имидж (в устройство %u, 0 - незареден) - секторите се записват на място")
+
+typedef enum {
+#define LOG_EVENT_ID(id, level, format) id,
+    LOG_EVENTS(LOG_EVENT_ID)
+#undef LOG_EVENT_ID
+    LOG_EVENT_COUNT
+} log_event_t;
+
+typedef struct {
+    uint32_t time_us;                // time_us_32() при записа
+    uint16_t event;                  // log_event_t
+    uint16_t seq;                    // Младшите битове на поредния номер (за пропуски)
+    uint32_t arg[2];
+} log_record_t;
+
+// Функции
+void log_event(log_event_t event, uint32_t arg0, uint32_t arg1);
+void log_set_level(log_level_t level);
+log_level_t log_get_level(void);
+const char* log_level_name(log_level_t level);
+bool log_parse_level(const char *name, log_level_t *level);
+uint32_t log_head(void);
+bool log_get(uint32_t seq, log_record_t *record);
+int log_format(const log_record_t *record, char *buf, size_t size);
+
+#endif // LOG_H
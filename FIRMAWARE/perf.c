@@ -0,0 +1,74 @@
+/*
+ * Хистограми на закъсненията в горещите пътища
+ */
+
+#include "perf.h"
+#include <string.h>
+#include "pico/stdlib.h"
+
+static perf_stat_t perf_stats[PERF_COUNT];
+
+static const char *perf_names[PERF_COUNT] = {
+    "track_load",
+    "track_save",
+    "sd_read",
+    "sd_write",
+    "sd_cmd",
+    "display",
+    "main_loop"
+};
+
+static inline uint8_t perf_bucket(uint32_t us) {
+    uint8_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    return (bucket < PERF_BUCKETS) ? bucket : PERF_BUCKETS - 1;
+}
+
+void perf_stat_add(perf_stat_t *stat, uint32_t us) {
+    if (stat->count == 0 || us < stat->min) {
+        stat->min = us;
+    }
+    if (us > stat->max) {
+        stat->max = us;
+    }
+    stat->count++;
+    stat->total += us;
+    stat->buckets[perf_bucket(us)]++;
+}
+
+void perf_stat_reset(perf_stat_t *stat) {
+    memset(stat, 0, sizeof(*stat));
+}
+
+// Горна граница на коша, в който попада percent-ният процентил (ограничена от max)
+uint32_t perf_stat_percentile(const perf_stat_t *stat, uint8_t percent) {
+    if (stat->count == 0) {
+        return 0;
+    }
+
+    uint32_t target = ((uint64_t)stat->count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b < PERF_BUCKETS; b++) {
+        seen += stat->buckets[b];
+        if (seen >= target && seen > 0) {
+            uint32_t upper = b ? (1u << b) - 1 : 0;
+            return (upper < stat->max) ? upper : stat->max;
+        }
+    }
+    return stat->max;
+}
+
+void perf_record(perf_id_t id, uint32_t start_us) {
+    perf_stat_add(&perf_stats[id], time_us_32() - start_us);
+}
+
+const perf_stat_t* perf_get(perf_id_t id) {
+    return &perf_stats[id];
+}
+
+const char* perf_name(perf_id_t id) {
+    return perf_names[id];
+}
+
+void perf_reset(void) {
+    memset(perf_stats, 0, sizeof(perf_stats));
+}
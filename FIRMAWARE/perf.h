@@ -0,0 +1,44 @@
+/*
+ * Хистограми на закъсненията в горещите пътища
+ *
+ * Всяко измерване (µs от time_us_32) отива в log2 кош: кош b събира
+ * стойностите от 2^(b-1) до 2^b - 1, кош 0 - нулевите.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PERF_BUCKETS 24              // До 2^23 µs (~8 s), по-дългите са в последния кош
+
+typedef enum {
+    PERF_TRACK_LOAD = 0,             // Четене и кодиране на пътека
+    PERF_TRACK_SAVE,                 // Запис на пътека в имиджа
+    PERF_SD_READ,                    // sd_read_block
+    PERF_SD_WRITE,                   // sd_write_block
+    PERF_SD_CMD,                     // sd_send_cmd
+    PERF_DISPLAY,                    // Изпращане на променените страници на дисплея
+    PERF_MAIN_LOOP,                  // Една итерация на главния цикъл
+    PERF_COUNT
+} perf_id_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[PERF_BUCKETS];
+} perf_stat_t;
+
+// Функции
+void perf_stat_add(perf_stat_t *stat, uint32_t us);
+void perf_stat_reset(perf_stat_t *stat);
+uint32_t perf_stat_percentile(const perf_stat_t *stat, uint8_t percent);
+void perf_record(perf_id_t id, uint32_t start_us);
+const perf_stat_t* perf_get(perf_id_t id);
+const char* perf_name(perf_id_t id);
+void perf_reset(void);
+
+#endif // PERF_H
@@ -0,0 +1,232 @@
+/*
+ * Профил на достъпа до пътеките за всеки имидж
+ */
+
+#include "profile.h"
+#include "config.h"
+#include "disk_manager.h"
+#include "drive.h"
+#include "track_cache.h"
+#include "log.h"
+#include "ff.h"
+#include "pico/stdlib.h"
+#include <string.h>
+
+// FatFS file access mode definitions (ако не са дефинирани в ff.h)
+#ifndef FA_READ
+#define FA_READ         0x01
+#define FA_WRITE        0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW   0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS  0x10
+#define FA_OPEN_APPEND  0x30
+#endif
+
+extern disk_manager_t disk_manager;
+
+// Пътеките от профила се зареждат в предварителните записи на кеша - не повече
+// от броя им, иначе зарежданията се изместват взаимно
+#if TRACK_CACHE_SPECULATIVE < PROFILE_LOOKAHEAD
+#define PROFILE_PREFETCH TRACK_CACHE_SPECULATIVE
+#else
+#define PROFILE_PREFETCH PROFILE_LOOKAHEAD
+#endif
+
+typedef struct {
+    bool recording;                  // Записват се зарежданията на пътеки
+    bool dirty;                      // Записът е завършен и чака запис в картата
+    bool replaying;                  // Пътеките от профила се зареждат предварително
+    uint32_t start_ms;               // Монтиране на имиджа
+    uint16_t count;
+    uint16_t position;               // Следващата очаквана пътека при възпроизвеждане
+    uint8_t tracks[PROFILE_MAX_TRACKS];
+} profile_t;
+
+static profile_t profiles[DRIVE_COUNT];
+static bool record_enabled = true;
+static bool replay_enabled = true;
+
+static bool profile_path(uint8_t drive, char *path, size_t size) {
+    return disk_manager_sidecar_path(&disk_manager, drive, PROFILE_EXT, path, size);
+}
+
+// Формат: magic, брой (по 4 байта), след тях номерата на пътеките
+static bool profile_load(uint8_t drive) {
+    profile_t *p = &profiles[drive];
+    char path[MAX_FILENAME_LEN];
+    uint32_t header[2];
+    FIL file;
+    UINT br;
+
+    if (!profile_path(drive, path, sizeof(path)) || f_open(&file, path, FA_READ) != FR_OK) {
+        return false;
+    }
+
+    bool ok = f_read(&file, header, sizeof(header), &br) == FR_OK && br == sizeof(header) &&
+              header[0] == PROFILE_MAGIC && header[1] > 0 && header[1] <= PROFILE_MAX_TRACKS &&
+              f_read(&file, p->tracks, header[1], &br) == FR_OK && br == header[1];
+    f_close(&file);
+
+    p->count = ok ? (uint16_t)header[1] : 0;
+    return ok;
+}
+
+static bool profile_save(uint8_t drive) {
+    profile_t *p = &profiles[drive];
+    char path[MAX_FILENAME_LEN];
+    uint32_t header[2] = {PROFILE_MAGIC, p->count};
+    FIL file;
+    UINT bw;
+
+    if (!profile_path(drive, path, sizeof(path)) || f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        return false;
+    }
+
+    bool ok = f_write(&file, header, sizeof(header), &bw) == FR_OK && bw == sizeof(header) &&
+              f_write(&file, p->tracks, p->count, &bw) == FR_OK && bw == p->count;
+    f_close(&file);
+    return ok;
+}
+
+// Нов имидж в устройството: възпроизвеждане на профила или начало на записа
+void profile_mount(uint8_t drive) {
+    if (drive >= DRIVE_COUNT) {
+        return;
+    }
+
+    profile_t *p = &profiles[drive];
+    memset(p, 0, sizeof(*p));
+
+    if (profile_load(drive)) {
+        p->replaying = replay_enabled;
+        log_event(LOG_PROFILE_LOADED, drive + 1, p->count);
+    } else if (record_enabled && disk_manager_get_image(&disk_manager, drive)) {
+        p->recording = true;
+        p->start_ms = to_ms_since_boot(get_absolute_time());
+    }
+}
+
+// Имиджът е изваден - незавършеният запис се губи
+void profile_unmount(uint8_t drive) {
+    if (drive < DRIVE_COUNT) {
+        memset(&profiles[drive], 0, sizeof(profiles[drive]));
+    }
+}
+
+// Главата зареди пътека (от кеша или от картата)
+void profile_note(uint8_t drive, uint8_t track) {
+    if (drive >= DRIVE_COUNT) {
+        return;
+    }
+    profile_t *p = &profiles[drive];
+
+    if (p->recording && p->count < PROFILE_MAX_TRACKS &&
+        (p->count == 0 || p->tracks[p->count - 1] != track)) {
+        p->tracks[p->count++] = track;
+    }
+
+    // Възпроизвеждане: позицията следва главата (допуска пропуснати пътеки)
+    if (p->replaying) {
+        for (uint16_t i = p->position; i < p->count && i < p->position + PROFILE_LOOKAHEAD; i++) {
+            if (p->tracks[i] == track) {
+                p->position = i + 1;
+                break;
+            }
+        }
+    }
+}
+
+// Обслужване от главния цикъл, когато няма друга работа с картата
+// Профилът се записва само при idle (изключен мотор); връща true при операция с картата
+bool profile_task(bool idle) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+        profile_t *p = &profiles[i];
+
+        if (p->recording && (now - p->start_ms >= PROFILE_RECORD_MS || p->count >= PROFILE_MAX_TRACKS)) {
+            p->recording = false;
+            p->dirty = p->count > 1;
+        }
+
+        if (p->dirty && idle) {
+            p->dirty = false;
+            if (profile_save(i)) {
+                log_event(LOG_PROFILE_SAVED, i + 1, p->count);
+            }
+            return true;
+        }
+
+        if (!p->replaying) {
+            continue;
+        }
+        if (p->position >= p->count) {
+            p->replaying = false;
+            continue;
+        }
+
+        // Следващите пътеки от профила, които още не са в RAM
+        // Запис или отложен запис на пътеката - зареждането изчаква, без да спира профила
+        drive_t *d = drive_get(i);
+        if (d->write_in_progress || d->flush_pending) {
+            continue;
+        }
+        for (uint16_t k = p->position; k < p->count && k < p->position + PROFILE_PREFETCH; k++) {
+            uint8_t track = p->tracks[k];
+            if (track == d->buffer_track || track_cache_contains(i, track)) {
+                continue;
+            }
+            // Тук false е само грешка при четене от имиджа
+            if (!drive_prefetch_track(d, track)) {
+                p->replaying = false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void profile_set_record(bool enabled) {
+    record_enabled = enabled;
+    if (!enabled) {
+        for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+            profiles[i].recording = false;
+        }
+    }
+}
+
+void profile_set_replay(bool enabled) {
+    replay_enabled = enabled;
+    if (!enabled) {
+        for (uint8_t i = 0; i < DRIVE_COUNT; i++) {
+            profiles[i].replaying = false;
+        }
+    }
+}
+
+bool profile_record_enabled(void) {
+    return record_enabled;
+}
+
+bool profile_replay_enabled(void) {
+    return replay_enabled;
+}
+
+// Изтриване на профила на имиджа в устройството (записва се наново при следващото монтиране)
+bool profile_delete(uint8_t drive) {
+    char path[MAX_FILENAME_LEN];
+    if (drive >= DRIVE_COUNT || !profile_path(drive, path, sizeof(path))) {
+        return false;
+    }
+    profiles[drive].replaying = false;
+    FRESULT res = f_unlink(path);
+    return res == FR_OK || res == FR_NO_FILE;
+}
+
+void profile_status(uint8_t drive, bool *recording, uint16_t *count, uint16_t *position) {
+    profile_t *p = &profiles[drive < DRIVE_COUNT ? drive : 0];
+    if (recording) *recording = p->recording;
+    if (count) *count = p->count;
+    if (position) *position = p->position;
+}
@@ -0,0 +1,34 @@
+/*
+ * Профил на достъпа до пътеките за всеки имидж
+ *
+ * През първите PROFILE_RECORD_MS след монтиране се записва редът, в който
+ * главата зарежда пътеките. Профилът се пази до имиджа (GAME.DSK -> GAME.PRF)
+ * и при следващото монтиране пътеките се зареждат предварително в кеша
+ * в същия ред - зареждането при стартиране на програмата е от RAM.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PROFILE_EXT ".PRF"
+#define PROFILE_MAGIC 0x31465250     // "PRF1"
+#define PROFILE_RECORD_MS 20000      // Записва се достъпът през първите 20 s
+#define PROFILE_MAX_TRACKS 128       // Зареждания в един профил
+#define PROFILE_LOOKAHEAD 4          // Пътеки от профила пред главата (следене на позицията)
+
+// Функции
+void profile_mount(uint8_t drive);
+void profile_unmount(uint8_t drive);
+void profile_note(uint8_t drive, uint8_t track);
+bool profile_task(bool idle);
+void profile_set_record(bool enabled);
+void profile_set_replay(bool enabled);
+bool profile_record_enabled(void);
+bool profile_replay_enabled(void);
+bool profile_delete(uint8_t drive);
+void profile_status(uint8_t drive, bool *recording, uint16_t *count, uint16_t *position);
+
+#endif // PROFILE_H
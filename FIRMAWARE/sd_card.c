@@ -0,0 +1,913 @@
+/*
+ * SD карта в SPI режим
+ *
+ * Инициализацията и проверките за наличност са синхронни (при стартиране и
+ * hotplug). Четенето и записът на блокове минават през машината на
+ * състоянията по-долу - тя не спи и не чака в цикъл без краен срок.
+ */
+
+#include "sd_card.h"
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+#include "hardware/gpio.h"
+#include "hardware/dma.h"
+#include "config.h"
+#include "log.h"
+#include "perf.h"
+
+#define PIN_MISO gpio_config.sd_miso
+#define PIN_CS gpio_config.sd_cs
+#define PIN_SCK gpio_config.sd_sck
+#define PIN_MOSI gpio_config.sd_mosi
+
+// SD Card SPI
+spi_inst_t* SPI_PORT = spi0;
+
+typedef enum {
+    SD_STATE_IDLE = 0,
+    SD_STATE_RETRY,                  // Чака насрочения повторен опит
+    SD_STATE_WAIT_READY,             // Картата още програмира предишния запис
+    SD_STATE_COMMAND,                // CMD17/CMD24 и отговор R1
+    SD_STATE_WAIT_TOKEN,             // Четене: чака старт токен 0xFE
+    SD_STATE_DATA,                   // Начало на прехвърлянето на 512 байта
+    SD_STATE_DATA_END,               // Край на DMA, CRC и data response
+    SD_STATE_WAIT_BUSY               // CMD25: картата програмира блока преди следващия
+} sd_state_t;
+
+static bool sd_is_sdhc = false;      // Дали SD картата е SDHC/SDXC (true) или SDSC (false)
+static sd_request_t *sd_current = NULL;
+static sd_state_t sd_state = SD_STATE_IDLE;
+static uint32_t sd_deadline = 0;     // Краен срок на изчакването или време за повторния опит
+static uint32_t sd_start = 0;        // Начало на заявката (за perf)
+static sd_wait_hook_t sd_wait_hook = NULL;
+static bool sd_in_wait_hook = false;
+static int sd_dma_tx = -1;           // SPI TX за блока с данни
+static int sd_dma_rx = -1;           // SPI RX за блока с данни
+static const uint8_t sd_dma_fill = 0xFF;
+static uint8_t sd_dma_sink;
+static bool sd_suspect = false;      // Последната операция е неуспешна - картата може да липсва
+static uint16_t sd_block_index = 0;  // Текущ блок на CMD25
+static bool sd_busy_pending = false; // Картата програмира последния запис (CS е освободен)
+static uint32_t sd_busy_deadline = 0;
+static uint32_t sd_busy_block = 0;   // Последният записан блок (за лога)
+static bool sd_busy_failed = false;  // Програмирането не завърши в срок
+static bool sd_crc_on = false;       // Картата проверява CRC (CMD59)
+static uint32_t sd_crc_errors = 0;   // Блокове с грешен CRC16
+static uint8_t sd_crc7_table[256];   // CRC7 на байт, изместен с 1 бит наляво
+static uint16_t sd_crc16_table[256]; // CRC16-CCITT (XMODEM) на байт
+
+static void sd_complete(bool ok);
+static void sd_wait_ready_blocking(void);
+
+// Таблиците за CRC7 (x^7 + x^3 + 1) и CRC16 (x^16 + x^12 + x^5 + 1)
+static void sd_crc_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t c7 = i;
+        uint16_t c16 = i << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            c7 = (c7 & 0x80) ? (c7 << 1) ^ 0x12 : (c7 << 1);
+            c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : (c16 << 1);
+        }
+        sd_crc7_table[i] = c7;
+        sd_crc16_table[i] = c16;
+    }
+}
+
+// Последният байт на командата: CRC7 и стоп бит
+static uint8_t sd_crc7(const uint8_t *data, uint8_t len) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        crc = sd_crc7_table[crc ^ data[i]];
+    }
+    return crc | 0x01;
+}
+
+static uint16_t sd_crc16(const uint8_t *data, uint32_t len) {
+    uint16_t crc = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        crc = (crc << 8) ^ sd_crc16_table[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+// Инициализация на SPI за SD карта
+void sd_spi_init(void) {
+    sd_crc_init();
+    spi_init(SPI_PORT, SD_SPI_INIT_HZ);  // 400 kHz за инициализация
+    gpio_set_function(PIN_MISO, GPIO_FUNC_SPI);
+    gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
+    gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+    
+    gpio_init(PIN_CS);
+    gpio_pull_up(PIN_CS);
+    gpio_set_dir(PIN_CS, GPIO_OUT);
+    gpio_put(PIN_CS, 1);  // CS висок (неактивен)
+    gpio_pull_up(PIN_MISO);
+    gpio_pull_up(PIN_MOSI);
+    gpio_pull_up(PIN_SCK);
+    
+    // DMA канали за фазата с данни (без тях блокът се прехвърля с spi_*_blocking)
+    if (sd_dma_rx < 0) {
+        sd_dma_tx = dma_claim_unused_channel(false);
+        sd_dma_rx = dma_claim_unused_channel(false);
+        if (sd_dma_tx < 0 || sd_dma_rx < 0) {
+            printf("ПРЕДУПРЕЖДЕНИЕ: Няма свободни DMA канали за SD картата\n");
+            sd_dma_rx = -1;
+        }
+    }
+    
+    // Card-detect ключ (ако е свързан)
+    if (sd_card_detect_available()) {
+        gpio_init(gpio_config.sd_detect);
+        gpio_set_dir(gpio_config.sd_detect, GPIO_IN);
+        gpio_pull_up(gpio_config.sd_detect);
+    }
+}
+
+// Изпращане на команда към SD карта
+static uint8_t sd_send_cmd_spi(uint8_t cmd, uint32_t arg) {
+    uint8_t response;
+    uint8_t dummy = 0xFF;
+    
+    // Предишният запис трябва да е програмиран
+    sd_wait_ready_blocking();
+    
+    // Изпращане на dummy byte преди CS (SD спецификация)
+    spi_write_blocking(SPI_PORT, &dummy, 1);
+    
+    // Спускане на CS
+    gpio_put(PIN_CS, 0);
+    
+    // Изчакване след CS (SD спецификация изисква минимум 1 dummy byte)
+    spi_write_blocking(SPI_PORT, &dummy, 1);
+    
+    // Команда, аргумент и CRC7 (задължителен за CMD0/CMD8 и за всички в CRC режим)
+    uint8_t frame[6] = {
+        cmd,
+        (arg >> 24) & 0xFF,
+        (arg >> 16) & 0xFF,
+        (arg >> 8) & 0xFF,
+        arg & 0xFF,
+        0
+    };
+    frame[5] = sd_crc7(frame, 5);
+    spi_write_blocking(SPI_PORT, frame, sizeof(frame));
+    
+    // Четене на отговор (до 8 байта за по-бавни карти)
+    response = 0xFF;
+    for (int i = 0; i < 8; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &response, 1);
+        if ((response & 0x80) == 0) break;
+    }
+    
+    // Вдигане на CS
+    gpio_put(PIN_CS, 1);
+    
+    // Допълнителен clock след CS
+    spi_write_blocking(SPI_PORT, &dummy, 1);
+    
+    return response;
+}
+
+static uint8_t sd_send_cmd(uint8_t cmd, uint32_t arg) {
+    uint32_t start = time_us_32();
+    uint8_t response = sd_send_cmd_spi(cmd, arg);
+    perf_record(PERF_SD_CMD, start);
+    return response;
+}
+
+// Инициализация на SD карта
+bool sd_init(void) {
+    uint8_t response;
+    bool is_sdhc = false;
+    uint8_t dummy = 0xFF;
+    
+    // Незавършена заявка не може да продължи след нулиране на картата
+    if (sd_current) {
+        sd_complete(false);
+    }
+    
+    // Уверете се че CS е висок (неактивен) преди началото
+    gpio_put(PIN_CS, 1);
+    
+    // Първоначални clock цикли (минимум 74 за SD карта, но изпращаме повече за надеждност)
+    for (int i = 0; i < 100; i++) {
+        spi_write_blocking(SPI_PORT, &dummy, 1);
+    }
+    
+    // Изчакване преди първата команда
+    sleep_ms(10);
+    
+    // CMD0 - Reset (GO_IDLE_STATE)
+    response = sd_send_cmd(0x40, 0);
+    if (response != 0x01) {
+        printf("SD CMD0 failed: 0x%02X\n", response);
+        // Опитваме се още веднъж с по-дълго забавяне
+        sleep_ms(200);
+        for (int i = 0; i < 100; i++) {
+            spi_write_blocking(SPI_PORT, &dummy, 1);
+        }
+        sleep_ms(10);
+        response = sd_send_cmd(0x40, 0);
+        if (response != 0x01) {
+            printf("SD CMD0 failed again: 0x%02X\n", response);
+            printf("ВЪЗМОЖНИ ПРИЧИНИ:\n");
+            printf("  1. SD картата не е правилно свързана\n");
+            printf("  2. Проблем с SPI комуникацията\n");
+            printf("  3. SD картата не е готова или е повредена\n");
+            return false;
+        }
+    }
+    
+    // Изчакване след CMD0 (SD спецификация изисква минимум 1ms)
+    sleep_ms(50);
+    
+    // CMD8 - Check voltage (SEND_IF_COND)
+    // За CMD8 трябва да четем R7 отговора докато CS е ниско
+    gpio_put(PIN_CS, 0);
+    uint8_t cmd8_cmd = 0x48;
+    uint8_t cmd8_crc = 0x87;
+    uint8_t cmd8_arg[4] = {0x00, 0x00, 0x01, 0xAA};
+    
+    // Изпращане на CMD8
+    spi_write_blocking(SPI_PORT, &cmd8_cmd, 1);
+    spi_write_blocking(SPI_PORT, cmd8_arg, 4);
+    spi_write_blocking(SPI_PORT, &cmd8_crc, 1);
+    
+    // Четене на отговор
+    response = 0xFF;
+    for (int i = 0; i < 8; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &response, 1);
+        if ((response & 0x80) == 0) break;
+    }
+    
+    if (response == 0x01) {
+        // SDHC/SDXC карта - четем R7 отговор (докато CS е ниско)
+        uint8_t r7[4];
+        for (int i = 0; i < 4; i++) {
+            spi_read_blocking(SPI_PORT, 0xFF, &r7[i], 1);
+        }
+        gpio_put(PIN_CS, 1);
+        spi_write_blocking(SPI_PORT, &dummy, 1);
+        
+        // Проверка дали картата поддържа напрежението
+        if (r7[2] == 0x01 && r7[3] == 0xAA) {
+            is_sdhc = true;
+        }
+    } else if (response == 0x05) {
+        // Стара SD карта (SDSC) - не поддържа CMD8
+        gpio_put(PIN_CS, 1);
+        spi_write_blocking(SPI_PORT, &dummy, 1);
+        is_sdhc = false;
+    } else {
+        gpio_put(PIN_CS, 1);
+        spi_write_blocking(SPI_PORT, &dummy, 1);
+        printf("SD CMD8 unexpected response: 0x%02X\n", response);
+        // Продължаваме с опит за инициализация (предполагаме SDSC)
+        is_sdhc = false;
+    }
+    
+    // ACMD41 - Initialize (SD_SEND_OP_COND)
+    // За SDHC/SDXC използваме 0x40000000, за SDSC използваме 0x00000000
+    uint32_t acmd41_arg = is_sdhc ? 0x40000000 : 0x00000000;
+    
+    // Опитваме се за по-дълго време за бавни карти
+    for (int i = 0; i < 200; i++) {
+        // CMD55 - APP_CMD (задължително преди всяка ACMD команда)
+        response = sd_send_cmd(0x77, 0);
+        if (response != 0x01) {
+            // Ако CMD55 не връща 0x01, картата не е готова - изчакваме по-дълго
+            if (i < 10 || (i % 20 == 0)) {
+                // Показваме само първите 10 опита или на всеки 20-ти опит
+                printf("SD CMD55 не готов: 0x%02X (attempt %d)\n", response, i + 1);
+            }
+            sleep_ms(50);
+            continue;
+        }
+        
+        // Допълнителни clock цикли между CMD55 и ACMD41 (SD спецификация изисква това)
+        for (int j = 0; j < 8; j++) {
+            spi_write_blocking(SPI_PORT, &dummy, 1);
+        }
+        
+        // ACMD41 - Initialize
+        response = sd_send_cmd(0x69, acmd41_arg);
+        if (response == 0x00) {
+            // Успешна инициализация
+            break;
+        }
+        
+        // Ако получим 0x01, картата все още е в idle state - това е нормално, продължаваме
+        if (response == 0x01) {
+            // Нормално - картата все още се инициализира
+            // Продължаваме с нормалното изчакване
+        } else if ((response & 0x01) == 0x01) {
+            // Отговор с bit 0 set (idle state) но с други битове - може да е временен проблем
+            // Продължаваме но с по-дълго изчакване
+            if (i < 5) {
+                printf("SD ACMD41 response with idle bit: 0x%02X (attempt %d)\n", response, i + 1);
+            }
+            sleep_ms(50);
+            continue;
+        } else {
+            // Неочакван отговор без idle bit - може да е проблем, но опитваме се отново
+            if (i < 5) {
+                printf("SD ACMD41 unexpected response: 0x%02X (attempt %d)\n", response, i + 1);
+            }
+            // При неочакван отговор правим по-дълго изчакване и опитваме се отново с CMD0
+            sleep_ms(100);
+            // Опитваме се да направим reset с CMD0
+            uint8_t reset_response = sd_send_cmd(0x40, 0);
+            if (reset_response == 0x01) {
+                sleep_ms(50);
+            }
+            continue;
+        }
+        
+        sleep_ms(10);  // Нормално изчакване когато отговорът е 0x01
+    }
+    
+    if (response != 0x00) {
+        printf("SD ACMD41 failed: 0x%02X (after 200 attempts)\n", response);
+        return false;
+    }
+    
+    // CMD59 - CRC_ON_OFF: без него грешка по шината минава незабелязано
+    sd_crc_on = false;
+#if SD_CRC_ENABLE
+    response = sd_send_cmd(0x7B, 1);
+    if (response == 0x00) {
+        sd_crc_on = true;
+    } else {
+        printf("SD CMD59 неуспешна: 0x%02X - без CRC\n", response);
+    }
+#endif
+    
+    // Увеличаване на скоростта (пълна само с CRC)
+    spi_set_baudrate(SPI_PORT, sd_crc_on ? SD_SPI_FAST_HZ : SD_SPI_SAFE_HZ);
+    
+    // Запазване на типа на картата за адресирането на блоковете
+    sd_is_sdhc = is_sdhc;
+    sd_suspect = false;
+    
+    printf("SD карта инициализирана успешно (%s, %lu kHz%s)\n", is_sdhc ? "SDHC/SDXC" : "SDSC",
+           (unsigned long)(sd_card_clock_hz() / 1000), sd_crc_on ? ", CRC" : "");
+    return true;
+}
+
+// Проверка дали SD картата е готова (публична функция за diskio.c)
+bool sd_check_ready(void) {
+    if (sd_current) {
+        return true;
+    }
+    
+    // Използваме CMD13 (SEND_STATUS) - безопасна команда която не променя състоянието
+    uint8_t response = sd_send_cmd(0x4D, 0);  // CMD13 - SEND_STATUS
+    if (response == 0x00) {
+        // Картата е готова - прочитаме статуса (2 байта) за да завършим транзакцията
+        uint8_t status[2];
+        uint8_t dummy = 0xFF;
+        gpio_put(PIN_CS, 0);
+        spi_read_blocking(SPI_PORT, 0xFF, status, 2);
+        gpio_put(PIN_CS, 1);
+        spi_write_blocking(SPI_PORT, &dummy, 1);
+        return true;
+    }
+    return false;
+}
+
+// Проверка дали SD картата е налична (hotplug detection)
+bool sd_check_presence(bool initialized) {
+    // Картата обслужва заявка - значи е налична
+    if (sd_current) {
+        return true;
+    }
+    
+    // Ако картата вече е инициализирана, опитваме се с безопасна команда
+    if (initialized) {
+        // Използваме CMD13 (SEND_STATUS) - безопасна команда
+        uint8_t response = sd_send_cmd(0x4D, 0);  // CMD13 - SEND_STATUS
+        if (response == 0x00) {
+            // Картата отговаря - прочитаме статуса (2 байта)
+            uint8_t status[2];
+            uint8_t dummy = 0xFF;
+            gpio_put(PIN_CS, 0);
+            spi_read_blocking(SPI_PORT, 0xFF, status, 2);
+            gpio_put(PIN_CS, 1);
+            spi_write_blocking(SPI_PORT, &dummy, 1);
+            sd_suspect = false;
+            return true;
+        }
+        // Ако CMD13 не работи, картата може да е премахната
+        return false;
+    } else {
+        // Картата не е инициализирана - опитваме се с CMD0
+        // CMD0 винаги трябва да отговори с 0x01 (idle state) ако картата е налична
+        uint8_t response = sd_send_cmd(0x40, 0);  // CMD0 - GO_IDLE_STATE
+        if (response == 0x01) {
+            // Картата е налична, но не е инициализирана
+            return true;
+        }
+        return false;
+    }
+}
+
+// ============================================================================
+// Машина на състоянията за четене/запис на блок
+// ============================================================================
+
+static inline bool sd_time_reached(uint32_t deadline) {
+    return (int32_t)(time_us_32() - deadline) >= 0;
+}
+
+static void sd_deselect(void) {
+    uint8_t dummy = 0xFF;
+    gpio_put(PIN_CS, 1);
+    spi_write_blocking(SPI_PORT, &dummy, 1);
+}
+
+static void sd_complete(bool ok) {
+    sd_request_t *req = sd_current;
+    sd_current = NULL;
+    sd_state = SD_STATE_IDLE;
+
+    perf_record(req->op == SD_OP_READ ? PERF_SD_READ : PERF_SD_WRITE, sd_start);
+    sd_suspect = !ok;
+    req->ok = ok;
+    req->busy = false;
+    if (req->done) {
+        req->done(req, ok);
+    }
+}
+
+static inline bool sd_multi_write(void) {
+    return sd_current->op == SD_OP_WRITE && sd_current->count > 1;
+}
+
+// Картата програмира блока - CS се освобождава, готовността се проверява при следващия достъп
+static void sd_release_busy(void) {
+    sd_deselect();
+    sd_busy_pending = true;
+    sd_busy_failed = false;
+    sd_busy_deadline = time_us_32() + SD_BUSY_TIMEOUT_US;
+    sd_busy_block = sd_current->block + sd_block_index;
+}
+
+// Проверка дали картата е приключила програмирането (true = може да се продължи)
+static bool sd_poll_ready(void) {
+    uint8_t status = 0x00;
+    gpio_put(PIN_CS, 0);
+    for (int i = 0; i < SD_POLL_BYTES; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &status, 1);
+        if (status != 0x00) break;
+    }
+    sd_deselect();
+
+    if (status != 0x00) {
+        sd_busy_pending = false;
+        return true;
+    }
+    if (sd_time_reached(sd_busy_deadline)) {
+        // Записът не е потвърден - следващата команда ще покаже дали картата отговаря
+        log_event(LOG_SD_BUSY_TIMEOUT, status, sd_busy_block);
+        sd_busy_pending = false;
+        sd_busy_failed = true;
+        sd_suspect = true;
+        return true;
+    }
+    return false;
+}
+
+static void sd_wait_ready_blocking(void) {
+    while (sd_busy_pending && !sd_poll_ready()) {
+    }
+}
+
+// Следващата команда - след края на програмирането от предишния запис
+static void sd_begin_command(void) {
+    sd_state = sd_busy_pending ? SD_STATE_WAIT_READY : SD_STATE_COMMAND;
+}
+
+// Неуспешен опит - насрочва се следващият или заявката завършва с грешка
+static void sd_fail(log_event_t event, uint32_t code, uint32_t delay_us) {
+    sd_deselect();
+
+    if (sd_current->attempts >= SD_MAX_ATTEMPTS) {
+        log_event(event, code, sd_current->block);
+        sd_complete(false);
+        return;
+    }
+    sd_state = SD_STATE_RETRY;
+    sd_deadline = time_us_32() + delay_us;
+}
+
+static bool sd_step_wait_ready(void) {
+    if (!sd_poll_ready()) {
+        return false;
+    }
+    sd_state = SD_STATE_COMMAND;
+    return true;
+}
+
+// Изпращане на CMD17/CMD24/CMD25 - отговорът R1 идва до 8 байта след командата
+static bool sd_step_command(void) {
+    sd_request_t *req = sd_current;
+    uint8_t dummy = 0xFF;
+    bool multi = sd_multi_write();
+    uint8_t cmd = (req->op == SD_OP_READ) ? 0x51 : (multi ? 0x59 : 0x58);
+    uint32_t start = time_us_32();
+
+    // ACMD23 (SET_WR_BLK_ERASE_COUNT) - картата изтрива блоковете предварително
+    // Само подсказка: при грешка CMD25 работи и без нея
+    if (multi && sd_send_cmd_spi(0x77, 0) <= 0x01) {
+        sd_send_cmd_spi(0x57, req->count);
+    }
+
+    // За SDHC/SDXC карти, адресът е директно в блокове
+    // За SDSC карти, адресът трябва да се умножи по 512 (размер на блока)
+    uint32_t address = sd_is_sdhc ? req->block : (req->block * SD_BLOCK_SIZE);
+    uint8_t frame[6] = {
+        cmd,
+        (address >> 24) & 0xFF,
+        (address >> 16) & 0xFF,
+        (address >> 8) & 0xFF,
+        address & 0xFF,
+        0
+    };
+    frame[5] = sd_crc7(frame, 5);
+
+    req->attempts++;
+    sd_block_index = 0;
+    gpio_put(PIN_CS, 0);
+    spi_write_blocking(SPI_PORT, &dummy, 1);
+    spi_write_blocking(SPI_PORT, frame, sizeof(frame));
+
+    uint8_t response = 0xFF;
+    for (int i = 0; i < 8; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &response, 1);
+        if ((response & 0x80) == 0) break;
+    }
+    // Командата и R1 (с ACMD23 при CMD25) - в същата хистограма като sd_send_cmd
+    perf_record(PERF_SD_CMD, start);
+
+    log_event_t fail_event = (req->op == SD_OP_READ) ? LOG_SD_CMD17_FAIL :
+                             (multi ? LOG_SD_CMD25_FAIL : LOG_SD_CMD24_FAIL);
+    if (response == 0x04) {
+        // Command CRC Error - повече clock цикли и по-дълга пауза
+        gpio_put(PIN_CS, 1);
+        for (int i = 0; i < 10; i++) {
+            spi_write_blocking(SPI_PORT, &dummy, 1);
+        }
+        sd_fail(fail_event, response, SD_CRC_RETRY_DELAY_US);
+        return false;
+    }
+    if (response != 0x00) {
+        sd_fail(fail_event, response, SD_RETRY_DELAY_US + (req->attempts - 1) * 10000);
+        return false;
+    }
+
+    if (req->op == SD_OP_READ) {
+        sd_state = SD_STATE_WAIT_TOKEN;
+        sd_deadline = time_us_32() + SD_TOKEN_TIMEOUT_US;
+    } else {
+        sd_state = SD_STATE_DATA;
+    }
+    return true;
+}
+
+// Изчакване на старт токена (0xFE) - по SD_POLL_BYTES байта на извикване
+static bool sd_step_wait_token(void) {
+    uint8_t token = 0xFF;
+    for (int i = 0; i < SD_POLL_BYTES; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &token, 1);
+        if (token != 0xFF) break;
+    }
+
+    if (token == 0xFE) {
+        sd_state = SD_STATE_DATA;
+        return true;
+    }
+    // Токен за грешка (0x0X) или изтекъл срок
+    if (token != 0xFF || sd_time_reached(sd_deadline)) {
+        sd_fail(LOG_SD_TOKEN_FAIL, token, SD_RETRY_DELAY_US);
+    }
+    return false;
+}
+
+// DMA за блока: RX канал пише в буфера, TX канал подава байтовете (или 0xFF)
+// Снифърът на DMA смята CRC16 на данните по време на прехвърлянето (канала с данните)
+static void sd_dma_start(const uint8_t *tx, bool tx_increment, uint8_t *rx, bool rx_increment) {
+    dma_channel_config c = dma_channel_get_default_config(sd_dma_rx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(SPI_PORT, false));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, rx_increment);
+    channel_config_set_sniff_enable(&c, rx_increment);
+    dma_channel_configure(sd_dma_rx, &c, rx, &spi_get_hw(SPI_PORT)->dr, SD_BLOCK_SIZE, false);
+
+    c = dma_channel_get_default_config(sd_dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(SPI_PORT, true));
+    channel_config_set_read_increment(&c, tx_increment);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_sniff_enable(&c, tx_increment);
+    dma_channel_configure(sd_dma_tx, &c, &spi_get_hw(SPI_PORT)->dr, tx, SD_BLOCK_SIZE, false);
+
+    dma_sniffer_enable(rx_increment ? sd_dma_rx : sd_dma_tx, DMA_SNIFF_CTRL_CALC_VALUE_CRC16, true);
+    dma_sniffer_set_data_accumulator(0);
+
+    // Двата канала тръгват заедно - RX FIFO не може да препълни
+    dma_start_channel_mask((1u << sd_dma_rx) | (1u << sd_dma_tx));
+}
+
+// Начало на фазата с данни: 512 байта с едно DMA прехвърляне (или наведнъж без DMA)
+static bool sd_step_data(void) {
+    sd_request_t *req = sd_current;
+
+    uint8_t *data = req->buffer + (uint32_t)sd_block_index * SD_BLOCK_SIZE;
+
+    if (req->op == SD_OP_WRITE) {
+        // 0xFC - блок от CMD25, 0xFE - единичен блок
+        uint8_t token = sd_multi_write() ? 0xFC : 0xFE;
+        spi_write_blocking(SPI_PORT, &token, 1);
+    }
+
+    if (sd_dma_rx < 0) {
+        if (req->op == SD_OP_READ) {
+            spi_read_blocking(SPI_PORT, 0xFF, data, SD_BLOCK_SIZE);
+        } else {
+            spi_write_blocking(SPI_PORT, data, SD_BLOCK_SIZE);
+        }
+        sd_state = SD_STATE_DATA_END;
+        return true;
+    }
+
+    if (req->op == SD_OP_READ) {
+        sd_dma_start(&sd_dma_fill, false, data, true);
+    } else {
+        sd_dma_start(data, true, &sd_dma_sink, false);
+    }
+    sd_state = SD_STATE_DATA_END;
+    sd_deadline = time_us_32() + SD_DMA_TIMEOUT_US;
+    return true;
+}
+
+// Край на фазата с данни: CRC и (при запис) data response token
+static bool sd_step_data_end(void) {
+    sd_request_t *req = sd_current;
+    uint8_t crc[2] = {0xFF, 0xFF};
+
+    if (sd_dma_rx >= 0 && dma_channel_is_busy(sd_dma_rx)) {
+        if (!sd_time_reached(sd_deadline)) {
+            return false;
+        }
+        dma_channel_abort(sd_dma_tx);
+        dma_channel_abort(sd_dma_rx);
+        sd_fail(LOG_SD_DMA_TIMEOUT, dma_channel_hw_addr(sd_dma_rx)->transfer_count, SD_RETRY_DELAY_US);
+        return false;
+    }
+
+    // CRC16 на блока - от снифъра (DMA) или по таблицата
+    const uint8_t *data = req->buffer + (uint32_t)sd_block_index * SD_BLOCK_SIZE;
+    uint16_t block_crc = 0xFFFF;
+    if (sd_crc_on) {
+        block_crc = (sd_dma_rx >= 0) ? (uint16_t)dma_sniffer_get_data_accumulator()
+                                     : sd_crc16(data, SD_BLOCK_SIZE);
+    }
+
+    if (req->op == SD_OP_READ) {
+        spi_read_blocking(SPI_PORT, 0xFF, crc, 2);
+        uint16_t card_crc = ((uint16_t)crc[0] << 8) | crc[1];
+        if (sd_crc_on && card_crc != block_crc) {
+            // Повреден блок - чете се наново (след последния опит грешката се записва от sd_fail)
+            sd_crc_errors++;
+            if (req->attempts < SD_MAX_ATTEMPTS) {
+                log_event(LOG_SD_DATA_CRC, card_crc, req->block);
+            }
+            sd_fail(LOG_SD_DATA_CRC, card_crc, 0);
+            return false;
+        }
+        sd_deselect();
+        sd_complete(true);
+        return false;
+    }
+
+    crc[0] = block_crc >> 8;
+    crc[1] = block_crc & 0xFF;
+    spi_write_blocking(SPI_PORT, crc, 2);
+
+    // Data response token идва веднага след CRC
+    uint8_t token = 0xFF;
+    for (int i = 0; i < 8; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &token, 1);
+        if (token != 0xFF) break;
+    }
+    if ((token & 0x1F) != 0x05) {
+        if (sd_multi_write()) {
+            // Stop Tran токен - картата излиза от CMD25
+            uint8_t stop = 0xFD;
+            spi_write_blocking(SPI_PORT, &stop, 1);
+        }
+        sd_release_busy();
+        sd_fail(LOG_SD_DATA_REJECT, token, SD_RETRY_DELAY_US);
+        return false;
+    }
+
+    if (!sd_multi_write()) {
+        // Заявката е готова - програмирането се припокрива със следващата работа
+        sd_release_busy();
+        sd_complete(true);
+        return false;
+    }
+
+    sd_state = SD_STATE_WAIT_BUSY;
+    sd_deadline = time_us_32() + SD_BUSY_TIMEOUT_US;
+    return true;
+}
+
+// CMD25: изчакване на програмирането на блока преди следващия
+static bool sd_step_wait_busy(void) {
+    sd_request_t *req = sd_current;
+    uint8_t status = 0x00;
+    for (int i = 0; i < SD_POLL_BYTES; i++) {
+        spi_read_blocking(SPI_PORT, 0xFF, &status, 1);
+        if (status != 0x00) break;
+    }
+
+    if (status == 0x00) {
+        if (sd_time_reached(sd_deadline)) {
+            sd_release_busy();
+            sd_fail(LOG_SD_BUSY_TIMEOUT, status, SD_RETRY_DELAY_US);
+        }
+        return false;
+    }
+
+    if (sd_block_index + 1 < req->count) {
+        sd_block_index++;
+        sd_state = SD_STATE_DATA;
+        return true;
+    }
+
+    // Stop Tran токен и един байт преди сигнала за зает
+    uint8_t stop[2] = {0xFD, 0xFF};
+    spi_write_blocking(SPI_PORT, stop, 2);
+    sd_release_busy();
+    sd_complete(true);
+    return false;
+}
+
+bool sd_card_submit(sd_request_t *req) {
+    if (!req || !req->buffer || sd_current) {
+        return false;
+    }
+
+    req->busy = true;
+    req->ok = false;
+    req->attempts = 0;
+    sd_current = req;
+    sd_begin_command();
+    sd_start = time_us_32();
+
+    sd_card_task();
+    return true;
+}
+
+// Придвижване на текущата заявка, докато не се наложи изчакване
+void sd_card_task(void) {
+    bool progress = true;
+    while (sd_current && progress) {
+        switch (sd_state) {
+            case SD_STATE_RETRY:
+                if (!sd_time_reached(sd_deadline)) {
+                    return;
+                }
+                log_event(LOG_SD_RETRY, sd_current->attempts + 1, sd_current->block);
+                sd_begin_command();
+                break;
+            case SD_STATE_WAIT_READY:
+                progress = sd_step_wait_ready();
+                break;
+            case SD_STATE_COMMAND:
+                progress = sd_step_command();
+                break;
+            case SD_STATE_WAIT_TOKEN:
+                progress = sd_step_wait_token();
+                break;
+            case SD_STATE_DATA:
+                progress = sd_step_data();
+                break;
+            case SD_STATE_DATA_END:
+                progress = sd_step_data_end();
+                break;
+            case SD_STATE_WAIT_BUSY:
+                progress = sd_step_wait_busy();
+                break;
+            default:
+                sd_complete(false);
+                return;
+        }
+    }
+}
+
+bool sd_card_busy(void) {
+    return sd_current != NULL;
+}
+
+void sd_card_set_wait_hook(sd_wait_hook_t hook) {
+    sd_wait_hook = hook;
+}
+
+bool sd_card_suspect(void) {
+    return sd_suspect;
+}
+
+bool sd_card_crc_enabled(void) {
+    return sd_crc_on;
+}
+
+uint32_t sd_card_crc_errors(void) {
+    return sd_crc_errors;
+}
+
+uint32_t sd_card_clock_hz(void) {
+    return spi_get_baudrate(SPI_PORT);
+}
+
+bool sd_card_detect_available(void) {
+    return gpio_config.sd_detect != GPIO_NONE;
+}
+
+// Състояние на card-detect ключа (без ключ картата се приема за поставена)
+bool sd_card_detected(void) {
+    if (!sd_card_detect_available()) {
+        return true;
+    }
+    return !gpio_get(gpio_config.sd_detect);
+}
+
+// Една стъпка на синхронното изчакване
+static void sd_card_wait(void) {
+    sd_card_task();
+    if (sd_current && sd_wait_hook && !sd_in_wait_hook) {
+        sd_in_wait_hook = true;
+        sd_wait_hook();
+        sd_in_wait_hook = false;
+    }
+}
+
+// Синхронно изпълнение на заявка (FatFS няма асинхронен интерфейс)
+static bool sd_card_run(sd_request_t *req) {
+    // Чакащата асинхронна заявка се довършва първо
+    while (sd_current) {
+        sd_card_wait();
+    }
+    if (!sd_card_submit(req)) {
+        return false;
+    }
+    while (req->busy) {
+        sd_card_wait();
+    }
+    return req->ok;
+}
+
+// Четене на блок от SD карта (512 байта)
+bool sd_read_block(uint32_t block_addr, uint8_t *buffer) {
+    sd_request_t req = {
+        .op = SD_OP_READ,
+        .block = block_addr,
+        .buffer = buffer
+    };
+    return sd_card_run(&req);
+}
+
+// Запис на блок в SD карта (512 байта)
+bool sd_write_block(uint32_t block_addr, const uint8_t *buffer) {
+    return sd_write_blocks(block_addr, buffer, 1);
+}
+
+// Запис на поредни блокове - с една CMD25 вместо count пъти CMD24
+bool sd_write_blocks(uint32_t block_addr, const uint8_t *buffer, uint16_t count) {
+    sd_request_t req = {
+        .op = SD_OP_WRITE,
+        .block = block_addr,
+        .buffer = (uint8_t *)buffer,
+        .count = count
+    };
+    return sd_card_run(&req);
+}
+
+// Изчакване на края на програмирането на последния запис (CTRL_SYNC)
+bool sd_card_sync(void) {
+    while (sd_current) {
+        sd_card_wait();
+    }
+    while (sd_busy_pending && !sd_poll_ready()) {
+        if (sd_wait_hook && !sd_in_wait_hook) {
+            sd_in_wait_hook = true;
+            sd_wait_hook();
+            sd_in_wait_hook = false;
+        }
+    }
+    return !sd_busy_failed;
+}
@@ -0,0 +1,88 @@
+/*
+ * SD карта в SPI режим
+ *
+ * Четенето и записът на блок минават през машина на състоянията
+ * (команда, старт токен, данни, зает), която се движи от sd_card_task()
+ * и никога не спи: изчакванията са с краен срок, а повторните опити
+ * се насрочват за по-късно. Заявката завършва с callback.
+ * След запис CS се освобождава, докато картата програмира блока -
+ * готовността се проверява при следващия достъп до картата.
+ * sd_read_block/sd_write_block (за FatFS) движат същата машина до край.
+ */
+
+#ifndef SD_CARD_H
+#define SD_CARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SD_BLOCK_SIZE 512
+#define SD_MAX_ATTEMPTS 5                // Опити за една заявка
+#define SD_RETRY_DELAY_US 20000          // Пауза преди повторен опит (+10 ms на всеки следващ)
+#define SD_CRC_RETRY_DELAY_US 50000      // Пауза след грешка в CRC на командата (R1 = 0x04)
+#define SD_TOKEN_TIMEOUT_US 100000       // Краен срок за старт токена при четене
+#define SD_BUSY_TIMEOUT_US 500000        // Краен срок за програмиране на блок
+#define SD_DMA_TIMEOUT_US 50000          // Краен срок за DMA на блока (10 ms при 400 kHz)
+#define SD_POLL_BYTES 16                 // Байтове, проверявани за токен/зает на извикване
+
+// CRC режим (CMD59): командите носят CRC7, блоковете - CRC16, а блок с грешен
+// CRC16 се чете наново. Само с включен CRC шината работи на пълна скорост.
+#define SD_CRC_ENABLE 1
+#define SD_SPI_INIT_HZ 400000            // Инициализация
+#define SD_SPI_SAFE_HZ 10000000          // Без CRC
+#define SD_SPI_FAST_HZ 25000000          // С CRC (SPI делителят дава най-близката по-ниска честота)
+
+typedef enum {
+    SD_OP_READ = 0,
+    SD_OP_WRITE
+} sd_op_t;
+
+typedef struct sd_request sd_request_t;
+typedef void (*sd_done_t)(sd_request_t *req, bool ok);
+
+struct sd_request {
+    sd_op_t op;
+    uint32_t block;                  // Номер на блока (512 байта)
+    uint8_t *buffer;                 // count * SD_BLOCK_SIZE байта
+    uint16_t count;                  // Блокове при запис (0/1 = CMD24, повече = ACMD23 + CMD25)
+    sd_done_t done;                  // Извиква се при завършване (може да е NULL)
+    void *context;                   // За извикващия
+    // Попълват се от драйвера
+    volatile bool busy;
+    bool ok;
+    uint8_t attempts;
+};
+
+// Функция, извиквана докато синхронна операция чака картата.
+// Не трябва да използва SD картата.
+typedef void (*sd_wait_hook_t)(void);
+
+// Инициализация
+void sd_spi_init(void);
+bool sd_init(void);
+
+// Асинхронни заявки (една наведнъж)
+bool sd_card_submit(sd_request_t *req);
+void sd_card_task(void);
+bool sd_card_busy(void);
+void sd_card_set_wait_hook(sd_wait_hook_t hook);
+
+// Синхронни операции (FatFS)
+bool sd_read_block(uint32_t block_addr, uint8_t *buffer);
+bool sd_write_block(uint32_t block_addr, const uint8_t *buffer);
+bool sd_write_blocks(uint32_t block_addr, const uint8_t *buffer, uint16_t count);
+bool sd_card_sync(void);
+bool sd_check_ready(void);
+bool sd_check_presence(bool initialized);
+
+// CRC
+bool sd_card_crc_enabled(void);
+uint32_t sd_card_crc_errors(void);
+uint32_t sd_card_clock_hz(void);
+
+// Наличност на картата без команди по шината
+bool sd_card_suspect(void);
+bool sd_card_detect_available(void);
+bool sd_card_detected(void);
+
+#endif // SD_CARD_H
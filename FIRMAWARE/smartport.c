@@ -0,0 +1,459 @@
+/*
+ * SmartPort блоково устройство
+ *
+ * Сигнали по шината (същите пинове като при Disk II):
+ *   PH1 + PH3  - шината е активна
+ *   PH0 + PH2  - нулиране на шината (адресите се губят)
+ *   PH0        - REQ от хоста
+ *   WRITE_DATA - пакети от хоста
+ *   READ_DATA  - пакети към хоста
+ *   WRITE_PROTECT - ACK към хоста (ниско = потвърждение)
+ *
+ * Всяко устройство (drive) е отделен том - блоковете се четат от
+ * заредения в него имидж по 512 байта.
+ */
+
+#include "smartport.h"
+#include "smartport_packet.h"
+#include "disk_manager.h"
+#include "drive.h"
+#include "log.h"
+#include "smartport.pio.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <string.h>
+
+extern disk_manager_t disk_manager;
+
+static PIO sp_pio_tx;
+static PIO sp_pio_rx;
+static uint sp_sm_tx = 0;
+static uint sp_sm_rx = 0;
+static uint sp_offset_rx = 0;
+static bool sp_ready = false;
+static bool sp_enabled = false;
+static bool sp_in_reset = false;
+
+static uint8_t sp_unit_ids[SP_UNIT_COUNT];   // Адрес, даден от хоста с INIT (0 = няма)
+static smartport_stats_t sp_stats;
+
+// Буфери (един пакет в движение)
+static uint8_t sp_wire[SP_PACKET_MAX_ENCODED];
+static sp_packet_t sp_packet;
+
+// ============================================================================
+// Сигнали по шината
+// ============================================================================
+
+static inline bool sp_req(void) {
+    return gpio_get(gpio_config.ph0);
+}
+
+static inline void sp_ack(bool asserted) {
+    gpio_put(gpio_config.write_protect, asserted ? 0 : 1);
+}
+
+// Чакане REQ да стане level (false при изтичане на времето)
+static bool sp_wait_req(bool level) {
+    uint32_t start = time_us_32();
+    while (sp_req() != level) {
+        if (time_us_32() - start > SP_PACKET_TIMEOUT_US) {
+            sp_stats.errors++;
+            return false;
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// Приемане и изпращане на пакети
+// ============================================================================
+
+// Приемане на пакет докато REQ е активен
+// Байтовете се отделят както при Disk II - байтът е готов, когато старшият бит стане 1
+static uint16_t sp_receive(uint8_t *buf, uint16_t size) {
+    pio_sm_set_enabled(sp_pio_rx, sp_sm_rx, false);
+    pio_sm_clear_fifos(sp_pio_rx, sp_sm_rx);
+    pio_sm_restart(sp_pio_rx, sp_sm_rx);
+    pio_sm_exec(sp_pio_rx, sp_sm_rx, pio_encode_jmp(sp_offset_rx));
+    pio_sm_set_enabled(sp_pio_rx, sp_sm_rx, true);
+
+    uint32_t start = time_us_32();
+    uint16_t len = 0;
+    uint8_t shift = 0;
+
+    while (sp_req() && time_us_32() - start < SP_PACKET_TIMEOUT_US) {
+        if (pio_sm_is_rx_fifo_empty(sp_pio_rx, sp_sm_rx)) {
+            continue;
+        }
+
+        uint32_t word = pio_sm_get(sp_pio_rx, sp_sm_rx);
+        for (int8_t b = 31; b >= 0; b--) {
+            shift = (shift << 1) | ((word >> b) & 1);
+            if (!(shift & 0x80)) {
+                continue;
+            }
+
+            // Пакетът започва от PBEGIN (синхронизацията се пропуска)
+            if (len > 0 || shift == SP_PACKET_BEGIN) {
+                buf[len++] = shift;
+                if (shift == SP_PACKET_END || len >= size) {
+                    pio_sm_set_enabled(sp_pio_rx, sp_sm_rx, false);
+                    return len;
+                }
+            }
+            shift = 0;
+        }
+    }
+
+    pio_sm_set_enabled(sp_pio_rx, sp_sm_rx, false);
+    sp_stats.errors++;
+    return 0;
+}
+
+// Изпращане на пакета от sp_packet (хостът трябва вече да е вдигнал REQ)
+static void sp_send(void) {
+    uint16_t len = sp_packet_encode(&sp_packet, sp_wire, sizeof(sp_wire));
+
+    pio_sm_clear_fifos(sp_pio_tx, sp_sm_tx);
+    for (uint16_t i = 0; i < len; i++) {
+        pio_sm_put_blocking(sp_pio_tx, sp_sm_tx, (uint32_t)sp_wire[i] << 24);
+    }
+
+    // Изчакване последният байт да излезе (8 бита по 4 µs)
+    while (!pio_sm_is_tx_fifo_empty(sp_pio_tx, sp_sm_tx)) {
+        tight_loop_contents();
+    }
+    sleep_us(40);
+}
+
+// Отговор към хоста: ACK готов -> REQ -> пакет -> ACK -> край на REQ
+static void sp_reply(uint8_t dest, uint8_t source) {
+    sp_packet.dest = dest;
+    sp_packet.source = source;
+    sp_packet.aux = 0;
+
+    sp_ack(false);
+    if (!sp_wait_req(true)) {
+        return;
+    }
+    sp_send();
+    sp_ack(true);
+    sp_wait_req(false);
+    sp_ack(false);
+}
+
+// ============================================================================
+// Томове
+// ============================================================================
+
+// Имиджът на тома - само .po/.hdv (ProDOS блоковете са подред)
+// .dsk е в реда на секторите на DOS 3.3 и ProDOS не би го прочел като блокове - томът е офлайн
+static disk_image_t* sp_volume(uint8_t unit) {
+    disk_image_t *image = disk_manager_get_image(&disk_manager, unit);
+    return (image && image->loaded && image->block_order) ? image : NULL;
+}
+
+static uint32_t sp_block_count(uint8_t unit) {
+    disk_image_t *image = sp_volume(unit);
+    return image ? image->file_size / SP_BLOCK_SIZE : 0;
+}
+
+static uint8_t sp_find_unit(uint8_t id) {
+    for (uint8_t i = 0; i < SP_UNIT_COUNT; i++) {
+        if (sp_unit_ids[i] != 0 && sp_unit_ids[i] == id) {
+            return i;
+        }
+    }
+    return SP_UNIT_COUNT;
+}
+
+// Общ статус: блоково, четене/запис, форматиране, онлайн, защита от запис
+static uint8_t sp_general_status(uint8_t unit) {
+    uint8_t status = 0xA8;                       // Блоково, четене, форматиране
+    if (!drive_get(unit)->write_protected) {
+        status |= 0x40;
+    } else {
+        status |= 0x04;
+    }
+    if (sp_block_count(unit) > 0) {
+        status |= 0x10;
+    }
+    return status;
+}
+
+// Отговор на STATUS (код 0 - статус, код 3 - описание на устройството)
+static uint8_t sp_status(uint8_t unit, uint8_t code) {
+    uint32_t blocks = sp_block_count(unit);
+    uint8_t *data = sp_packet.data;
+
+    if (code != 0 && code != 3) {
+        sp_packet.length = 0;
+        return SP_ERR_BAD_COMMAND;
+    }
+
+    data[0] = sp_general_status(unit);
+    data[1] = blocks & 0xFF;
+    data[2] = (blocks >> 8) & 0xFF;
+    data[3] = (blocks >> 16) & 0xFF;
+    sp_packet.length = 4;
+
+    if (code == 3) {
+        // Име (до 16 знака, допълнено с интервали), тип, подтип, версия
+        char name[17];
+        snprintf(name, sizeof(name), "FLOPPY PICO %d", unit + 1);
+        data[4] = strlen(name);
+        memset(&data[5], ' ', 16);
+        memcpy(&data[5], name, strlen(name));
+        data[21] = 0x02;                         // Твърд диск
+        data[22] = 0x00;                         // Сменяем носител
+        data[23] = 0x00;
+        data[24] = 0x01;                         // Версия 1.0
+        sp_packet.length = 25;
+    }
+    return SP_OK;
+}
+
+static uint8_t sp_read_block(uint8_t unit, uint32_t block, uint8_t *data) {
+    disk_image_t *image = sp_volume(unit);
+    UINT bytes_read;
+
+    if (!image) {
+        return SP_ERR_OFFLINE;
+    }
+    if (block >= sp_block_count(unit)) {
+        return SP_ERR_BAD_BLOCK;
+    }
+
+    // Подравнено четене на цял сектор - FatFS чете направо в буфера през sd_read_block
+    if (f_lseek(&image->file_handle, (FSIZE_t)block * SP_BLOCK_SIZE) != FR_OK ||
+        f_read(&image->file_handle, data, SP_BLOCK_SIZE, &bytes_read) != FR_OK ||
+        bytes_read != SP_BLOCK_SIZE) {
+        log_event(LOG_SP_READ_FAIL, unit + 1, block);
+        return SP_ERR_IO;
+    }
+
+    sp_stats.blocks_read++;
+    return SP_OK;
+}
+
+static uint8_t sp_write_block(uint8_t unit, uint32_t block, const uint8_t *data) {
+    disk_image_t *image = sp_volume(unit);
+    UINT bytes_written;
+
+    if (!image) {
+        return SP_ERR_OFFLINE;
+    }
+    if (drive_get(unit)->write_protected) {
+        return SP_ERR_WRITE_PROTECT;
+    }
+    if (block >= sp_block_count(unit)) {
+        return SP_ERR_BAD_BLOCK;
+    }
+
+    if (f_lseek(&image->file_handle, (FSIZE_t)block * SP_BLOCK_SIZE) != FR_OK ||
+        f_write(&image->file_handle, data, SP_BLOCK_SIZE, &bytes_written) != FR_OK ||
+        bytes_written != SP_BLOCK_SIZE) {
+        log_event(LOG_SP_WRITE_FAIL, unit + 1, block);
+        return SP_ERR_IO;
+    }
+    f_sync(&image->file_handle);
+
+    sp_stats.blocks_written++;
+    return SP_OK;
+}
+
+// ============================================================================
+// Обработка на команди
+// ============================================================================
+
+static void sp_handle_command(void) {
+    uint8_t host = sp_packet.source;
+    uint8_t id = sp_packet.dest;
+    uint8_t command = sp_packet.data[0] & 0x7F;
+    uint8_t unit;
+
+    if (command == SP_CMD_INIT) {
+        // Адресът се дава на първия том без адрес
+        unit = sp_find_unit(id);
+        for (uint8_t i = 0; i < SP_UNIT_COUNT && unit == SP_UNIT_COUNT; i++) {
+            if (sp_unit_ids[i] == 0) {
+                sp_unit_ids[i] = id;
+                unit = i;
+            }
+        }
+    } else {
+        unit = sp_find_unit(id);
+    }
+
+    // Пакетът не е за нас
+    if (unit == SP_UNIT_COUNT || sp_packet.type != SP_TYPE_COMMAND) {
+        sp_wait_req(false);
+        return;
+    }
+
+    // Потвърждение на командата
+    sp_ack(true);
+    if (!sp_wait_req(false)) {
+        sp_ack(false);
+        return;
+    }
+
+    sp_stats.commands++;
+    uint32_t block = sp_packet.data[4] | ((uint32_t)sp_packet.data[5] << 8) | ((uint32_t)sp_packet.data[6] << 16);
+    uint8_t status = SP_OK;
+
+    switch (command) {
+        case SP_CMD_INIT:
+            // Последният том в веригата отговаря с 0x7F
+            log_event(LOG_SP_INIT, unit + 1, id);
+            sp_packet.length = 0;
+            status = (unit == SP_UNIT_COUNT - 1) ? 0x7F : SP_OK;
+            break;
+
+        case SP_CMD_STATUS:
+            status = sp_status(unit, sp_packet.data[4]);
+            break;
+
+        case SP_CMD_READBLOCK:
+            status = sp_read_block(unit, block, sp_packet.data);
+            sp_packet.type = SP_TYPE_DATA;
+            sp_packet.length = (status == SP_OK) ? SP_BLOCK_SIZE : 0;
+            sp_packet.status = status;
+            sp_reply(host, id);
+            return;
+
+        case SP_CMD_WRITEBLOCK:
+            // Хостът изпраща блока в отделен пакет с данни
+            sp_ack(false);
+            if (!sp_wait_req(true)) {
+                return;
+            }
+            {
+                uint16_t len = sp_receive(sp_wire, sizeof(sp_wire));
+                if (len == 0 || !sp_packet_decode(sp_wire, len, &sp_packet) ||
+                    sp_packet.type != SP_TYPE_DATA || sp_packet.length != SP_BLOCK_SIZE) {
+                    sp_stats.errors++;
+                    return;
+                }
+            }
+            sp_ack(true);
+            sp_wait_req(false);
+            status = sp_write_block(unit, block, sp_packet.data);
+            sp_packet.length = 0;
+            break;
+
+        case SP_CMD_FORMAT:
+        case SP_CMD_CONTROL:
+            // Томът вече е форматиран; контролни команди няма
+            sp_packet.length = 0;
+            break;
+
+        default:
+            sp_packet.length = 0;
+            status = SP_ERR_BAD_COMMAND;
+            break;
+    }
+
+    sp_packet.type = SP_TYPE_STATUS;
+    sp_packet.status = status;
+    sp_reply(host, id);
+}
+
+// ============================================================================
+// Публични функции
+// ============================================================================
+
+bool smartport_init(PIO pio_tx, PIO pio_rx) {
+    if (!pio_can_add_program(pio_tx, &smartport_tx_program) ||
+        !pio_can_add_program(pio_rx, &smartport_rx_program)) {
+        printf("ГРЕШКА: Не може да се добавят SmartPort PIO програмите\n");
+        return false;
+    }
+
+    sp_pio_tx = pio_tx;
+    sp_pio_rx = pio_rx;
+    sp_sm_tx = pio_claim_unused_sm(pio_tx, true);
+    sp_sm_rx = pio_claim_unused_sm(pio_rx, true);
+
+    uint offset_tx = pio_add_program(pio_tx, &smartport_tx_program);
+    sp_offset_rx = pio_add_program(pio_rx, &smartport_rx_program);
+    smartport_tx_program_init(pio_tx, sp_sm_tx, offset_tx, gpio_config.read_data);
+    smartport_rx_program_init(pio_rx, sp_sm_rx, sp_offset_rx, gpio_config.write_data);
+
+    memset(sp_unit_ids, 0, sizeof(sp_unit_ids));
+    memset(&sp_stats, 0, sizeof(sp_stats));
+    sp_ready = true;
+
+    printf("SmartPort PIO инициализиран (TX SM %d, RX SM %d)\n", sp_sm_tx, sp_sm_rx);
+    return true;
+}
+
+// Включване/изключване на SmartPort режима
+// Disk II машините (READ_DATA/WRITE_DATA) се спират от извикващия
+void smartport_set_enabled(bool enabled) {
+    if (!sp_ready || enabled == sp_enabled) {
+        return;
+    }
+
+    sp_enabled = enabled;
+    memset(sp_unit_ids, 0, sizeof(sp_unit_ids));
+    pio_sm_set_enabled(sp_pio_rx, sp_sm_rx, false);
+    pio_sm_set_enabled(sp_pio_tx, sp_sm_tx, enabled);
+    sp_ack(false);
+
+    printf("SmartPort режим %s\n", enabled ? "ВКЛЮЧЕН" : "ИЗКЛЮЧЕН");
+}
+
+bool smartport_enabled(void) {
+    return sp_enabled;
+}
+
+// Обслужване на шината от главния цикъл
+// Транзакцията с хоста се довършва в едно извикване
+void smartport_poll(void) {
+    if (!sp_enabled) {
+        return;
+    }
+
+    bool ph0 = gpio_get(gpio_config.ph0);
+    bool ph1 = gpio_get(gpio_config.ph1);
+    bool ph2 = gpio_get(gpio_config.ph2);
+    bool ph3 = gpio_get(gpio_config.ph3);
+
+    // Нулиране на шината - хостът ще раздаде адресите отново
+    if (ph0 && ph2 && !ph1 && !ph3) {
+        if (!sp_in_reset) {
+            memset(sp_unit_ids, 0, sizeof(sp_unit_ids));
+            log_event(LOG_SP_RESET, sp_stats.commands, 0);
+        }
+        sp_in_reset = true;
+        return;
+    }
+    sp_in_reset = false;
+
+    // Команда: шината е активна и хостът е вдигнал REQ
+    if (!(ph1 && ph3) || !ph0) {
+        return;
+    }
+
+    uint16_t len = sp_receive(sp_wire, sizeof(sp_wire));
+    if (len == 0 || !sp_packet_decode(sp_wire, len, &sp_packet)) {
+        // Без ACK хостът повтаря командата
+        if (len != 0) {
+            sp_stats.errors++;
+        }
+        sp_wait_req(false);
+        return;
+    }
+
+    sp_handle_command();
+}
+
+uint8_t smartport_unit_id(uint8_t unit) {
+    return (unit < SP_UNIT_COUNT) ? sp_unit_ids[unit] : 0;
+}
+
+const smartport_stats_t* smartport_get_stats(void) {
+    return &sp_stats;
+}
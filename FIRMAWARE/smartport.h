@@ -0,0 +1,50 @@
+/*
+ * SmartPort блоково устройство (ProDOS томове .po/.hdv)
+ */
+
+#ifndef SMARTPORT_H
+#define SMARTPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/pio.h"
+#include "config.h"
+
+#define SP_UNIT_COUNT DRIVE_COUNT    // Всяко устройство е отделен SmartPort том
+#define SP_BLOCK_SIZE 512
+
+// Команди
+#define SP_CMD_STATUS 0x00
+#define SP_CMD_READBLOCK 0x01
+#define SP_CMD_WRITEBLOCK 0x02
+#define SP_CMD_FORMAT 0x03
+#define SP_CMD_CONTROL 0x04
+#define SP_CMD_INIT 0x05
+
+// Кодове за грешка
+#define SP_OK 0x00
+#define SP_ERR_BAD_COMMAND 0x01
+#define SP_ERR_IO 0x27
+#define SP_ERR_NO_DEVICE 0x28
+#define SP_ERR_WRITE_PROTECT 0x2B
+#define SP_ERR_BAD_BLOCK 0x2D
+#define SP_ERR_OFFLINE 0x2F
+
+#define SP_PACKET_TIMEOUT_US 100000  // Максимално чакане на хоста по време на транзакция
+
+typedef struct {
+    uint32_t commands;
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t errors;                 // Повредени пакети и изтекли времена
+} smartport_stats_t;
+
+// Функции
+bool smartport_init(PIO pio_tx, PIO pio_rx);
+void smartport_set_enabled(bool enabled);
+bool smartport_enabled(void);
+void smartport_poll(void);
+uint8_t smartport_unit_id(uint8_t unit);
+const smartport_stats_t* smartport_get_stats(void);
+
+#endif // SMARTPORT_H
@@ -0,0 +1,146 @@
+/*
+ * Кодиране и декодиране на пакети от SmartPort шината
+ *
+ * По шината всеки байт има старши бит 1. Данните се изпращат като
+ * "нечетни" байтове (length % 7) и групи по 7 байта; пред всяка част
+ * стои байт със старшите битове на байтовете след него.
+ */
+
+#include "smartport_packet.h"
+#include <string.h>
+
+// Синхронизиращи байтове пред всеки пакет
+static const uint8_t sp_sync[SP_SYNC_LEN] = { 0xFF, 0x3F, 0xCF, 0xF3, 0xFC, 0xFF };
+
+// Байт със старшите битове на count байта (първият байт е в бит 6)
+static uint8_t sp_msb_byte(const uint8_t *data, uint8_t count) {
+    uint8_t msb = 0x80;
+    for (uint8_t i = 0; i < count; i++) {
+        msb |= (data[i] >> 7) << (6 - i);
+    }
+    return msb;
+}
+
+uint16_t sp_packet_encode(const sp_packet_t *packet, uint8_t *out, uint16_t out_size) {
+    if (packet->length > SP_MAX_DATA || out_size < SP_PACKET_MAX_ENCODED) {
+        return 0;
+    }
+
+    uint8_t odd_count = packet->length % 7;
+    uint8_t group_count = packet->length / 7;
+    uint16_t pos = 0;
+
+    memcpy(out, sp_sync, SP_SYNC_LEN);
+    pos += SP_SYNC_LEN;
+    out[pos++] = SP_PACKET_BEGIN;
+
+    // Заглавие
+    uint8_t header[SP_HEADER_LEN] = {
+        0x80 | packet->dest,
+        0x80 | packet->source,
+        0x80 | packet->type,
+        0x80 | packet->aux,
+        0x80 | packet->status,
+        0x80 | odd_count,
+        0x80 | group_count
+    };
+    memcpy(out + pos, header, SP_HEADER_LEN);
+    pos += SP_HEADER_LEN;
+
+    // Контролната сума е XOR на данните и на байтовете от заглавието
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < SP_HEADER_LEN; i++) {
+        checksum ^= header[i];
+    }
+    for (uint16_t i = 0; i < packet->length; i++) {
+        checksum ^= packet->data[i];
+    }
+
+    // Нечетни байтове
+    const uint8_t *data = packet->data;
+    if (odd_count > 0) {
+        out[pos++] = sp_msb_byte(data, odd_count);
+        for (uint8_t i = 0; i < odd_count; i++) {
+            out[pos++] = 0x80 | data[i];
+        }
+        data += odd_count;
+    }
+
+    // Групи по 7 байта
+    for (uint8_t g = 0; g < group_count; g++) {
+        out[pos++] = sp_msb_byte(data, 7);
+        for (uint8_t i = 0; i < 7; i++) {
+            out[pos++] = 0x80 | data[i];
+        }
+        data += 7;
+    }
+
+    // Контролна сума - четните и нечетните битове в два байта
+    out[pos++] = checksum | 0xAA;
+    out[pos++] = (checksum >> 1) | 0xAA;
+    out[pos++] = SP_PACKET_END;
+
+    return pos;
+}
+
+// in може да започва със синхронизиращите байтове - пропускат се до PBEGIN
+bool sp_packet_decode(const uint8_t *in, uint16_t len, sp_packet_t *packet) {
+    uint16_t pos = 0;
+
+    while (pos < len && in[pos] != SP_PACKET_BEGIN) {
+        pos++;
+    }
+    pos++;
+    if (pos + SP_HEADER_LEN > len) {
+        return false;
+    }
+
+    const uint8_t *header = in + pos;
+    pos += SP_HEADER_LEN;
+
+    packet->dest = header[0] & 0x7F;
+    packet->source = header[1] & 0x7F;
+    packet->type = header[2] & 0x7F;
+    packet->aux = header[3] & 0x7F;
+    packet->status = header[4] & 0x7F;
+
+    uint8_t odd_count = header[5] & 0x7F;
+    uint8_t group_count = header[6] & 0x7F;
+    if (odd_count >= 7 || (uint16_t)odd_count + group_count * 7 > SP_MAX_DATA) {
+        return false;
+    }
+    packet->length = odd_count + group_count * 7;
+
+    // Данни + контролна сума + PEND
+    uint16_t encoded = (odd_count ? odd_count + 1 : 0) + group_count * 8;
+    if (pos + encoded + 3 > len) {
+        return false;
+    }
+
+    uint8_t *data = packet->data;
+    if (odd_count > 0) {
+        uint8_t msb = in[pos++];
+        for (uint8_t i = 0; i < odd_count; i++) {
+            *data++ = (in[pos++] & 0x7F) | ((msb << (i + 1)) & 0x80);
+        }
+    }
+    for (uint8_t g = 0; g < group_count; g++) {
+        uint8_t msb = in[pos++];
+        for (uint8_t i = 0; i < 7; i++) {
+            *data++ = (in[pos++] & 0x7F) | ((msb << (i + 1)) & 0x80);
+        }
+    }
+
+    uint8_t checksum = (in[pos] & 0x55) | ((in[pos + 1] & 0x55) << 1);
+    if (in[pos + 2] != SP_PACKET_END) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < SP_HEADER_LEN; i++) {
+        checksum ^= header[i];
+    }
+    for (uint16_t i = 0; i < packet->length; i++) {
+        checksum ^= packet->data[i];
+    }
+    return checksum == 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Кодиране и декодиране на пакети от SmartPort шината
+ * Не зависи от Pico SDK - може да се компилира и тества на хоста
+ */
+
+#ifndef SMARTPORT_PACKET_H
+#define SMARTPORT_PACKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SP_PACKET_BEGIN 0xC3         // PBEGIN
+#define SP_PACKET_END 0xC8           // PEND
+#define SP_SYNC_LEN 6                // Синхронизиращи байтове преди PBEGIN
+#define SP_HEADER_LEN 7              // DEST, SRC, TYPE, AUX, STAT, ODDCNT, GRP7CNT
+#define SP_MAX_DATA 512              // Най-големият пакет е един блок
+
+// Максимален размер на кодиран пакет (синхронизация + заглавие + данни + контролна сума)
+#define SP_PACKET_MAX_ENCODED (SP_SYNC_LEN + 1 + SP_HEADER_LEN + 7 + (SP_MAX_DATA / 7) * 8 + 2 + 1)
+
+// Тип на пакета (без старшия бит, който винаги е 1 по шината)
+#define SP_TYPE_COMMAND 0x00
+#define SP_TYPE_STATUS 0x01
+#define SP_TYPE_DATA 0x02
+
+typedef struct {
+    uint8_t dest;                    // Адрес на получателя (0 = хостът)
+    uint8_t source;                  // Адрес на изпращача
+    uint8_t type;                    // SP_TYPE_*
+    uint8_t aux;
+    uint8_t status;                  // Код на грешка в отговорите
+    uint16_t length;                 // Брой байтове в data
+    uint8_t data[SP_MAX_DATA];
+} sp_packet_t;
+
+// Функции
+uint16_t sp_packet_encode(const sp_packet_t *packet, uint8_t *out, uint16_t out_size);
+bool sp_packet_decode(const uint8_t *in, uint16_t len, sp_packet_t *packet);
+
+#endif // SMARTPORT_PACKET_H
@@ -1,50 +1,94 @@
 /*
  * SSD1306 OLED Display Driver Implementation
+ * Изпращане на кадровия буфер по I2C/DMA; изрисуването е в ssd1306_gfx.c
  */
 
 #include "ssd1306.h"
-#include "font_5x7.h"
 #include <string.h>
 #include <stdint.h>
-#include <stdlib.h>
+#include "hardware/dma.h"
+#include "perf.h"
 #include <stdio.h>
 
 static i2c_inst_t *i2c_instance = NULL;
-static uint8_t framebuffer[SSD1306_WIDTH * SSD1306_PAGES];
+
+// Съдържанието на дисплея (за откриване на променените колони)
+static uint8_t shadow[SSD1306_WIDTH * SSD1306_PAGES];
+static uint8_t shadow_valid = 0;                 // Бит на страница - shadow съвпада с дисплея
+
+// Променени колони на всяка страница, чакащи изпращане
+static uint8_t dirty_lo[SSD1306_PAGES];
+static uint8_t dirty_hi[SSD1306_PAGES];
+static uint8_t dirty_pages = 0;                  // Бит на страница
+
+// Една I2C транзакция на страница: команди за прозореца + данни
+// Всяка дума е запис в IC_DATA_CMD (байт + STOP в последната)
+#define SSD1306_TX_COMMANDS 6
+#define SSD1306_TX_WORDS (SSD1306_TX_COMMANDS * 2 + 1 + SSD1306_WIDTH)
+static uint32_t tx_buffer[SSD1306_TX_WORDS];
+static int dma_channel = -1;
+static uint32_t tx_errors = 0;
+static bool flush_active = false;                // Изпращат се страници от едно обновяване
+static uint32_t flush_start = 0;
 
 static void ssd1306_write_command(uint8_t cmd) {
     uint8_t buf[2] = {0x00, cmd};  // Control byte + command
     // Използваме timeout вместо blocking за по-добър контрол
-    //printf("before whrite command\n");
     i2c_write_timeout_us(i2c_instance, SSD1306_I2C_ADDR, buf, 2, false, 1000);
-    //printf("after whrite command\n");
-    // CLI обработка след командата за да не блокираме главния цикъл
-    //extern void cli_process(void);
-    //cli_process();
 }
 
-static void ssd1306_write_data(uint8_t *data, size_t len) {
-    // Разделяме изпращането на по-малки части за да не блокираме твърде дълго
-    const size_t chunk_size = 64;  // Изпращаме по 64 байта наведнъж (по-малко за по-бърза реакция)
-    size_t offset = 0;
-    
-    //extern void cli_process(void);
-    
-    while (offset < len) {
-        size_t current_chunk = (len - offset > chunk_size) ? chunk_size : (len - offset);
-        uint8_t *buf = (uint8_t *)malloc(current_chunk + 1);
-        buf[0] = 0x40;  // Data mode
-        memcpy(buf + 1, data + offset, current_chunk);
-        
-        // Използваме timeout вместо blocking за по-добър контрол
-        i2c_write_timeout_us(i2c_instance, SSD1306_I2C_ADDR, buf, current_chunk + 1, false, 2000);
-        
-        free(buf);
-        offset += current_chunk;
-        
-        // CLI обработка между частите за да не блокираме главния цикъл
-        //cli_process();
+// Дали предишната транзакция е завършила (DMA, FIFO и шината)
+static bool ssd1306_bus_idle(void) {
+    i2c_hw_t *hw = i2c_get_hw(i2c_instance);
+
+    if (dma_channel_is_busy(dma_channel)) {
+        // Без ACK от дисплея I2C изхвърля FIFO - DMA се спира
+        if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+            dma_channel_abort(dma_channel);
+        } else {
+            return false;
+        }
+    }
+    if (!(hw->status & I2C_IC_STATUS_TFE_BITS) || (hw->status & I2C_IC_STATUS_ACTIVITY_BITS)) {
+        return false;
     }
+
+    if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        (void)hw->clr_tx_abrt;
+        tx_errors++;
+        shadow_valid = 0;  // Не знаем какво е стигнало до дисплея
+    }
+    return true;
+}
+
+static uint16_t tx_put_command(uint16_t pos, uint8_t cmd) {
+    tx_buffer[pos++] = 0x80;  // Co = 1: следва един команден байт
+    tx_buffer[pos++] = cmd;
+    return pos;
+}
+
+// Изпращане на колоните lo..hi от страница page (без изчакване)
+static void ssd1306_send_page(uint8_t page, uint8_t lo, uint8_t hi) {
+    uint16_t pos = 0;
+    const uint8_t *src = &ssd1306_framebuffer[page * SSD1306_WIDTH];
+
+    pos = tx_put_command(pos, SSD1306_COLUMNADDR);
+    pos = tx_put_command(pos, lo);
+    pos = tx_put_command(pos, hi);
+    pos = tx_put_command(pos, SSD1306_PAGEADDR);
+    pos = tx_put_command(pos, page);
+    pos = tx_put_command(pos, page);
+    tx_buffer[pos++] = 0x40;  // Data mode до края на транзакцията
+    for (uint16_t x = lo; x <= hi; x++) {
+        tx_buffer[pos++] = src[x];
+    }
+    tx_buffer[pos - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+
+    // Изпратеното вече е на дисплея
+    memcpy(&shadow[page * SSD1306_WIDTH + lo], &src[lo], hi - lo + 1);
+
+    dma_channel_set_read_addr(dma_channel, tx_buffer, false);
+    dma_channel_set_trans_count(dma_channel, pos, true);
 }
 
 void ssd1306_init(i2c_inst_t *i2c, uint8_t sda, uint8_t scl) {
@@ -56,6 +100,15 @@ void ssd1306_init(i2c_inst_t *i2c, uint8_t sda, uint8_t scl) {
     gpio_pull_up(sda);
     gpio_pull_up(scl);
     
+    // DMA канал за кадрите: думи към IC_DATA_CMD по DREQ на I2C TX
+    dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(dma_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_dreq(&c, i2c_get_dreq(i2c, true));
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(dma_channel, &c, &i2c_get_hw(i2c)->data_cmd, tx_buffer, 0, false);
+    
     // Инициализация на дисплея
     ssd1306_write_command(SSD1306_DISPLAYOFF);
     ssd1306_write_command(SSD1306_SETDISPLAYCLOCKDIV);
@@ -85,79 +138,76 @@ void ssd1306_init(i2c_inst_t *i2c, uint8_t sda, uint8_t scl) {
     
     ssd1306_clear();
     ssd1306_update();
+    
+    // Първият кадър се изпраща веднага (адресът на дисплея е зададен от i2c_write)
+    while (ssd1306_busy()) {
+        ssd1306_task();
+    }
 }
 
-void ssd1306_clear(void) {
-    memset(framebuffer, 0, sizeof(framebuffer));
-}
-
+// Откриване на променените колони спрямо дисплея
+// Самото изпращане става от ssd1306_task() - по една страница, без изчакване
 void ssd1306_update(void) {
-    ssd1306_write_command(SSD1306_COLUMNADDR);
-    ssd1306_write_command(0);
-    ssd1306_write_command(SSD1306_WIDTH - 1);
-    ssd1306_write_command(SSD1306_PAGEADDR);
-    ssd1306_write_command(0);
-    ssd1306_write_command(SSD1306_PAGES - 1);
-    ssd1306_write_data(framebuffer, sizeof(framebuffer));
-}
-
-void ssd1306_set_pixel(uint8_t x, uint8_t y, bool on) {
-    if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT) return;
-    
-    uint16_t index = x + (y / 8) * SSD1306_WIDTH;
-    uint8_t bit = y % 8;
-    
-    if (on) {
-        framebuffer[index] |= (1 << bit);
-    } else {
-        framebuffer[index] &= ~(1 << bit);
+    for (uint8_t page = 0; page < SSD1306_PAGES; page++) {
+        const uint8_t *src = &ssd1306_framebuffer[page * SSD1306_WIDTH];
+        const uint8_t *dst = &shadow[page * SSD1306_WIDTH];
+        int16_t lo = 0;
+        int16_t hi = SSD1306_WIDTH - 1;
+        
+        if (shadow_valid & (1 << page)) {
+            while (lo <= hi && src[lo] == dst[lo]) lo++;
+            while (hi >= lo && src[hi] == dst[hi]) hi--;
+            if (lo > hi) {
+                continue;
+            }
+        }
+        shadow_valid |= (1 << page);
+        
+        // Обединяване с вече чакащия диапазон
+        if (dirty_pages & (1 << page)) {
+            if (lo > dirty_lo[page]) lo = dirty_lo[page];
+            if (hi < dirty_hi[page]) hi = dirty_hi[page];
+        }
+        dirty_lo[page] = lo;
+        dirty_hi[page] = hi;
+        dirty_pages |= (1 << page);
     }
+    
+    ssd1306_task();
 }
 
-void ssd1306_draw_char(uint8_t x, uint8_t y, char c) {
-    // Получаване на глиф на символа
-    const uint8_t *glyph = font_get_glyph((uint8_t)c);
-    
-    if (!glyph) {
-        glyph = font_get_glyph('?');  // Fallback на '?'
+// Изпращане на следващата променена страница, ако шината е свободна
+// Извиква се от главния цикъл; никога не чака I2C
+void ssd1306_task(void) {
+    if (dma_channel < 0 || !ssd1306_bus_idle()) {
+        return;
     }
-    
-    // Рисуване на глифа (всеки байт е колона, битовете от долу нагоре)
-    for (int i = 0; i < FONT_WIDTH; i++) {
-        uint8_t column = glyph[i];
-        for (int j = 0; j < FONT_HEIGHT; j++) {
-            bool pixel = (column >> j) & 0x01;
-            ssd1306_set_pixel(x + i, y + j, pixel);
+    if (dirty_pages == 0) {
+        // Последната страница е изпратена - времето на цялото обновяване
+        if (flush_active) {
+            perf_record(PERF_DISPLAY, flush_start);
+            flush_active = false;
         }
+        return;
     }
-}
-
-void ssd1306_draw_string(uint8_t x, uint8_t y, const char *str) {
-    uint8_t pos_x = x;
-    while (*str && pos_x < SSD1306_WIDTH - FONT_WIDTH) {
-        ssd1306_draw_char(pos_x, y, *str++);
-        pos_x += FONT_WIDTH + FONT_CHAR_SPACING;  // Ширина на символа + интервал
+    if (!flush_active) {
+        flush_start = time_us_32();
+        flush_active = true;
     }
-}
-
-void ssd1306_draw_string_scroll(uint8_t x, uint8_t y, const char *str, uint8_t max_width) {
-    size_t len = strlen(str);
-    uint8_t char_width = FONT_WIDTH + FONT_CHAR_SPACING;
     
-    if (len * char_width <= max_width) {
-        ssd1306_draw_string(x, y, str);
-    } else {
-        // Скролиране на текста
-        static uint8_t scroll_pos = 0;
-        char display_str[22];
-        uint8_t chars_to_show = max_width / char_width;
-        if (scroll_pos + chars_to_show > len) {
-            scroll_pos = 0;
+    for (uint8_t page = 0; page < SSD1306_PAGES; page++) {
+        if (dirty_pages & (1 << page)) {
+            dirty_pages &= ~(1 << page);
+            ssd1306_send_page(page, dirty_lo[page], dirty_hi[page]);
+            return;
         }
-        strncpy(display_str, str + scroll_pos, chars_to_show);
-        display_str[chars_to_show] = '\0';
-        ssd1306_draw_string(x, y, display_str);
-        scroll_pos++;
     }
 }
 
+bool ssd1306_busy(void) {
+    return dirty_pages != 0 || (dma_channel >= 0 && !ssd1306_bus_idle());
+}
+
+uint32_t ssd1306_get_errors(void) {
+    return tx_errors;
+}
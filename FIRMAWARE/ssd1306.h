@@ -8,11 +8,9 @@
 
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
+#include "ssd1306_gfx.h"
 
 #define SSD1306_I2C_ADDR 0x3C
-#define SSD1306_WIDTH 128
-#define SSD1306_HEIGHT 64
-#define SSD1306_PAGES (SSD1306_HEIGHT / 8)
 
 // Команди
 #define SSD1306_SETCONTRAST 0x81
@@ -43,12 +41,10 @@
 
 // Функции
 void ssd1306_init(i2c_inst_t *i2c, uint8_t sda, uint8_t scl);
-void ssd1306_clear(void);
 void ssd1306_update(void);
-void ssd1306_set_pixel(uint8_t x, uint8_t y, bool on);
-void ssd1306_draw_char(uint8_t x, uint8_t y, char c);
-void ssd1306_draw_string(uint8_t x, uint8_t y, const char *str);
-void ssd1306_draw_string_scroll(uint8_t x, uint8_t y, const char *str, uint8_t max_width);
+void ssd1306_task(void);
+bool ssd1306_busy(void);
+uint32_t ssd1306_get_errors(void);
 
 #endif // SSD1306_H
 
@@ -0,0 +1,195 @@
+/*
+ * Кадров буфер на SSD1306 и изрисуване на текст
+ *
+ * Текстът се пише по колони от глифовете (една колона = до два байта в
+ * буфера), а изрисуваните редове се пазят в малък кеш - менюто рисува
+ * едни и същи редове на всеки кадър.
+ */
+
+#include "ssd1306_gfx.h"
+#include "font_5x7.h"
+#include <string.h>
+
+uint8_t ssd1306_framebuffer[SSD1306_WIDTH * SSD1306_PAGES];
+
+void ssd1306_clear(void) {
+    memset(ssd1306_framebuffer, 0, sizeof(ssd1306_framebuffer));
+}
+
+void ssd1306_set_pixel(uint8_t x, uint8_t y, bool on) {
+    if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT) return;
+    
+    uint16_t index = x + (y / 8) * SSD1306_WIDTH;
+    uint8_t bit = y % 8;
+    
+    if (on) {
+        ssd1306_framebuffer[index] |= (1 << bit);
+    } else {
+        ssd1306_framebuffer[index] &= ~(1 << bit);
+    }
+}
+
+// Запис на колона от height пиксела (бит 0 = горе) на позиция x, y
+// Страниците са по 8 реда - при y, което не е кратно на 8, колоната се разделя на две
+static inline void ssd1306_blit_column(uint8_t x, uint8_t y, uint8_t bits, uint8_t height) {
+    uint8_t page = y >> 3;
+    uint8_t shift = y & 7;
+    uint16_t mask = ((1u << height) - 1) << shift;
+    uint16_t data = ((uint16_t)bits << shift) & mask;  // Бит 7 на глифа не е част от символа
+    uint8_t *dst = &ssd1306_framebuffer[page * SSD1306_WIDTH + x];
+
+    dst[0] = (dst[0] & ~(uint8_t)mask) | (uint8_t)data;
+    if ((mask >> 8) && page + 1 < SSD1306_PAGES) {
+        dst[SSD1306_WIDTH] = (dst[SSD1306_WIDTH] & ~(uint8_t)(mask >> 8)) | (uint8_t)(data >> 8);
+    }
+}
+
+// Запис на поредица колони (един ред текст)
+static void ssd1306_blit_columns(uint8_t x, uint8_t y, const uint8_t *columns, uint8_t count) {
+    if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT) {
+        return;
+    }
+    if (count > SSD1306_WIDTH - x) {
+        count = SSD1306_WIDTH - x;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        ssd1306_blit_column(x + i, y, columns[i], FONT_HEIGHT);
+    }
+}
+
+// Глиф на символа ('?' за неподдържаните)
+static const uint8_t* ssd1306_glyph(char c) {
+    const uint8_t *glyph = font_get_glyph((uint8_t)c);
+    return glyph ? glyph : font_get_glyph('?');
+}
+
+// ============================================================================
+// Кеш на изрисувани редове
+// ============================================================================
+
+// Изрисуваните колони на ред текст (без позицията); намира се по хеш + текста
+typedef struct {
+    uint32_t hash;
+    char text[SSD1306_LINE_MAX_CHARS + 1];
+    uint8_t width;                               // Брой колони
+    uint8_t age;                                 // За подмяна на най-стария запис
+    uint8_t columns[SSD1306_LINE_MAX_CHARS * (FONT_WIDTH + FONT_CHAR_SPACING)];
+} line_cache_entry_t;
+
+static line_cache_entry_t line_cache[SSD1306_LINE_CACHE_SIZE];
+static uint8_t line_cache_clock = 0;
+static uint32_t line_cache_hits = 0;
+static uint32_t line_cache_misses = 0;
+
+// FNV-1a над видимата част от текста
+static uint32_t line_hash(const char *str, uint8_t *len) {
+    uint32_t hash = 2166136261u;
+    uint8_t n = 0;
+    while (str[n] && n < SSD1306_LINE_MAX_CHARS) {
+        hash = (hash ^ (uint8_t)str[n]) * 16777619u;
+        n++;
+    }
+    *len = n;
+    return hash;
+}
+
+static const line_cache_entry_t* line_cache_get(const char *str) {
+    uint8_t len;
+    uint32_t hash = line_hash(str, &len);
+    line_cache_entry_t *victim = &line_cache[0];
+
+    line_cache_clock++;
+    for (uint8_t i = 0; i < SSD1306_LINE_CACHE_SIZE; i++) {
+        line_cache_entry_t *e = &line_cache[i];
+        if (e->width > 0 && e->hash == hash &&
+            strncmp(e->text, str, len) == 0 && e->text[len] == '\0') {
+            e->age = line_cache_clock;
+            line_cache_hits++;
+            return e;
+        }
+        // Празен запис или най-дълго неизползваният
+        if (victim->width != 0 &&
+            (e->width == 0 || (uint8_t)(line_cache_clock - e->age) > (uint8_t)(line_cache_clock - victim->age))) {
+            victim = e;
+        }
+    }
+
+    // Изрисуване на реда - колоните на всеки символ + празна колона
+    line_cache_misses++;
+    victim->hash = hash;
+    memcpy(victim->text, str, len);
+    victim->text[len] = '\0';
+    victim->age = line_cache_clock;
+
+    uint8_t *out = victim->columns;
+    for (uint8_t i = 0; i < len; i++) {
+        memcpy(out, ssd1306_glyph(str[i]), FONT_WIDTH);
+        out += FONT_WIDTH;
+        memset(out, 0, FONT_CHAR_SPACING);
+        out += FONT_CHAR_SPACING;
+    }
+    victim->width = out - victim->columns;
+    return victim;
+}
+
+void ssd1306_line_cache_stats(uint32_t *hits, uint32_t *misses) {
+    *hits = line_cache_hits;
+    *misses = line_cache_misses;
+}
+
+void ssd1306_draw_char(uint8_t x, uint8_t y, char c) {
+    // Всеки байт от глифа е колона, битовете от горе надолу
+    ssd1306_blit_columns(x, y, ssd1306_glyph(c), FONT_WIDTH);
+}
+
+void ssd1306_draw_string(uint8_t x, uint8_t y, const char *str) {
+    if (x >= SSD1306_WIDTH - FONT_WIDTH || *str == '\0') {
+        return;
+    }
+
+    // Символите, които започват преди SSD1306_WIDTH - FONT_WIDTH
+    uint8_t char_width = FONT_WIDTH + FONT_CHAR_SPACING;
+    uint8_t max_chars = (SSD1306_WIDTH - FONT_WIDTH - x + char_width - 1) / char_width;
+
+    const line_cache_entry_t *line = line_cache_get(str);
+    uint8_t count = line->width;
+    if (count > max_chars * char_width) {
+        count = max_chars * char_width;
+    }
+    ssd1306_blit_columns(x, y, line->columns, count - FONT_CHAR_SPACING);
+}
+
+// Текст в прозорец от max_width пиксела, отместен с offset пиксела (бягащ ред)
+// Всеки ред пази собственото си отместване - текстът се повтаря след празнина
+void ssd1306_draw_string_scroll(uint8_t x, uint8_t y, const char *str, uint8_t max_width, uint16_t offset) {
+    uint8_t char_width = FONT_WIDTH + FONT_CHAR_SPACING;
+    uint16_t text_width = strlen(str) * char_width;
+
+    if (text_width <= max_width) {
+        ssd1306_draw_string(x, y, str);
+        return;
+    }
+    if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT) {
+        return;
+    }
+    if (max_width > SSD1306_WIDTH - x) {
+        max_width = SSD1306_WIDTH - x;
+    }
+
+    uint16_t period = text_width + SSD1306_SCROLL_GAP;
+    uint16_t pos = offset % period;
+    for (uint8_t i = 0; i < max_width; i++) {
+        uint8_t bits = 0;
+        if (pos < text_width) {
+            uint8_t col = pos % char_width;
+            if (col < FONT_WIDTH) {
+                bits = ssd1306_glyph(str[pos / char_width])[col];
+            }
+        }
+        ssd1306_blit_column(x + i, y, bits, FONT_HEIGHT);
+        if (++pos == period) {
+            pos = 0;
+        }
+    }
+}
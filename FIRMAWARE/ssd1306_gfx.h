@@ -0,0 +1,32 @@
+/*
+ * Кадров буфер на SSD1306 и изрисуване на текст
+ * Не зависи от Pico SDK - може да се компилира и измерва на хоста (tools/oled_bench.c)
+ */
+
+#ifndef SSD1306_GFX_H
+#define SSD1306_GFX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SSD1306_WIDTH 128
+#define SSD1306_HEIGHT 64
+#define SSD1306_PAGES (SSD1306_HEIGHT / 8)
+
+// Кеш на изрисувани редове текст
+#define SSD1306_LINE_CACHE_SIZE 12   // Редове (колкото се виждат в най-пълното меню + резерва)
+#define SSD1306_LINE_MAX_CHARS 21    // Символи, които се събират на ред
+#define SSD1306_SCROLL_GAP 24        // Празнина между повторенията на бягащ ред (пиксели)
+
+// Страница по страница, по една колона на байт (бит 0 = горе) - както в паметта на дисплея
+extern uint8_t ssd1306_framebuffer[SSD1306_WIDTH * SSD1306_PAGES];
+
+// Функции
+void ssd1306_clear(void);
+void ssd1306_set_pixel(uint8_t x, uint8_t y, bool on);
+void ssd1306_draw_char(uint8_t x, uint8_t y, char c);
+void ssd1306_draw_string(uint8_t x, uint8_t y, const char *str);
+void ssd1306_line_cache_stats(uint32_t *hits, uint32_t *misses);
+void ssd1306_draw_string_scroll(uint8_t x, uint8_t y, const char *str, uint8_t max_width, uint16_t offset);
+
+#endif // SSD1306_GFX_H
@@ -0,0 +1,49 @@
+/*
+ * Заместител на hardware/dma.h за тестове на хоста
+ * Прехвърлянето се изпълнява от теста при dma_start_channel_mask.
+ */
+
+#ifndef HOST_HARDWARE_DMA_H
+#define HOST_HARDWARE_DMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DMA_SNIFF_CTRL_CALC_VALUE_CRC16 0x2
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2
+};
+
+typedef struct {
+    enum dma_channel_transfer_size size;
+    uint32_t dreq;
+    bool read_increment;
+    bool write_increment;
+    bool sniff;
+} dma_channel_config;
+
+typedef struct {
+    volatile uint32_t transfer_count;
+} dma_channel_hw_t;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(unsigned channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_dreq(dma_channel_config *c, unsigned dreq);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff);
+void dma_channel_configure(unsigned channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned transfer_count, bool trigger);
+void dma_start_channel_mask(uint32_t chan_mask);
+bool dma_channel_is_busy(unsigned channel);
+void dma_channel_abort(unsigned channel);
+dma_channel_hw_t *dma_channel_hw_addr(unsigned channel);
+void dma_sniffer_enable(unsigned channel, unsigned mode, bool force_channel_enable);
+void dma_sniffer_set_data_accumulator(uint32_t seed_value);
+uint32_t dma_sniffer_get_data_accumulator(void);
+
+#endif // HOST_HARDWARE_DMA_H
@@ -0,0 +1,26 @@
+/*
+ * Заместител на hardware/gpio.h за тестове на хоста
+ */
+
+#ifndef HOST_HARDWARE_GPIO_H
+#define HOST_HARDWARE_GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+typedef enum {
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_SIO = 5
+} gpio_function_t;
+
+void gpio_init(uint32_t gpio);
+void gpio_set_function(uint32_t gpio, gpio_function_t fn);
+void gpio_set_dir(uint32_t gpio, bool out);
+void gpio_pull_up(uint32_t gpio);
+void gpio_put(uint32_t gpio, bool value);
+bool gpio_get(uint32_t gpio);
+
+#endif // HOST_HARDWARE_GPIO_H
@@ -0,0 +1,12 @@
+/*
+ * Заместител на hardware/pio.h за тестове на хоста
+ */
+
+#ifndef HOST_HARDWARE_PIO_H
+#define HOST_HARDWARE_PIO_H
+
+typedef unsigned int uint;
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+#endif // HOST_HARDWARE_PIO_H
@@ -0,0 +1,31 @@
+/*
+ * Заместител на hardware/spi.h за тестове на хоста
+ * Байтовете по шината отиват в модела на картата в теста.
+ */
+
+#ifndef HOST_HARDWARE_SPI_H
+#define HOST_HARDWARE_SPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    volatile uint32_t dr;            // Адресът се използва само като цел/източник на DMA
+} spi_hw_t;
+
+typedef struct spi_inst spi_inst_t;
+
+// Както в SDK: инстанцията е адресът на регистрите
+extern spi_hw_t host_spi0_hw;
+#define spi0 ((spi_inst_t *)&host_spi0_hw)
+
+uint32_t spi_init(spi_inst_t *spi, uint32_t baudrate);
+uint32_t spi_set_baudrate(spi_inst_t *spi, uint32_t baudrate);
+uint32_t spi_get_baudrate(const spi_inst_t *spi);
+spi_hw_t *spi_get_hw(spi_inst_t *spi);
+uint32_t spi_get_dreq(spi_inst_t *spi, bool is_tx);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+
+#endif // HOST_HARDWARE_SPI_H
@@ -0,0 +1,16 @@
+/*
+ * Заместител на Pico SDK за тестове на хоста (tools/sd_card_test.c)
+ * Само декларациите, които използват тестваните модули; реализацията е в теста.
+ */
+
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+uint32_t time_us_32(void);
+void sleep_ms(uint32_t ms);
+
+#endif // HOST_PICO_STDLIB_H
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""
+Декодиране на двоичния лог от CLI командата "log raw" / "log stream on raw".
+
+Таблицата със събитията се чете от LOG_EVENTS в log.h, така че декодерът
+винаги съответства на фърмуера от същото дърво.
+
+Използване:
+    python3 tools/log_decode.py [capture.txt] [--header ../log.h]
+Без файл се чете стандартният вход (например директно от серийния порт).
+"""
+
+import argparse
+import os
+import re
+import sys
+
+LEVEL_NAMES = {
+    "LOG_LEVEL_ERROR": "error",
+    "LOG_LEVEL_WARN": "warn",
+    "LOG_LEVEL_INFO": "info",
+    "LOG_LEVEL_DEBUG": "debug",
+}
+
+EVENT_RE = re.compile(r'X\(\s*(\w+)\s*,\s*(LOG_LEVEL_\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+RECORD_RE = re.compile(r'L ([0-9A-F]{8}) ([0-9A-F]{4}) ([0-9A-F]{4}) ([0-9A-F]{8}) ([0-9A-F]{8})')
+SPEC_RE = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?l*[diuxXc]')
+
+
+def load_events(header):
+    with open(header, encoding="utf-8") as f:
+        text = f.read()
+    start = text.index("#define LOG_EVENTS(X)")
+    events = []
+    for name, level, fmt in EVENT_RE.findall(text[start:]):
+        events.append((name, LEVEL_NAMES.get(level, level), fmt))
+    return events
+
+
+def format_record(events, time_us, event, args):
+    if event >= len(events):
+        return "[%10u] ? събитие %u" % (time_us // 1000, event)
+    name, level, fmt = events[event]
+    # Форматът използва само първите N аргумента
+    fmt = SPEC_RE.sub(lambda m: m.group(0).replace("l", ""), fmt)
+    count = len(SPEC_RE.findall(fmt))
+    return "[%10u] %s: %s" % (time_us // 1000, level, fmt % tuple(args[:count]))
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Декодиране на двоичния лог")
+    parser.add_argument("capture", nargs="?", help="Файл със записан изход (по подразбиране stdin)")
+    parser.add_argument("--header", default=os.path.join(here, "..", "log.h"), help="Път до log.h")
+    opts = parser.parse_args()
+
+    events = load_events(opts.header)
+    source = open(opts.capture, encoding="utf-8", errors="replace") if opts.capture else sys.stdin
+
+    last_seq = None
+    for line in source:
+        match = RECORD_RE.search(line)
+        if not match:
+            continue
+        time_us, event, seq, arg0, arg1 = (int(v, 16) for v in match.groups())
+
+        # Пропуснати записи (буферът е презаписан преди извеждането)
+        if last_seq is not None and seq != (last_seq + 1) & 0xFFFF:
+            print("... пропуснати %u записа" % ((seq - last_seq - 1) & 0xFFFF))
+        last_seq = seq
+
+        print(format_record(events, time_us, event, [arg0, arg1]))
+
+
+if __name__ == "__main__":
+    main()
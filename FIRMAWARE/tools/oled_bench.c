@@ -0,0 +1,157 @@
+/*
+ * Измерване на изрисуването на кадри на хоста (ssd1306_gfx.c + font_5x7.c)
+ *
+ * Сравнява предишното изрисуване пиксел по пиксел с колоните от глифовете и
+ * кеша на редове: кадри в секунда за неподвижно меню (кешът е топъл), за меню,
+ * което се превърта (на всеки кадър влиза нов ред), и за бягащ ред. Проверява
+ * и че двата начина дават един и същ кадров буфер.
+ *
+ * Използване (от FIRMAWARE):
+ *     cc -O2 -I. tools/oled_bench.c ssd1306_gfx.c font_5x7.c -o oled_bench
+ *     ./oled_bench [кадри]
+ * Абсолютните стойности са за хоста; съотношенията са ориентир за RP2040.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "ssd1306_gfx.h"
+#include "font_5x7.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MENU_LINES 6
+#define MENU_LINE_HEIGHT 9               // Редовете не са подравнени на страници
+#define NAME_COUNT 40                    // Повече от SSD1306_LINE_CACHE_SIZE
+
+static char names[NAME_COUNT][SSD1306_LINE_MAX_CHARS + 1];
+static volatile uint8_t sink;
+
+// ============================================================================
+// Предишното изрисуване - пиксел по пиксел през ssd1306_set_pixel
+// ============================================================================
+
+static void ref_draw_char(uint8_t x, uint8_t y, char c) {
+    const uint8_t *glyph = font_get_glyph((uint8_t)c);
+    if (!glyph) {
+        glyph = font_get_glyph('?');
+    }
+    for (int i = 0; i < FONT_WIDTH; i++) {
+        for (int j = 0; j < FONT_HEIGHT; j++) {
+            ssd1306_set_pixel(x + i, y + j, (glyph[i] >> j) & 0x01);
+        }
+    }
+}
+
+static void ref_draw_string(uint8_t x, uint8_t y, const char *str) {
+    uint8_t pos_x = x;
+    while (*str && pos_x < SSD1306_WIDTH - FONT_WIDTH) {
+        ref_draw_char(pos_x, y, *str++);
+        pos_x += FONT_WIDTH + FONT_CHAR_SPACING;
+    }
+}
+
+// ============================================================================
+// Кадри
+// ============================================================================
+
+typedef void (*draw_string_fn)(uint8_t x, uint8_t y, const char *str);
+
+// Заглавие + MENU_LINES имена, започващи от first
+static void draw_menu(draw_string_fn draw, uint16_t first) {
+    ssd1306_clear();
+    draw(0, 0, "Disk 1: select image");
+    for (uint8_t i = 0; i < MENU_LINES; i++) {
+        draw(6, 10 + i * MENU_LINE_HEIGHT, names[(first + i) % NAME_COUNT]);
+    }
+    sink ^= ssd1306_framebuffer[first % sizeof(ssd1306_framebuffer)];
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, uint32_t frames, double seconds, double base_fps) {
+    double fps = frames / seconds;
+    // Подравняване по символи (имената са UTF-8)
+    int width = 0;
+    for (const char *p = name; *p; p++) {
+        width += ((uint8_t)*p & 0xC0) != 0x80;
+    }
+    printf("%s%*s %10.0f кадъра/s  %7.2f us/кадър", name, width < 28 ? 28 - width : 0, "", fps, 1e6 / fps);
+    if (base_fps > 0) {
+        printf("  x%.1f", fps / base_fps);
+    }
+    printf("\n");
+}
+
+static double bench_menu(const char *name, draw_string_fn draw, bool moving, uint32_t frames, double base_fps) {
+    double start = now_s();
+    for (uint32_t f = 0; f < frames; f++) {
+        draw_menu(draw, moving ? f : 0);
+    }
+    double seconds = now_s() - start;
+    report(name, frames, seconds, base_fps);
+    return frames / seconds;
+}
+
+// Менюто, изрисувано по двата начина, трябва да е байт по байт еднакво
+static bool verify(void) {
+    static uint8_t expected[sizeof(ssd1306_framebuffer)];
+
+    for (uint16_t first = 0; first < NAME_COUNT; first++) {
+        draw_menu(ref_draw_string, first);
+        memcpy(expected, ssd1306_framebuffer, sizeof(expected));
+        draw_menu(ssd1306_draw_string, first);
+        if (memcmp(expected, ssd1306_framebuffer, sizeof(expected)) != 0) {
+            printf("Разлика в кадъра при първи ред %u\n", first);
+            return false;
+        }
+    }
+
+    // Отделен символ на неподравнен ред и до края на дисплея
+    ssd1306_clear();
+    ref_draw_char(SSD1306_WIDTH - FONT_WIDTH, SSD1306_HEIGHT - FONT_HEIGHT + 3, 'W');
+    memcpy(expected, ssd1306_framebuffer, sizeof(expected));
+    ssd1306_clear();
+    ssd1306_draw_char(SSD1306_WIDTH - FONT_WIDTH, SSD1306_HEIGHT - FONT_HEIGHT + 3, 'W');
+    if (memcmp(expected, ssd1306_framebuffer, sizeof(expected)) != 0) {
+        printf("Разлика при символ в долния край\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t frames = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 20000;
+
+    for (uint8_t i = 0; i < NAME_COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "GAME%02u - DISK %c.DSK", i, 'A' + i % 4);
+    }
+
+    if (!verify()) {
+        return 1;
+    }
+    printf("Кадровият буфер съвпада с изрисуването пиксел по пиксел\n\n");
+
+    double base = bench_menu("пиксел по пиксел", ref_draw_string, false, frames, 0);
+    bench_menu("колони, неподвижно меню", ssd1306_draw_string, false, frames, base);
+    bench_menu("колони, превъртане", ssd1306_draw_string, true, frames, base);
+
+    // Бягащ ред на всеки кадър (името не се събира в прозореца)
+    double start = now_s();
+    for (uint32_t f = 0; f < frames; f++) {
+        ssd1306_clear();
+        ssd1306_draw_string_scroll(0, 28, "A VERY LONG IMAGE NAME THAT SCROLLS.DSK", SSD1306_WIDTH, f);
+        sink ^= ssd1306_framebuffer[f % sizeof(ssd1306_framebuffer)];
+    }
+    report("бягащ ред", frames, now_s() - start, 0);
+
+    uint32_t hits, misses;
+    ssd1306_line_cache_stats(&hits, &misses);
+    printf("\nКеш на редове: %u попадения, %u пропуска\n", (unsigned)hits, (unsigned)misses);
+    return 0;
+}
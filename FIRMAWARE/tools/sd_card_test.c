@@ -0,0 +1,517 @@
+/*
+ * Тест на машината на състоянията в sd_card.c на хоста
+ *
+ * SPI шината, DMA каналите и часовникът са заместени (tools/host): байтовете
+ * отиват в модел на SD карта в SPI режим (CMD17/CMD24, токени, data response,
+ * зает), а DMA прехвърлянето се изпълнява наведнъж при стартирането му или
+ * "увисва", за да изтече SD_DMA_TIMEOUT_US. Проверява се цял блок през DMA,
+ * повторен опит след DMA timeout, отказ след SD_MAX_ATTEMPTS и прехвърлянето
+ * без DMA, когато няма свободни канали.
+ *
+ * Използване (от FIRMAWARE):
+ *     cc -std=c99 -Itools/host -I. tools/sd_card_test.c sd_card.c -o sd_card_test
+ *     ./sd_card_test
+ */
+
+#include "sd_card.h"
+#include "config.h"
+#include "log.h"
+#include "perf.h"
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_PIN_CS 17
+#define CARD_BLOCKS 16
+#define CARD_BUSY_BYTES 40               // Байтове 0x00 след запис (картата програмира)
+#define DMA_CHANNELS 4
+#define MAX_EVENTS 64
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  ГРЕШКА %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+// ============================================================================
+// Модел на SD картата (SDSC - адресът е в байтове)
+// ============================================================================
+
+typedef enum {
+    CARD_COMMAND = 0,                // Чака 6-байтова команда
+    CARD_WRITE_TOKEN,                // CMD24: чака старт токен 0xFE
+    CARD_WRITE_DATA                  // CMD24: 512 байта + CRC16
+} card_mode_t;
+
+static struct {
+    bool selected;                   // CS е нисък
+    card_mode_t mode;
+    uint8_t frame[6];
+    uint8_t frame_len;
+    uint8_t out[SD_BLOCK_SIZE + 8];  // Отговорът, който картата подава по MISO
+    uint16_t out_len;
+    uint16_t out_pos;
+    uint16_t rx_count;
+    uint32_t block;
+    uint16_t busy;
+    uint32_t bytes;                  // Всички байтове, минали през шината при нисък CS
+    uint8_t blocks[CARD_BLOCKS][SD_BLOCK_SIZE];
+} card;
+
+static void card_queue(uint8_t byte) {
+    card.out[card.out_len++] = byte;
+}
+
+static void card_command(void) {
+    uint8_t cmd = card.frame[0] & 0x3F;
+    uint32_t address = ((uint32_t)card.frame[1] << 24) | ((uint32_t)card.frame[2] << 16) |
+                       ((uint32_t)card.frame[3] << 8) | card.frame[4];
+
+    card.out_len = 0;
+    card.out_pos = 0;
+    card.block = address / SD_BLOCK_SIZE;
+    card_queue(0xFF);                // R1 идва един байт след командата
+
+    if ((cmd == 17 || cmd == 24) && card.block < CARD_BLOCKS) {
+        card_queue(0x00);
+        if (cmd == 17) {
+            card_queue(0xFF);
+            card_queue(0xFE);
+            for (uint16_t i = 0; i < SD_BLOCK_SIZE; i++) {
+                card_queue(card.blocks[card.block][i]);
+            }
+            card_queue(0xAA);        // CRC16 (без CMD59 не се проверява)
+            card_queue(0xBB);
+        } else {
+            card.mode = CARD_WRITE_TOKEN;
+        }
+        return;
+    }
+    card_queue(0x05);                // Illegal command
+}
+
+// Един байт по шината: MOSI от драйвера, MISO от картата
+static uint8_t card_xfer(uint8_t mosi) {
+    if (!card.selected) {
+        return 0xFF;
+    }
+    card.bytes++;
+
+    uint8_t miso = 0xFF;
+    if (card.out_pos < card.out_len) {
+        miso = card.out[card.out_pos++];
+    } else if (card.busy) {
+        card.busy--;
+        miso = 0x00;
+    }
+
+    switch (card.mode) {
+        case CARD_COMMAND:
+            if (card.frame_len == 0 && (mosi & 0xC0) != 0x40) {
+                break;
+            }
+            card.frame[card.frame_len++] = mosi;
+            if (card.frame_len == sizeof(card.frame)) {
+                card.frame_len = 0;
+                card_command();
+            }
+            break;
+        case CARD_WRITE_TOKEN:
+            if (mosi == 0xFE) {
+                card.mode = CARD_WRITE_DATA;
+                card.rx_count = 0;
+            }
+            break;
+        case CARD_WRITE_DATA:
+            if (card.rx_count < SD_BLOCK_SIZE) {
+                card.blocks[card.block][card.rx_count] = mosi;
+            }
+            if (++card.rx_count == SD_BLOCK_SIZE + 2) {
+                card.out_len = 0;
+                card.out_pos = 0;
+                card_queue(0xE5);    // Data accepted
+                card.busy = CARD_BUSY_BYTES;
+                card.mode = CARD_COMMAND;
+            }
+            break;
+    }
+    return miso;
+}
+
+// ============================================================================
+// Заместители на Pico SDK
+// ============================================================================
+
+spi_hw_t host_spi0_hw;
+gpio_config_t gpio_config;
+
+static uint32_t now_us = 0;
+static uint32_t spi_baudrate = 0;
+
+uint32_t time_us_32(void) {
+    // Всяко четене на часовника е малко по-късно - крайните срокове изтичат
+    now_us += 50;
+    return now_us;
+}
+
+void sleep_ms(uint32_t ms) {
+    now_us += ms * 1000;
+}
+
+void gpio_init(uint32_t gpio) { (void)gpio; }
+void gpio_set_function(uint32_t gpio, gpio_function_t fn) { (void)gpio; (void)fn; }
+void gpio_set_dir(uint32_t gpio, bool out) { (void)gpio; (void)out; }
+void gpio_pull_up(uint32_t gpio) { (void)gpio; }
+bool gpio_get(uint32_t gpio) { (void)gpio; return false; }
+
+void gpio_put(uint32_t gpio, bool value) {
+    if (gpio != TEST_PIN_CS) {
+        return;
+    }
+    card.selected = !value;
+    if (value) {
+        // CS високо прекъсва командата; програмирането (busy) продължава
+        card.frame_len = 0;
+        card.out_len = 0;
+        card.out_pos = 0;
+        card.mode = CARD_COMMAND;
+    }
+}
+
+uint32_t spi_init(spi_inst_t *spi, uint32_t baudrate) { (void)spi; return spi_baudrate = baudrate; }
+uint32_t spi_set_baudrate(spi_inst_t *spi, uint32_t baudrate) { (void)spi; return spi_baudrate = baudrate; }
+uint32_t spi_get_baudrate(const spi_inst_t *spi) { (void)spi; return spi_baudrate; }
+spi_hw_t *spi_get_hw(spi_inst_t *spi) { (void)spi; return &host_spi0_hw; }
+uint32_t spi_get_dreq(spi_inst_t *spi, bool is_tx) { (void)spi; return is_tx ? 16 : 17; }
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len) {
+    (void)spi;
+    for (size_t i = 0; i < len; i++) {
+        card_xfer(src[i]);
+    }
+    return (int)len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len) {
+    (void)spi;
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = card_xfer(repeated_tx_data);
+    }
+    return (int)len;
+}
+
+typedef struct {
+    dma_channel_config config;
+    volatile void *write_addr;
+    const volatile void *read_addr;
+    unsigned count;
+    bool busy;
+} dma_mock_channel_t;
+
+static dma_mock_channel_t dma_channels[DMA_CHANNELS];
+static dma_channel_hw_t dma_hw[DMA_CHANNELS];
+static int dma_free = 0;             // Свободни канали за dma_claim_unused_channel
+static int dma_next = 0;
+static int dma_stall = 0;            // Толкова поредни прехвърляния "увисват"
+static uint32_t dma_starts = 0;
+static uint32_t dma_aborts = 0;
+
+int dma_claim_unused_channel(bool required) {
+    (void)required;
+    if (dma_free == 0 || dma_next >= DMA_CHANNELS) {
+        return -1;
+    }
+    dma_free--;
+    return dma_next++;
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned channel) {
+    (void)channel;
+    dma_channel_config c = { DMA_SIZE_32, 0, true, false, false };
+    return c;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { c->size = size; }
+void channel_config_set_dreq(dma_channel_config *c, unsigned dreq) { c->dreq = dreq; }
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff) { c->sniff = sniff; }
+
+void dma_channel_configure(unsigned channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned transfer_count, bool trigger) {
+    dma_mock_channel_t *ch = &dma_channels[channel];
+    ch->config = *config;
+    ch->write_addr = write_addr;
+    ch->read_addr = read_addr;
+    ch->count = transfer_count;
+    dma_hw[channel].transfer_count = transfer_count;
+    if (trigger) {
+        dma_start_channel_mask(1u << channel);
+    }
+}
+
+// Двойката TX/RX канали към SPI регистъра данни минава наведнъж (или увисва)
+void dma_start_channel_mask(uint32_t chan_mask) {
+    dma_mock_channel_t *tx = NULL;
+    dma_mock_channel_t *rx = NULL;
+    unsigned tx_index = 0;
+    unsigned rx_index = 0;
+
+    for (unsigned i = 0; i < DMA_CHANNELS; i++) {
+        if (!(chan_mask & (1u << i))) {
+            continue;
+        }
+        if (dma_channels[i].write_addr == &host_spi0_hw.dr) {
+            tx = &dma_channels[i];
+            tx_index = i;
+        } else if (dma_channels[i].read_addr == &host_spi0_hw.dr) {
+            rx = &dma_channels[i];
+            rx_index = i;
+        }
+    }
+    dma_starts++;
+    CHECK(tx && rx && tx->count == rx->count);
+    CHECK(tx && rx && tx->config.size == DMA_SIZE_8 && rx->config.size == DMA_SIZE_8);
+    if (!tx || !rx) {
+        return;
+    }
+
+    if (dma_stall > 0) {
+        dma_stall--;
+        tx->busy = rx->busy = true;
+        return;
+    }
+
+    const volatile uint8_t *src = tx->read_addr;
+    volatile uint8_t *dst = rx->write_addr;
+    for (unsigned i = 0; i < tx->count; i++) {
+        uint8_t miso = card_xfer(tx->config.read_increment ? src[i] : src[0]);
+        if (rx->config.write_increment) {
+            dst[i] = miso;
+        } else {
+            dst[0] = miso;
+        }
+    }
+    dma_hw[tx_index].transfer_count = 0;
+    dma_hw[rx_index].transfer_count = 0;
+}
+
+bool dma_channel_is_busy(unsigned channel) {
+    return dma_channels[channel].busy;
+}
+
+void dma_channel_abort(unsigned channel) {
+    dma_channels[channel].busy = false;
+    dma_aborts++;
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(unsigned channel) {
+    return &dma_hw[channel];
+}
+
+void dma_sniffer_enable(unsigned channel, unsigned mode, bool force_channel_enable) {
+    (void)channel; (void)mode; (void)force_channel_enable;
+}
+void dma_sniffer_set_data_accumulator(uint32_t seed_value) { (void)seed_value; }
+uint32_t dma_sniffer_get_data_accumulator(void) { return 0; }
+
+// ============================================================================
+// Заместители на лога и perf
+// ============================================================================
+
+static struct {
+    log_event_t event;
+    uint32_t arg0;
+    uint32_t arg1;
+} events[MAX_EVENTS];
+static uint16_t event_count = 0;
+
+void log_event(log_event_t event, uint32_t arg0, uint32_t arg1) {
+    if (event_count < MAX_EVENTS) {
+        events[event_count].event = event;
+        events[event_count].arg0 = arg0;
+        events[event_count].arg1 = arg1;
+        event_count++;
+    }
+}
+
+void perf_record(perf_id_t id, uint32_t start_us) {
+    (void)id; (void)start_us;
+}
+
+static uint16_t events_of(log_event_t event) {
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < event_count; i++) {
+        n += events[i].event == event;
+    }
+    return n;
+}
+
+// ============================================================================
+// Тестове
+// ============================================================================
+
+static void reset_counters(void) {
+    event_count = 0;
+    dma_starts = 0;
+    dma_aborts = 0;
+    card.bytes = 0;
+}
+
+static void fill_block(uint8_t *data, uint8_t seed) {
+    for (uint16_t i = 0; i < SD_BLOCK_SIZE; i++) {
+        data[i] = (uint8_t)(seed + i * 7);
+    }
+}
+
+// Асинхронна заявка, движена само от sd_card_task()
+static void run_request(sd_request_t *req) {
+    CHECK(sd_card_submit(req));
+    for (uint32_t i = 0; req->busy && i < 1000000; i++) {
+        sd_card_task();
+    }
+    CHECK(!req->busy);
+}
+
+// Без свободни DMA канали блокът минава с spi_*_blocking
+static void test_blocking_fallback(void) {
+    uint8_t data[SD_BLOCK_SIZE];
+    uint8_t buffer[SD_BLOCK_SIZE];
+
+    printf("без DMA канали\n");
+    reset_counters();
+    dma_free = 0;
+    sd_spi_init();
+
+    fill_block(card.blocks[3], 0x31);
+    CHECK(sd_read_block(3, buffer));
+    CHECK(memcmp(buffer, card.blocks[3], SD_BLOCK_SIZE) == 0);
+
+    fill_block(data, 0x52);
+    CHECK(sd_write_block(5, data));
+    CHECK(sd_card_sync());
+    CHECK(memcmp(card.blocks[5], data, SD_BLOCK_SIZE) == 0);
+
+    CHECK(dma_starts == 0);
+    CHECK(event_count == 0);
+    CHECK(!card.selected);
+}
+
+// Цял блок с едно DMA прехвърляне - четене и запис
+static void test_dma_block(void) {
+    uint8_t data[SD_BLOCK_SIZE];
+    uint8_t buffer[SD_BLOCK_SIZE];
+
+    printf("блок през DMA\n");
+    reset_counters();
+    dma_free = 2;
+    sd_spi_init();
+
+    fill_block(card.blocks[7], 0x07);
+    memset(buffer, 0, sizeof(buffer));
+    sd_request_t read = { .op = SD_OP_READ, .block = 7, .buffer = buffer };
+    run_request(&read);
+    CHECK(read.ok && read.attempts == 1);
+    CHECK(memcmp(buffer, card.blocks[7], SD_BLOCK_SIZE) == 0);
+    CHECK(dma_starts == 1);
+
+    fill_block(data, 0x99);
+    sd_request_t write = { .op = SD_OP_WRITE, .block = 9, .buffer = data, .count = 1 };
+    run_request(&write);
+    CHECK(write.ok && write.attempts == 1);
+    CHECK(memcmp(card.blocks[9], data, SD_BLOCK_SIZE) == 0);
+    CHECK(dma_starts == 2);
+
+    // Следващата заявка изчаква края на програмирането на записа
+    CHECK(sd_read_block(9, buffer));
+    CHECK(memcmp(buffer, data, SD_BLOCK_SIZE) == 0);
+    CHECK(card.busy == 0);
+
+    CHECK(event_count == 0);
+    CHECK(!card.selected);
+}
+
+// Увиснало DMA: след SD_DMA_TIMEOUT_US каналите се спират и блокът се чете наново
+static void test_dma_timeout_retry(void) {
+    uint8_t buffer[SD_BLOCK_SIZE];
+
+    printf("DMA timeout и повторен опит\n");
+    reset_counters();
+    fill_block(card.blocks[11], 0xC3);
+    memset(buffer, 0, sizeof(buffer));
+
+    dma_stall = 1;
+    uint32_t start = now_us;
+    sd_request_t read = { .op = SD_OP_READ, .block = 11, .buffer = buffer };
+    run_request(&read);
+
+    CHECK(read.ok && read.attempts == 2);
+    CHECK(memcmp(buffer, card.blocks[11], SD_BLOCK_SIZE) == 0);
+    CHECK(dma_starts == 2);
+    CHECK(dma_aborts == 2);
+    CHECK(now_us - start >= SD_DMA_TIMEOUT_US + SD_RETRY_DELAY_US);
+    // Грешката от неокончателния опит не се записва - само насроченият повторен опит
+    CHECK(events_of(LOG_SD_RETRY) == 1);
+    CHECK(events_of(LOG_SD_DMA_TIMEOUT) == 0);
+    CHECK(!sd_card_suspect());
+    CHECK(!card.selected);
+}
+
+// DMA увисва при всеки опит: заявката завършва с грешка и LOG_SD_DMA_TIMEOUT
+static void test_dma_timeout_fail(void) {
+    uint8_t data[SD_BLOCK_SIZE];
+
+    printf("DMA timeout при всички опити\n");
+    reset_counters();
+    fill_block(data, 0x44);
+    memset(card.blocks[12], 0, SD_BLOCK_SIZE);
+
+    dma_stall = SD_MAX_ATTEMPTS;
+    sd_request_t write = { .op = SD_OP_WRITE, .block = 12, .buffer = data, .count = 1 };
+    run_request(&write);
+
+    CHECK(!write.ok && write.attempts == SD_MAX_ATTEMPTS);
+    CHECK(dma_starts == SD_MAX_ATTEMPTS);
+    CHECK(events_of(LOG_SD_RETRY) == SD_MAX_ATTEMPTS - 1);
+    CHECK(events_of(LOG_SD_DMA_TIMEOUT) == 1);
+    for (uint16_t i = 0; i < event_count; i++) {
+        if (events[i].event == LOG_SD_DMA_TIMEOUT) {
+            CHECK(events[i].arg0 == SD_BLOCK_SIZE);   // Непрехвърлени байтове
+            CHECK(events[i].arg1 == 12);
+        }
+    }
+    CHECK(sd_card_suspect());
+    CHECK(!card.selected);
+
+    // Картата отново отговаря - следващата заявка минава
+    reset_counters();
+    uint8_t buffer[SD_BLOCK_SIZE];
+    CHECK(sd_write_block(12, data));
+    CHECK(sd_read_block(12, buffer));
+    CHECK(memcmp(buffer, data, SD_BLOCK_SIZE) == 0);
+    CHECK(!sd_card_suspect());
+}
+
+int main(void) {
+    gpio_config.sd_cs = TEST_PIN_CS;
+    gpio_config.sd_detect = GPIO_NONE;
+
+    // Без свободни канали първо - sd_spi_init() заема каналите само веднъж
+    test_blocking_fallback();
+    test_dma_block();
+    test_dma_timeout_retry();
+    test_dma_timeout_fail();
+
+    if (failures) {
+        printf("%d грешки\n", failures);
+        return 1;
+    }
+    printf("Всички тестове минаха\n");
+    return 0;
+}
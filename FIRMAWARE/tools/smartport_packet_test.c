@@ -0,0 +1,154 @@
+/*
+ * Тест на кодирането на SmartPort пакети (smartport_packet.c) на хоста
+ *
+ * Пакетите се сравняват с фиксирани байтове по шината, сметнати на ръка:
+ * синхронизация, PBEGIN, заглавие, байтовете със старшите битове (първият
+ * байт е в бит 6), двата байта на контролната сума и PEND. Проверява се и
+ * блок от 512 байта (ODDCNT = 0x81, GRP7CNT = 0xC9), декодирането му обратно
+ * и отхвърлянето на пакет с грешен PEND или грешна контролна сума.
+ *
+ * Използване (от FIRMAWARE):
+ *     cc -std=c99 -I. tools/smartport_packet_test.c smartport_packet.c -o smartport_packet_test
+ *     ./smartport_packet_test
+ */
+
+#include "smartport_packet.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_WIRE_LEN (SP_SYNC_LEN + 1 + SP_HEADER_LEN + 2 + 73 * 8 + 2 + 1)
+#define BLOCK_DATA_START (SP_SYNC_LEN + 1 + SP_HEADER_LEN)
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  ГРЕШКА %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static uint8_t wire[SP_PACKET_MAX_ENCODED];
+static sp_packet_t packet;
+static sp_packet_t decoded;
+
+// Отговор на STATUS от том 1: общ статус 0xF8 и 0x0118 блока
+// Контролна сума: XOR на заглавието (0x84) и данните (0xE1) = 0x65
+static const uint8_t status_wire[] = {
+    0xFF, 0x3F, 0xCF, 0xF3, 0xFC, 0xFF,          // Синхронизация
+    0xC3,                                        // PBEGIN
+    0x80, 0x81, 0x81, 0x80, 0x80, 0x84, 0x80,    // DEST, SRC, TYPE, AUX, STAT, ODDCNT, GRP7CNT
+    0xC0, 0xF8, 0x98, 0x81, 0x80,                // Старши битове (само 0xF8 има), 4 нечетни байта
+    0xEF, 0xBA,                                  // Четните и нечетните битове на 0x65
+    0xC8                                         // PEND
+};
+
+static void test_status_reply(void) {
+    printf("Кратък отговор (4 нечетни байта)\n");
+
+    memset(&packet, 0, sizeof(packet));
+    packet.dest = 0x00;
+    packet.source = 0x01;
+    packet.type = SP_TYPE_STATUS;
+    packet.length = 4;
+    packet.data[0] = 0xF8;
+    packet.data[1] = 0x18;
+    packet.data[2] = 0x01;
+    packet.data[3] = 0x00;
+
+    uint16_t len = sp_packet_encode(&packet, wire, sizeof(wire));
+    CHECK(len == sizeof(status_wire));
+    CHECK(memcmp(wire, status_wire, sizeof(status_wire)) == 0);
+
+    CHECK(sp_packet_decode(status_wire, sizeof(status_wire), &decoded));
+    CHECK(decoded.source == 0x01 && decoded.type == SP_TYPE_STATUS && decoded.length == 4);
+    CHECK(memcmp(decoded.data, packet.data, 4) == 0);
+}
+
+// Блок 0..255, 0..255 от том 2 към хоста
+// Контролна сума: XOR на заглавието (0xC8), данните се унищожават взаимно
+static void test_block(void) {
+    printf("Блок от 512 байта\n");
+
+    memset(&packet, 0, sizeof(packet));
+    packet.dest = 0x00;
+    packet.source = 0x02;
+    packet.type = SP_TYPE_DATA;
+    packet.length = SP_MAX_DATA;
+    for (uint16_t i = 0; i < SP_MAX_DATA; i++) {
+        packet.data[i] = i & 0xFF;
+    }
+
+    uint16_t len = sp_packet_encode(&packet, wire, sizeof(wire));
+    CHECK(len == BLOCK_WIRE_LEN);
+
+    static const uint8_t header[] = { 0xC3, 0x80, 0x82, 0x82, 0x80, 0x80, 0x81, 0xC9 };
+    CHECK(memcmp(wire + SP_SYNC_LEN, header, sizeof(header)) == 0);
+
+    // Нечетният байт 0x00, после групата с байтове 1..7
+    const uint8_t *data = wire + BLOCK_DATA_START;
+    CHECK(data[0] == 0x80 && data[1] == 0x80);
+    CHECK(data[2] == 0x80 && data[3] == 0x81 && data[9] == 0x87);
+
+    // Група 18 е байтове 127..133: само 127 е без старши бит (бит 6 на байта)
+    const uint8_t *group = data + 2 + 18 * 8;
+    CHECK(group[0] == 0xBF);
+    CHECK(group[1] == 0xFF && group[2] == 0x80 && group[7] == 0x85);
+
+    // Група 36 е байтове 253..259: 253..255 със старши бит, после 0..3
+    group = data + 2 + 36 * 8;
+    CHECK(group[0] == 0xF0);
+    CHECK(group[1] == 0xFD && group[4] == 0x80);
+
+    CHECK(wire[len - 3] == 0xEA && wire[len - 2] == 0xEE);
+    CHECK(wire[len - 1] == SP_PACKET_END);
+
+    memset(&decoded, 0, sizeof(decoded));
+    CHECK(sp_packet_decode(wire, len, &decoded));
+    CHECK(decoded.source == 0x02 && decoded.type == SP_TYPE_DATA && decoded.length == SP_MAX_DATA);
+    CHECK(memcmp(decoded.data, packet.data, SP_MAX_DATA) == 0);
+
+    // Пакетът може да започва направо от PBEGIN
+    CHECK(sp_packet_decode(wire + SP_SYNC_LEN, len - SP_SYNC_LEN, &decoded));
+}
+
+static void test_rejected(void) {
+    uint8_t bad[sizeof(status_wire)];
+
+    printf("Повредени пакети\n");
+
+    memcpy(bad, status_wire, sizeof(bad));
+    bad[sizeof(bad) - 1] = 0xC9;
+    CHECK(!sp_packet_decode(bad, sizeof(bad), &decoded));
+
+    memcpy(bad, status_wire, sizeof(bad));
+    bad[15] ^= 0x01;                             // Бит от данните
+    CHECK(!sp_packet_decode(bad, sizeof(bad), &decoded));
+
+    memcpy(bad, status_wire, sizeof(bad));
+    bad[14] = 0x80;                              // Изгубен старши бит на 0xF8
+    CHECK(!sp_packet_decode(bad, sizeof(bad), &decoded));
+
+    memcpy(bad, status_wire, sizeof(bad));
+    bad[sizeof(bad) - 2] ^= 0x04;                // Бит от контролната сума
+    CHECK(!sp_packet_decode(bad, sizeof(bad), &decoded));
+
+    // Отрязан пакет и ODDCNT от 7 байта
+    CHECK(!sp_packet_decode(status_wire, sizeof(status_wire) - 1, &decoded));
+    memcpy(bad, status_wire, sizeof(bad));
+    bad[12] = 0x87;
+    CHECK(!sp_packet_decode(bad, sizeof(bad), &decoded));
+}
+
+int main(void) {
+    test_status_reply();
+    test_block();
+    test_rejected();
+
+    if (failures > 0) {
+        printf("%d грешки\n", failures);
+        return 1;
+    }
+    printf("Всички тестове минаха\n");
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Попадения в кеша на пътеки при трасе на позициониране от DOS 3.3 (на хоста)
+ *
+ * Трасето е като при работа с файлове: каталог и VTOC на пътека 17, после
+ * пътеките на файла (T/S списък и 1-4 пътеки данни), с връщане на пътека 17
+ * между файловете и между записите. При позициониране главата минава през
+ * междинните пътеки за ~3 ms на стъпка, а на целевата стои поне един оборот.
+ * Най-лошият случай: всяка стъпка зарежда пътеката под главата, а (във втория
+ * проход) на всяка стъпка в същата посока се зарежда и пътеката пред главата -
+ * +2 при бързите стъпки, както в drive_plan_prefetch.
+ *
+ * Сравняват се два начина с реалния track_cache.c:
+ *   всяко зареждане - всяка заредена пътека и предварителните влизат в LRU
+ *   престой         - в LRU влизат само пътеките, на които главата е стояла,
+ *                     а предварителните - в отделните си записи
+ *
+ * Използване (от FIRMAWARE), с различен брой LRU записи:
+ *     cc -std=c99 -Itools/host -I. -DTRACK_CACHE_ENTRIES=2 tools/track_cache_trace.c track_cache.c -o trace
+ *     ./trace [операции]
+ */
+
+#include "track_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_TRACKS 35
+#define CATALOG_TRACK 17
+#define STEP_US 3000                     // Стъпка при позициониране
+#define DWELL_US 200000                  // Престой на целевата пътека (един оборот)
+
+typedef enum {
+    POLICY_EVERY_LOAD = 0,
+    POLICY_DWELL
+} policy_t;
+
+typedef struct {
+    uint32_t loads;                      // Смени на пътеката в буфера
+    uint32_t sd_reads;                   // Четения от картата (главата + предварителни)
+    uint32_t dwell_loads;                // Пътеки, на които главата остава
+    uint32_t dwell_hits;
+    uint32_t catalog_returns;            // Връщания на пътека 17
+    uint32_t catalog_hits;
+} trace_stats_t;
+
+static drive_t drive;
+static policy_t policy;
+static bool prefetch;
+static trace_stats_t stats;
+static uint32_t now_us;
+static uint32_t rng = 12345;
+
+static uint32_t trace_random(uint32_t range) {
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 16) % range;
+}
+
+// Зареждане на пътеката под главата (както drive_read_track)
+static void trace_load(bool dwell) {
+    drive_t *d = &drive;
+    if (d->buffer_track == d->track) {
+        return;
+    }
+    stats.loads++;
+
+    if (policy == POLICY_DWELL) {
+        track_cache_keep(d);
+    }
+    bool hit = track_cache_fetch(d, d->track);
+    if (!hit) {
+        stats.sd_reads++;
+        memset(d->track_buffer, d->track, sizeof(d->track_buffer));
+        d->stream_len = 16;
+    }
+    d->buffer_track = d->track;
+    d->resident.image = 1;
+    if (!hit && policy == POLICY_EVERY_LOAD) {
+        track_cache_store(d);
+    }
+
+    if (dwell) {
+        stats.dwell_loads++;
+        stats.dwell_hits += hit;
+        if (d->track == CATALOG_TRACK) {
+            stats.catalog_returns++;
+            stats.catalog_hits += hit;
+        }
+    }
+}
+
+// Предварително зареждане на пътеката пред главата (както drive_prefetch_track)
+static void trace_prefetch(uint8_t track) {
+    if (track >= TRACE_TRACKS || track == drive.buffer_track || track_cache_contains(drive.id, track)) {
+        return;
+    }
+    track_cache_entry_t *entry = (policy == POLICY_DWELL) ?
+        track_cache_claim_speculative(drive.id, track) : track_cache_claim(drive.id, track);
+    memset(entry->data, track, sizeof(entry->data));
+    entry->stream_len = 16;
+    track_cache_commit(entry);
+    stats.sd_reads++;
+}
+
+// Позициониране: стъпка по стъпка, зареждане на всяка междинна пътека
+static void trace_seek(uint8_t target) {
+    drive_t *d = &drive;
+    while (d->track != target) {
+        int8_t dir = target > d->track ? 1 : -1;
+        uint8_t next = d->track + dir;
+
+        if (policy == POLICY_DWELL) {
+            track_cache_leave(d, now_us);
+        }
+        d->step_time = now_us;
+        d->track = next;
+        now_us += STEP_US;
+
+        trace_load(d->track == target);
+        if (prefetch && dir == d->step_dir) {
+            trace_prefetch((uint8_t)(next + dir * (STEP_US < DRIVE_FAST_STEP_US ? 2 : 1)));
+        }
+        d->step_dir = dir;
+    }
+    now_us += DWELL_US;
+}
+
+static uint8_t trace_data_track(void) {
+    uint8_t track;
+    do {
+        track = 3 + trace_random(TRACE_TRACKS - 3);
+    } while (track == CATALOG_TRACK);
+    return track;
+}
+
+static void trace_run(policy_t p, bool with_prefetch, uint32_t operations) {
+    policy = p;
+    prefetch = with_prefetch;
+    rng = 12345;
+    now_us = 0;
+    memset(&stats, 0, sizeof(stats));
+    memset(&drive, 0, sizeof(drive));
+    drive.buffer_track = DRIVE_TRACK_NONE;
+    drive.prefetch_track = DRIVE_TRACK_NONE;
+    track_cache_init();
+
+    for (uint32_t op = 0; op < operations; op++) {
+        uint8_t track = trace_data_track();
+        if (trace_random(2) == 0) {
+            // Отваряне и четене на файл: каталог, T/S списък, пътеките с данни
+            uint8_t length = 1 + trace_random(4);
+            trace_seek(CATALOG_TRACK);
+            trace_seek(track);
+            for (uint8_t i = 1; i < length && track + i < TRACE_TRACKS; i++) {
+                trace_seek(track + i);
+            }
+        } else {
+            // Запис в отворен файл: VTOC на пътека 17 и пътеката с данни
+            trace_seek(track);
+            trace_seek(CATALOG_TRACK);
+            trace_seek(track);
+        }
+    }
+
+    printf("%s%*s %7u %9u %7u/%-7u %5.1f%% %7u/%-7u %5.1f%%\n",
+           p == POLICY_DWELL ? "престой" : "всяко зареждане", p == POLICY_DWELL ? 9 : 1, "",
+           (unsigned)stats.loads, (unsigned)stats.sd_reads,
+           (unsigned)stats.dwell_hits, (unsigned)stats.dwell_loads,
+           100.0 * stats.dwell_hits / (stats.dwell_loads ? stats.dwell_loads : 1),
+           (unsigned)stats.catalog_hits, (unsigned)stats.catalog_returns,
+           100.0 * stats.catalog_hits / (stats.catalog_returns ? stats.catalog_returns : 1));
+}
+
+int main(int argc, char **argv) {
+    uint32_t operations = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 2000;
+
+    printf("LRU записи: %u, предварителни: %u, операции: %u\n\n",
+           TRACK_CACHE_ENTRIES, TRACK_CACHE_SPECULATIVE, (unsigned)operations);
+    for (int with_prefetch = 0; with_prefetch < 2; with_prefetch++) {
+        printf("%s\n", with_prefetch ? "С предварително зареждане:" : "Без предварително зареждане:");
+        printf("%-16s %7s %9s %15s %6s %15s %6s\n",
+               "", "смени", "SD четения", "престой: попад.", "", "пътека 17", "");
+        trace_run(POLICY_EVERY_LOAD, with_prefetch, operations);
+        trace_run(POLICY_DWELL, with_prefetch, operations);
+        printf("\n");
+    }
+    return 0;
+}
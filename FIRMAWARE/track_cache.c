@@ -0,0 +1,236 @@
+/*
+ * LRU кеш на пътеки и записи за предварително заредените
+ *
+ * cache[0 .. TRACK_CACHE_ENTRIES-1] - LRU; след тях - предварителните записи.
+ * Изтласква се записът с най-малко попадения, при равенство - най-старият:
+ * пътека 17 (VTOC, каталог) натрупва попадения и остава, докато пътеките с
+ * данни се сменят в другите записи. Изтласканите пътеки се помнят (само номер
+ * и брояч) - пътека, заредена наново от картата, продължава с брояча си, дори
+ * да е изтласкана преди първото си попадение. На всеки TRACK_CACHE_DECAY нови
+ * пътеки броячите се намаляват наполовина - смененият диск не държи старите.
+ */
+
+#include "track_cache.h"
+#include <string.h>
+
+#define TRACK_CACHE_TOTAL (TRACK_CACHE_ENTRIES + TRACK_CACHE_SPECULATIVE)
+
+static track_cache_entry_t cache[TRACK_CACHE_TOTAL];
+static uint32_t cache_clock = 0;
+static uint32_t cache_hits = 0;
+static uint32_t cache_misses = 0;
+static uint32_t cache_claims = 0;
+
+// Изтласканите LRU записи (без данните)
+typedef struct {
+    bool valid;
+    uint8_t drive;
+    uint8_t track;
+    uint8_t hits;
+} track_cache_ghost_t;
+
+static track_cache_ghost_t ghosts[TRACK_CACHE_HISTORY];
+static uint8_t ghost_next = 0;
+
+static track_cache_entry_t* track_cache_find_in(uint8_t first, uint8_t count, uint8_t drive, uint8_t track) {
+    for (uint8_t i = first; i < first + count; i++) {
+        if (cache[i].valid && cache[i].drive == drive && cache[i].track == track) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+static track_cache_entry_t* track_cache_find(uint8_t drive, uint8_t track) {
+    return track_cache_find_in(0, TRACK_CACHE_TOTAL, drive, track);
+}
+
+// Брояч на пътеката от историята на изтласканите (и махане от нея)
+static uint8_t track_cache_recall(uint8_t drive, uint8_t track) {
+    for (uint8_t i = 0; i < TRACK_CACHE_HISTORY; i++) {
+        if (ghosts[i].valid && ghosts[i].drive == drive && ghosts[i].track == track) {
+            ghosts[i].valid = false;
+            // Повторното зареждане е попадение, което кешът е пропуснал
+            return ghosts[i].hits < UINT8_MAX ? ghosts[i].hits + 1 : UINT8_MAX;
+        }
+    }
+    return 0;
+}
+
+static void track_cache_forget(const track_cache_entry_t *entry) {
+    ghosts[ghost_next].valid = true;
+    ghosts[ghost_next].drive = entry->drive;
+    ghosts[ghost_next].track = entry->track;
+    ghosts[ghost_next].hits = entry->hits;
+    ghost_next = (ghost_next + 1) % TRACK_CACHE_HISTORY;
+}
+
+static void track_cache_decay(void) {
+    for (uint8_t i = 0; i < TRACK_CACHE_ENTRIES; i++) {
+        cache[i].hits >>= 1;
+    }
+    for (uint8_t i = 0; i < TRACK_CACHE_HISTORY; i++) {
+        ghosts[i].hits >>= 1;
+    }
+}
+
+// Същата пътека, свободен запис или записът с най-малко попадения в областта
+static track_cache_entry_t* track_cache_claim_in(uint8_t first, uint8_t count, uint8_t drive, uint8_t track) {
+    track_cache_entry_t *entry = track_cache_find_in(first, count, drive, track);
+    if (!entry) {
+        // Свободен запис или най-малко попадения, при равенство най-старият
+        entry = &cache[first];
+        for (uint8_t i = first; i < first + count; i++) {
+            if (!cache[i].valid) {
+                entry = &cache[i];
+                break;
+            }
+            if (cache[i].hits < entry->hits ||
+                (cache[i].hits == entry->hits && cache[i].age < entry->age)) {
+                entry = &cache[i];
+            }
+        }
+        entry->hits = 0;
+
+        // История и стареене само за пътеките, на които главата е стояла
+        if (first == 0) {
+            if (entry->valid) {
+                track_cache_forget(entry);
+            }
+            entry->hits = track_cache_recall(drive, track);
+            if (++cache_claims % TRACK_CACHE_DECAY == 0) {
+                track_cache_decay();
+            }
+        }
+    }
+
+    entry->valid = false;
+    entry->drive = drive;
+    entry->track = track;
+    return entry;
+}
+
+void track_cache_init(void) {
+    memset(cache, 0, sizeof(cache));
+    memset(ghosts, 0, sizeof(ghosts));
+    cache_clock = 0;
+    cache_hits = 0;
+    cache_misses = 0;
+}
+
+// Копиране на пътеката от кеша в буфера и потока на устройството
+bool track_cache_fetch(drive_t *d, uint8_t track) {
+    track_cache_entry_t *entry = track_cache_find(d->id, track);
+    if (!entry) {
+        cache_misses++;
+        return false;
+    }
+
+    memcpy(d->track_buffer, entry->data, sizeof(entry->data));
+    memcpy(d->stream, entry->stream, entry->stream_len);
+    d->stream_len = entry->stream_len;
+    entry->age = ++cache_clock;
+    cache_hits++;
+    if (entry->hits < UINT8_MAX) {
+        entry->hits++;
+    }
+    return true;
+}
+
+bool track_cache_contains(uint8_t drive, uint8_t track) {
+    return track_cache_find(drive, track) != NULL;
+}
+
+// LRU запис за попълване (пътека, на която главата е стояла)
+// Записът е невалиден до track_cache_commit; предварителното копие на пътеката се освобождава
+track_cache_entry_t* track_cache_claim(uint8_t drive, uint8_t track) {
+    track_cache_entry_t *spare = track_cache_find_in(TRACK_CACHE_ENTRIES, TRACK_CACHE_SPECULATIVE, drive, track);
+    track_cache_entry_t *entry = track_cache_claim_in(0, TRACK_CACHE_ENTRIES, drive, track);
+    if (spare) {
+        // Попаденията в предварителното копие се пренасят
+        spare->valid = false;
+        if (spare->hits > entry->hits) {
+            entry->hits = spare->hits;
+        }
+    }
+    return entry;
+}
+
+// Запис за предварително зареждане - не изтласква LRU записите
+track_cache_entry_t* track_cache_claim_speculative(uint8_t drive, uint8_t track) {
+    return track_cache_claim_in(TRACK_CACHE_ENTRIES, TRACK_CACHE_SPECULATIVE, drive, track);
+}
+
+void track_cache_commit(track_cache_entry_t *entry) {
+    entry->age = ++cache_clock;
+    entry->valid = true;
+}
+
+// Главата напуска пътеката си (преди d->track и d->step_time да се сменят):
+// буферът ще влезе в LRU, само ако главата е стояла на пътеката в него
+void track_cache_leave(drive_t *d, uint32_t now) {
+    if (d->track == d->buffer_track && now - d->step_time >= TRACK_CACHE_DWELL_US) {
+        d->buffer_dwelt = true;
+    }
+}
+
+// Буферът ще бъде презаписан с друга пътека - запазва се, ако главата е стояла на нея
+// и съвпада с имиджа (незаписаният или изоставен буфер не е)
+void track_cache_keep(drive_t *d) {
+    if (d->buffer_dwelt && d->buffer_track != DRIVE_TRACK_NONE && !d->flush_pending &&
+        d->resident.image != 0 &&
+        !track_cache_find_in(0, TRACK_CACHE_ENTRIES, d->id, d->buffer_track)) {
+        track_cache_store(d);
+    }
+    d->buffer_dwelt = false;
+}
+
+// Запазване на пътеката в буфера на устройството (на която главата е стояла или е записала)
+void track_cache_store(const drive_t *d) {
+    if (d->buffer_track == DRIVE_TRACK_NONE) {
+        return;
+    }
+
+    track_cache_entry_t *entry = track_cache_claim(d->id, d->buffer_track);
+    entry->stream_len = d->stream_len;
+    memcpy(entry->data, d->track_buffer, sizeof(entry->data));
+    memcpy(entry->stream, d->stream, d->stream_len);
+    track_cache_commit(entry);
+}
+
+// Секторът е променен - копието в кеша вече не е вярно
+void track_cache_invalidate(uint8_t drive, uint8_t track) {
+    track_cache_entry_t *entry;
+    while ((entry = track_cache_find(drive, track)) != NULL) {
+        entry->valid = false;
+    }
+}
+
+// Смяна или изваждане на диска
+void track_cache_invalidate_drive(uint8_t drive) {
+    for (uint8_t i = 0; i < TRACK_CACHE_TOTAL; i++) {
+        if (cache[i].drive == drive) {
+            cache[i].valid = false;
+        }
+    }
+    for (uint8_t i = 0; i < TRACK_CACHE_HISTORY; i++) {
+        if (ghosts[i].drive == drive) {
+            ghosts[i].valid = false;
+        }
+    }
+}
+
+uint8_t track_cache_used(void) {
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < TRACK_CACHE_TOTAL; i++) {
+        if (cache[i].valid) {
+            used++;
+        }
+    }
+    return used;
+}
+
+void track_cache_stats(uint32_t *hits, uint32_t *misses) {
+    if (hits) *hits = cache_hits;
+    if (misses) *misses = cache_misses;
+}
@@ -0,0 +1,65 @@
+/*
+ * LRU кеш на пътеки - секторните данни заедно с вече кодирания GCR поток
+ *
+ * Повторно посещение на пътека (DOS 3.3 постоянно се връща на пътека 17 -
+ * VTOC и каталог) се обслужва от RAM без четене от картата и без кодиране.
+ * RAM идва от страничния каталог в disk_manager_t (в RAM е само една страница).
+ *
+ * В LRU частта влизат само пътеки, на които главата е стояла поне
+ * TRACK_CACHE_DWELL_US - прескочените при позициониране не изместват пътека 17.
+ * Предварителните зареждания (посоката на главата, профилът на имиджа) имат
+ * собствени TRACK_CACHE_SPECULATIVE записа и никога не изместват LRU записите.
+ *
+ * .bss бюджет (запис = 4096 данни + 16 * 517 поток = ~12.4 KB):
+ *   буфери на устройствата: DRIVE_COUNT * 12.4 KB = ~24.7 KB (drive_t, и без кеша)
+ *   кеш: (2 + 1) * 12.4 KB = ~37 KB
+ * Страничният каталог освободи ~35 KB (images[50] -> една страница); кешът е
+ * с ~2 KB над тази сума. tools/track_cache_trace.c (DOS 3.3 трасе: пътека 17 и
+ * файлове по 1-4 пътеки, зареждане на всяка прескочена пътека) - при 2 записа
+ * връщането на пътека 17 е попадение в 99.9% от случаите (3 и 4 записа: 100%).
+ */
+
+#ifndef TRACK_CACHE_H
+#define TRACK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "drive.h"
+
+#ifndef TRACK_CACHE_ENTRIES
+#define TRACK_CACHE_ENTRIES 2        // LRU записи, по ~12.4 KB (4 KB данни + 8.1 KB поток)
+#endif
+#ifndef TRACK_CACHE_SPECULATIVE
+#define TRACK_CACHE_SPECULATIVE 1    // Записи за предварително заредените пътеки
+#endif
+#define TRACK_CACHE_HISTORY 8        // Изтласкани пътеки, чийто брояч се помни
+#define TRACK_CACHE_DECAY 32          // Нови пътеки между две намалявания на броячите
+#define TRACK_CACHE_DWELL_US 20000   // Главата е стояла на пътеката (стъпките при позициониране са ~3 ms)
+
+typedef struct {
+    bool valid;
+    uint8_t drive;
+    uint8_t track;
+    uint32_t age;                    // Последно използване (за LRU)
+    uint8_t hits;                    // Попадения (намаляват наполовина с времето)
+    uint16_t stream_len;
+    uint8_t data[DRIVE_TRACK_BUFFER_SIZE];
+    uint8_t stream[DRIVE_STREAM_SIZE];
+} track_cache_entry_t;
+
+// Функции
+void track_cache_init(void);
+bool track_cache_fetch(drive_t *d, uint8_t track);
+bool track_cache_contains(uint8_t drive, uint8_t track);
+void track_cache_store(const drive_t *d);
+track_cache_entry_t* track_cache_claim(uint8_t drive, uint8_t track);
+track_cache_entry_t* track_cache_claim_speculative(uint8_t drive, uint8_t track);
+void track_cache_leave(drive_t *d, uint32_t now);
+void track_cache_keep(drive_t *d);
+void track_cache_commit(track_cache_entry_t *entry);
+void track_cache_invalidate(uint8_t drive, uint8_t track);
+void track_cache_invalidate_drive(uint8_t drive);
+uint8_t track_cache_used(void);
+void track_cache_stats(uint32_t *hits, uint32_t *misses);
+
+#endif // TRACK_CACHE_H